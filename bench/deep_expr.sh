@@ -0,0 +1,44 @@
+#!/bin/sh
+# Compiles and runs expressions nested DEPTH levels deep, 1,000,000 by
+# default, to check that parsing and every later pass handle them without
+# overflowing the stack.
+#
+# usage: bench/deep_expr.sh [depth]
+
+set -e
+
+BASALT=${BASALT:-$(pwd)/bin/basalt}
+DEPTH=${1:-1000000}
+DIR=$(mktemp -d)
+trap 'rm -rf "$DIR"' EXIT
+
+# ((...(1)+1)...)+1 - (DEPTH + 1) evaluates to 0
+python3 - "$DIR" "$DEPTH" <<'EOF'
+import sys
+dir, depth = sys.argv[1], int(sys.argv[2])
+with open(dir + "/grouping.bs", "w") as out:
+    out.write("fn main() int\n    return " + "(" * depth + "1" + ")+1" * depth + " - %d\nend\n" % (depth + 1))
+with open(dir + "/call.bs", "w") as out:
+    out.write("fn id(v: int) int\n    return v\nend\n\nfn main() int\n    return " + "id(" * depth + "0" + ")" * depth + "\nend\n")
+EOF
+
+status=0
+cd "$DIR"
+for name in grouping call; do
+    start=$(date +%s%N)
+    if ! "$BASALT" $name.bs > /dev/null; then
+        echo "$name: failed to compile"
+        status=1
+        continue
+    fi
+    end=$(date +%s%N)
+
+    if ./$name; then
+        echo "$name: depth $DEPTH compiled in $(( (end - start) / 1000000 ))ms"
+    else
+        echo "$name: exited with $? instead of 0"
+        status=1
+    fi
+done
+
+exit $status
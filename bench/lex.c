@@ -0,0 +1,50 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "lexer.h"
+#include "source.h"
+#include "token.h"
+
+// Lexes a file several times and reports the best throughput, keeping the
+// lexer apart from the parser and every later pass
+int main(int argc, char** argv) {
+    if(argc != 2) {
+        fprintf(stderr, "usage: %s <file>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    Source src;
+    if(!source_open(&src, argv[1]))
+        return EXIT_FAILURE;
+    current_source = &src;
+
+    double best = 0.0;
+    size_t n_tokens = 0;
+    for(int run = 0; run < 5; ++run) {
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+        Lexer lex = { .source = src.data, .source_len = src.len };
+        Token tok;
+        n_tokens = 0;
+        do {
+            if(!lexer_collect_token(&lex, &tok))
+                return EXIT_FAILURE;
+            ++n_tokens;
+        } while(tok.type != TOK_EOF);
+
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        const double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+        if(run == 0 || seconds < best)
+            best = seconds;
+    }
+
+    printf("%zu tokens in %.3fs, %.1f Mtok/s, %.1f MB/s\n",
+        n_tokens, best,
+        n_tokens / best / 1e6, src.len / best / 1e6
+    );
+
+    source_close(&src);
+    return EXIT_SUCCESS;
+}
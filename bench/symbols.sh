@@ -0,0 +1,42 @@
+#!/bin/sh
+# Times compiling N globals plus N/4 functions referencing them, for each N
+# given, to check that symbol lookup stays constant time as the table grows.
+# Assembling and linking are stubbed out so only the compiler is measured.
+#
+# usage: bench/symbols.sh [N...]
+
+set -e
+
+BASALT=${BASALT:-$(pwd)/bin/basalt}
+DIR=$(mktemp -d)
+trap 'rm -rf "$DIR"' EXIT
+
+mkdir "$DIR/stubs"
+for tool in yasm ld; do
+    printf '#!/bin/sh\nexit 0\n' > "$DIR/stubs/$tool"
+    chmod +x "$DIR/stubs/$tool"
+done
+
+[ $# -gt 0 ] || set -- 25000 50000 100000
+
+echo "N        compile"
+for n in "$@"; do
+    python3 - "$DIR/symbols.bs" "$n" <<'EOF'
+import sys
+path, n = sys.argv[1], int(sys.argv[2])
+with open(path, "w") as out:
+    for i in range(n):
+        out.write("var g%d: int = %d\n" % (i, i))
+    for i in range(0, n, 4):
+        out.write("fn f%d(a: int) int\n" % i)
+        out.write("    g%d = g%d + a * g%d\n" % (i, i, (i * 7) % n))
+        out.write("    return g%d + a\n" % ((i * 13) % n))
+        out.write("end\n")
+    out.write("fn main() int\n    return f0(1)\nend\n")
+EOF
+
+    start=$(date +%s%N)
+    (cd "$DIR" && PATH="$DIR/stubs:$PATH" "$BASALT" symbols.bs > /dev/null)
+    end=$(date +%s%N)
+    printf "%-8s %dms\n" "$n" $(( (end - start) / 1000000 ))
+done
@@ -0,0 +1,75 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+
+#define ARENA_BLOCK_SIZE (64 * 1024)
+#define ARENA_ALIGNMENT 16
+
+static ArenaBlock* arena_block_create(size_t size, ArenaBlock* next) {
+    ArenaBlock* block = malloc(sizeof(ArenaBlock) + size);
+    block->next = next;
+    block->used = 0;
+    block->size = size;
+    return block;
+}
+
+void* arena_alloc(Arena* arena, size_t size) {
+    size = (size + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+
+    ArenaBlock* block = arena->blocks;
+    if(!block || block->size - block->used < size) {
+        if(size > ARENA_BLOCK_SIZE / 4) {
+            // Large allocations get a block of their own behind the current
+            // one, so the space left in the current block is not wasted
+            ArenaBlock* large = arena_block_create(size, block ? block->next : NULL);
+            if(block)
+                block->next = large;
+            else
+                arena->blocks = large;
+            large->used = size;
+            return large->data;
+        }
+
+        block = arena_block_create(ARENA_BLOCK_SIZE, block);
+        arena->blocks = block;
+    }
+
+    void* result = block->data + block->used;
+    block->used += size;
+    return result;
+}
+
+void* arena_copy(Arena* arena, const void* data, size_t size) {
+    void* result = arena_alloc(arena, size);
+    memcpy(result, data, size);
+    return result;
+}
+
+// Releases every allocation but keeps the most recent block around, so an
+// arena which is reset regularly settles without touching malloc
+void arena_reset(Arena* arena) {
+    if(!arena->blocks)
+        return;
+
+    ArenaBlock* keep = arena->blocks;
+    ArenaBlock* block = keep->next;
+    while(block) {
+        ArenaBlock* next = block->next;
+        free(block);
+        block = next;
+    }
+
+    keep->next = NULL;
+    keep->used = 0;
+}
+
+void arena_free(Arena* arena) {
+    ArenaBlock* block = arena->blocks;
+    while(block) {
+        ArenaBlock* next = block->next;
+        free(block);
+        block = next;
+    }
+    arena->blocks = NULL;
+}
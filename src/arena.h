@@ -0,0 +1,23 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+// Bump allocator. Allocations cannot be freed individually, everything is
+// released at once by resetting or freeing the arena.
+typedef struct _ArenaBlock {
+    struct _ArenaBlock* next;
+    size_t used, size;
+    _Alignas(16) char data[];
+} ArenaBlock;
+
+typedef struct {
+    ArenaBlock* blocks;
+} Arena;
+
+void* arena_alloc(Arena* arena, size_t size);
+void* arena_copy(Arena* arena, const void* data, size_t size);
+void arena_reset(Arena* arena);
+void arena_free(Arena* arena);
+
+#endif // ARENA_H
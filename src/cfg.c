@@ -0,0 +1,190 @@
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "cfg.h"
+#include "expr.h"
+#include "walk.h"
+
+// Blocks are built by walking the function's body with an explicit stack, so
+// deeply nested statements need no recursion. Items are only ever added to
+// `current`, and no block becomes current twice, so the items of each block
+// end up contiguous.
+static ExprWalk walk = { 0 };
+static BlockId current = BLOCK_NONE;
+
+static BlockId new_block(Cfg* cfg) {
+    if(cfg->n_blocks == cfg->blocks_capacity) {
+        cfg->blocks_capacity = cfg->blocks_capacity ? cfg->blocks_capacity * 2 : 64;
+        cfg->blocks = realloc(cfg->blocks, sizeof(BasicBlock) * cfg->blocks_capacity);
+    }
+
+    cfg->blocks[cfg->n_blocks] = (BasicBlock) { .succs = { BLOCK_NONE, BLOCK_NONE } };
+    return cfg->n_blocks++;
+}
+
+static void enter_block(Cfg* cfg, BlockId block) {
+    current = block;
+    cfg->blocks[block].first_item = cfg->n_items;
+}
+
+static void add_edge(Cfg* cfg, BlockId from, BlockId to) {
+    BasicBlock* block = &cfg->blocks[from];
+    block->succs[block->succs[0] == BLOCK_NONE ? 0 : 1] = to;
+}
+
+static void add_item(Cfg* cfg, Expr* expr) {
+    if(cfg->n_items == cfg->items_capacity) {
+        cfg->items_capacity = cfg->items_capacity ? cfg->items_capacity * 2 : 256;
+        cfg->items = realloc(cfg->items, sizeof(CfgItem) * cfg->items_capacity);
+    }
+
+    cfg->items[cfg->n_items++] = (CfgItem) { .first = expr_first_node(expr), .last = expr };
+    ++cfg->blocks[current].n_items;
+}
+
+// Ends the current block with the condition of an if statement or loop
+static void add_branch(Cfg* cfg, Expr* condition, BlockId if_true, BlockId if_false) {
+    add_item(cfg, condition);
+    cfg->blocks[current].branches = true;
+    add_edge(cfg, current, if_true);
+    add_edge(cfg, current, if_false);
+}
+
+// If statements are given consecutive blocks for their body, their else body
+// if they have one, and the code following them. The first of these is
+// carried in `data`.
+static void build_if(Cfg* cfg, Expr* expr, uint32_t step, BlockId first) {
+    const bool has_else = expr->if_stmt.else_body != 0;
+    const BlockId join = has_else ? first + 2 : first + 1;
+
+    switch(step) {
+        case 0: {
+            const BlockId if_body = new_block(cfg);
+            if(has_else)
+                new_block(cfg);
+            new_block(cfg);
+
+            add_branch(cfg, expr_child(expr, expr->if_stmt.condition), if_body, if_body + 1);
+            enter_block(cfg, if_body);
+            walk_push(&walk, expr, 1, if_body);
+            walk_push_list(&walk, expr_child(expr, expr->if_stmt.if_body), 0, 0);
+            break;
+        }
+
+        case 1:
+            add_edge(cfg, current, join);
+            if(has_else) {
+                enter_block(cfg, first + 1);
+                walk_push(&walk, expr, 2, first);
+                walk_push_list(&walk, expr_child(expr, expr->if_stmt.else_body), 0, 0);
+            } else {
+                enter_block(cfg, join);
+            }
+            break;
+
+        default:
+            add_edge(cfg, current, join);
+            enter_block(cfg, join);
+            break;
+    }
+}
+
+// Loops are given consecutive blocks for their condition, their body and the
+// code following them, the first of which is carried in `data`
+static void build_while(Cfg* cfg, Expr* expr, uint32_t step, BlockId header) {
+    if(step == 0) {
+        header = new_block(cfg);
+        const BlockId body = new_block(cfg);
+        new_block(cfg);
+
+        add_edge(cfg, current, header);
+        enter_block(cfg, header);
+        add_branch(cfg, expr_child(expr, expr->while_loop.condition), body, header + 2);
+        enter_block(cfg, body);
+        walk_push(&walk, expr, 1, header);
+        walk_push_list(&walk, expr_child(expr, expr->while_loop.body), 0, 0);
+        return;
+    }
+
+    add_edge(cfg, current, header);
+    enter_block(cfg, header + 2);
+}
+
+static void build_preds(Cfg* cfg) {
+    for(BlockId i = 0; i < cfg->n_blocks; ++i)
+        cfg->blocks[i].n_preds = 0;
+    for(BlockId i = 0; i < cfg->n_blocks; ++i) {
+        for(uint32_t j = 0; j < cfg_n_succs(&cfg->blocks[i]); ++j)
+            ++cfg->blocks[cfg->blocks[i].succs[j]].n_preds;
+    }
+
+    uint32_t n_preds = 0;
+    for(BlockId i = 0; i < cfg->n_blocks; ++i) {
+        cfg->blocks[i].first_pred = n_preds;
+        n_preds += cfg->blocks[i].n_preds;
+        cfg->blocks[i].n_preds = 0;
+    }
+
+    if(n_preds > cfg->preds_capacity) {
+        cfg->preds_capacity = n_preds;
+        cfg->preds = realloc(cfg->preds, sizeof(BlockId) * cfg->preds_capacity);
+    }
+
+    for(BlockId i = 0; i < cfg->n_blocks; ++i) {
+        for(uint32_t j = 0; j < cfg_n_succs(&cfg->blocks[i]); ++j) {
+            BasicBlock* succ = &cfg->blocks[cfg->blocks[i].succs[j]];
+            cfg->preds[succ->first_pred + succ->n_preds++] = i;
+        }
+    }
+}
+
+// Builds the graph of `fn`'s body into `cfg`, reusing its storage
+void cfg_build(Cfg* cfg, Expr* fn) {
+    cfg->fn = fn;
+    cfg->n_blocks = 0;
+    cfg->n_items = 0;
+
+    new_block(cfg);
+    new_block(cfg);
+    enter_block(cfg, CFG_ENTRY);
+
+    walk_push_list(&walk, expr_child(fn, fn->fn_def.body), 0, 0);
+
+    ExprFrame frame;
+    while(walk_pop(&walk, &frame)) {
+        Expr* expr = frame.expr;
+        switch(expr->tag) {
+            case EXPR_IF:
+                build_if(cfg, expr, frame.step, frame.data);
+                break;
+            case EXPR_WHILE:
+                build_while(cfg, expr, frame.step, frame.data);
+                break;
+            case EXPR_RETURN:
+                add_item(cfg, expr);
+                cfg->blocks[current].returns = true;
+                add_edge(cfg, current, CFG_EXIT);
+                // Anything following a return is unreachable
+                enter_block(cfg, new_block(cfg));
+                break;
+            // Nested functions are not executed where they are defined
+            case EXPR_FN_DEF:
+                break;
+            default:
+                add_item(cfg, expr);
+                break;
+        }
+    }
+
+    // Falling off the end of the body
+    add_edge(cfg, current, CFG_EXIT);
+    build_preds(cfg);
+}
+
+void cfg_free(Cfg* cfg) {
+    free(cfg->blocks);
+    free(cfg->items);
+    free(cfg->preds);
+    *cfg = (Cfg) { 0 };
+    walk_free(&walk);
+}
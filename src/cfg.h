@@ -0,0 +1,64 @@
+#ifndef CFG_H
+#define CFG_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "expr.h"
+
+typedef uint32_t BlockId;
+#define BLOCK_NONE UINT32_MAX
+
+// A straight-line piece of a function body: a statement, or the condition of
+// an if statement or while loop. Its nodes are the contiguous post-order
+// range `first..last`, which contains no control flow, and are evaluated in
+// index order.
+typedef struct {
+    Expr* first;
+    Expr* last;
+} CfgItem;
+
+typedef struct {
+    uint32_t first_item; // Items of a block are stored contiguously
+    uint32_t n_items;
+    // A block which branches ends with its condition and continues at
+    // `succs[0]` when it is true and `succs[1]` when it is false. Any other
+    // block continues at `succs[0]`, unless it is the exit block.
+    BlockId succs[2];
+    uint32_t first_pred;
+    uint32_t n_preds;
+    bool branches;
+    bool returns; // Ends with a return, and so continues at the exit block
+} BasicBlock;
+
+// Control-flow graph of a single function. Every return, and falling off the
+// end of the body, leads to an empty exit block. Statements following a
+// return are placed in blocks with no predecessors.
+typedef struct {
+    Expr* fn;
+    BasicBlock* blocks;
+    uint32_t n_blocks;
+    uint32_t blocks_capacity;
+    CfgItem* items;
+    uint32_t n_items;
+    uint32_t items_capacity;
+    BlockId* preds;
+    uint32_t preds_capacity;
+} Cfg;
+
+#define CFG_ENTRY 0
+#define CFG_EXIT 1
+
+void cfg_build(Cfg* cfg, Expr* fn);
+void cfg_free(Cfg* cfg);
+
+static inline uint32_t cfg_n_succs(const BasicBlock* block) {
+    return (block->succs[0] != BLOCK_NONE) + (block->succs[1] != BLOCK_NONE);
+}
+
+static inline const BlockId* cfg_preds(const Cfg* cfg, BlockId block) {
+    return &cfg->preds[cfg->blocks[block].first_pred];
+}
+
+#endif // CFG_H
@@ -4,62 +4,53 @@
 #include <string.h>
 
 #include "codegen.h"
-#include "expr.h"
 #include "global.h"
+#include "intern.h"
+#include "ir.h"
 #include "symbol.h"
-#include "token.h"
 #include "value.h"
 
-static const char* qregs[] = { "r8", "r9", "r10", "r11", "r12", "r13", "r14", "r15" };          // 64-bit registers
-static const char* dregs[] = { "r8d", "r9d", "r10d", "r11d", "r12d", "r13d", "r14d", "r15d" };  // 32-bit registers
-static const char* wregs[] = { "r8w", "r9w", "r10w", "r11w", "r12w", "r13w", "r14w", "r15w" };  // 16-bit registers
-static const char* bregs[] = { "r8b", "r9b", "r10b", "r11b", "r12b", "r13b", "r14b", "r15b" };  // 8-bit registers
+// Values are given registers by linear scan over the blocks in order. Only
+// callee-saved registers are handed out, so values survive calls, and those a
+// function uses are saved in its frame. Values which do not fit are spilled
+// to slots in the frame. The remaining registers are scratch space and carry
+// arguments and results between functions.
+static const char* qregs[] = { "rbx", "r12", "r13", "r14", "r15" };     // 64-bit registers
+static const char* dregs[] = { "ebx", "r12d", "r13d", "r14d", "r15d" }; // 32-bit registers
+static const char* bregs[] = { "bl", "r12b", "r13b", "r14b", "r15b" };  // 8-bit registers
 #define n_regs (sizeof(qregs) / sizeof(char*))
 
-static int free_regs[n_regs];
-static size_t n_free_regs = n_regs;
-
-static void initialize_registers(void) {
-    for(size_t i = 0; i < n_free_regs; ++i) {
-        free_regs[i] = i;
-    }
-}
-
-static int allocate_register(void) {
-    if(n_free_regs == 0) {
-        fprintf(stderr, "error: failed to allocate register\n");
-        return -1;
-    }
-    
-    return free_regs[--n_free_regs];
-}
-
-static void free_register(int reg) {
-    if(reg == -1)
-        return;
-
-    free_regs[n_free_regs++] = reg;
-}
-
-static const char* get_register(int reg, size_t size) {
-    switch(size) {
-        case 1: return bregs[reg];
-        case 2: return wregs[reg];
-        case 4: return dregs[reg];
-        case 8: return qregs[reg];
-        default:
-            fprintf(stderr, "error: invalid register size %lu\n", size);
-            exit(1);
-    };
-}
-
-// TODO: It might make more sense for the caller of write functions to specify
-// a return register rather than returning them as we do currently. This would
-// both allow us to easily specify a return register for exprs with multiple
-// returns and prevent us from having to return -1 from codegen functions for 
-// exprs with no return values.
-
-static int write_assembly_for_expr(Expr* expr, FILE* out);
+// Arguments beyond these are pushed on the stack
+static const char* arg_regs[] = { "rdi", "rsi", "rdx", "rcx", "r8", "r9" };
+#define n_arg_regs (sizeof(arg_regs) / sizeof(char*))
+
+// Locations are registers below `n_regs` and frame slots from there on.
+// Constants are written out wherever they are used.
+#define LOC_NONE -1
+#define LOC_IMM -2
+#define LOC_TEMP -3 // Holds a value displaced while resolving phis
+
+static const IrFunction* fn = NULL;
+static uint32_t* positions = NULL; // Of each instruction in the order they are written
+static uint32_t* ends = NULL; // Last position at which each value is needed
+static uint32_t* uses = NULL;
+static int* locs = NULL;
+static uint32_t values_capacity = 0;
+
+static uint32_t* block_starts = NULL;
+static uint32_t* block_ends = NULL;
+static IrBlockId* loops = NULL; // Innermost loop header containing each block, or enclosing a header
+static uint32_t* loop_ends = NULL;
+static bool* headers = NULL;
+static IrBlockId* worklist = NULL; // Room for every edge
+static uint32_t blocks_capacity = 0;
+
+static bool used_regs[n_regs];
+static uint32_t n_saved = 0;
+static uint32_t n_slots = 0;
+static bool has_frame = false;
+
+static size_t n_inits = 0;
 
 static void write_globals(FILE* out) {
     fprintf(out, "section .bss\n");
@@ -68,22 +59,23 @@ static void write_globals(FILE* out) {
         // For now we can assume that all global values are strings, but this won't be the case for long
         // TODO: Switch on value tag instead of assuming all globals will be strings
         fprintf(out,
-            "    str_%lu: db \"%s\", 0\n",
+            "    str_%lu: db \"%.*s\", 0\n",
             global_values[i].global_id,
+            (int)global_values[i].val_string_len,
             global_values[i].val_string
         );
     }
 
-    for(size_t i = 0; i < symbol_table_len; ++i) {
-        const Symbol item = symbol_table[i];
+    for(size_t i = 0; i < n_symbols; ++i) {
+        const Symbol item = *symbol_at(i);
 
         if(item.stype == SYM_VAR) {
             switch(item.type) {
                 case VAL_INT:
-                    fprintf(out, "    g_%s: resq 1\n", item.identifier);
+                    fprintf(out, "    g_%s: resq 1\n", intern_str(item.identifier));
                     break;
                 case VAL_BOOL:
-                    fprintf(out, "    g_%s: resb 1\n", item.identifier);
+                    fprintf(out, "    g_%s: resb 1\n", intern_str(item.identifier));
                     break;
 
                 default:
@@ -97,11 +89,13 @@ static void write_globals(FILE* out) {
     fprintf(out, "\n");
 }
 
+// Top-level statements are run before `main`, each chained to the next
 static void write_preamble(FILE* out) {
     fprintf(out,
         "section .text\n"
         "global _start\n\n"
         "_start:\n"
+        "    call _init_0\n"
         "    call fn_main\n"
         // Exit syscall
         "    mov rdi, rax\n"
@@ -110,429 +104,870 @@ static void write_preamble(FILE* out) {
     );
 }
 
-static int write_literal(Expr* expr, FILE* out) {
-    const int reg = allocate_register();
-    switch(expr->literal.value.tag) {
-        case VAL_INT:
-            fprintf(out, "    mov %s, %i\n", get_register(reg, SIZE_INT), expr->literal.value.val_int);
-            break;
-        case VAL_BOOL:
-            fprintf(out, "    mov %s, %i\n", get_register(reg, SIZE_BOOL), expr->literal.value.val_bool);
-            break;
-        case VAL_STRING:
-            fprintf(out, "    mov %s, str_%lu\n", get_register(reg, SIZE_STRING), expr->literal.value.global_id);
-            break;
-        case VAL_IDENTIFIER:
-            if(symbol_exists(expr->literal.value.identifier)) {
-                const Symbol symbol = symbol_get(expr->literal.value.identifier);
-                if(symbol.stype != SYM_VAR) {
-                    fprintf(stderr, "error: symbol '%s' is not a variable\n", expr->literal.value.identifier);
-                    return -1;
-                }
-                fprintf(out, "    mov %s, [g_%s]\n", get_register(reg, get_type_size(symbol.type)), expr->literal.value.identifier);
-            } else if(expr->parent_fn.exists) {
-                for(size_t i = 0; i < expr->parent_fn.n_params; ++i) {
-                    if(strcmp(expr->parent_fn.param_identifiers[i], expr->literal.value.identifier) == 0) {
-                        size_t parameter_offset = 0;
-                        for(size_t j = 0; j < i; ++j) {
-                            parameter_offset = get_type_size(expr->parent_fn.param_types[j]);
-                        }
-                        fprintf(out, "    mov %s, [rsp + %lu]\n", get_register(reg, get_type_size(expr->parent_fn.param_types[i])), parameter_offset);
-                        break;
-                    }
-                }
-            }
-            break;
-        case VAL_NONE:
-        case VAL_ERROR:
-            fprintf(stderr, "error: cannot generate code for value %s\n", type_strs[expr->literal.value.tag]);
-            return -1;
+static void grow_arrays(void) {
+    if(fn->n_insts > values_capacity) {
+        values_capacity = fn->n_insts;
+        positions = realloc(positions, sizeof(uint32_t) * values_capacity);
+        ends = realloc(ends, sizeof(uint32_t) * values_capacity);
+        uses = realloc(uses, sizeof(uint32_t) * values_capacity);
+        locs = realloc(locs, sizeof(int) * values_capacity);
+    }
+    if(fn->n_blocks > blocks_capacity) {
+        blocks_capacity = fn->n_blocks;
+        block_starts = realloc(block_starts, sizeof(uint32_t) * blocks_capacity);
+        block_ends = realloc(block_ends, sizeof(uint32_t) * blocks_capacity);
+        loops = realloc(loops, sizeof(IrBlockId) * blocks_capacity);
+        loop_ends = realloc(loop_ends, sizeof(uint32_t) * blocks_capacity);
+        headers = realloc(headers, sizeof(bool) * blocks_capacity);
+        worklist = realloc(worklist, sizeof(IrBlockId) * blocks_capacity * 2);
     }
+}
 
-    return reg;
+// Finds the natural loops of the function. Blocks are in reverse postorder,
+// so an edge to an earlier block closes a loop, and inner loops have later
+// headers than the loops enclosing them.
+static void find_loops(void) {
+    for(IrBlockId b = 0; b < fn->n_blocks; ++b) {
+        loops[b] = IR_NONE;
+        headers[b] = false;
+    }
+
+    for(IrBlockId h = fn->n_blocks; h-- > 0;) {
+        const IrBlock* header = &fn->blocks[h];
+        uint32_t n_work = 0;
+        for(uint32_t i = 0; i < header->n_preds; ++i) {
+            if(header->preds[i] >= h)
+                worklist[n_work++] = header->preds[i];
+        }
+        if(!n_work)
+            continue;
+
+        headers[h] = true;
+        loop_ends[h] = block_ends[h];
+        while(n_work) {
+            // Inner loops are taken as a whole, by way of their outermost header
+            IrBlockId top = worklist[--n_work];
+            while(loops[top] != IR_NONE)
+                top = loops[top];
+            if(top == h)
+                continue;
+
+            loops[top] = h;
+            const uint32_t end = headers[top] ? loop_ends[top] : block_ends[top];
+            if(end > loop_ends[h])
+                loop_ends[h] = end;
+            for(uint32_t i = 0; i < fn->blocks[top].n_preds; ++i)
+                worklist[n_work++] = fn->blocks[top].preds[i];
+        }
+    }
+
+    // Blocks placed between those of a loop, such as the exits of an inner
+    // loop, fall inside its interval without being part of it. Each block is
+    // given to the innermost loop whose interval it falls inside, and
+    // intervals which overlap without nesting are widened until they do.
+    uint32_t n_open = 0;
+    for(IrBlockId b = 0; b < fn->n_blocks; ++b) {
+        while(n_open && loop_ends[worklist[n_open - 1]] < block_starts[b])
+            --n_open;
+        loops[b] = n_open ? worklist[n_open - 1] : IR_NONE;
+        if(!headers[b])
+            continue;
+
+        for(uint32_t i = n_open; i-- > 0 && loop_ends[worklist[i]] < loop_ends[b];)
+            loop_ends[worklist[i]] = loop_ends[b];
+        worklist[n_open++] = b;
+    }
 }
 
-static int write_unary(Expr* expr, FILE* out) {
-    const int rhs_reg = write_assembly_for_expr(expr->unary.rhs, out);
-    switch(expr->unary.op.type) {
-        case TOK_MINUS:
-            fprintf(out, "    neg %s\n", get_register(rhs_reg, SIZE_INT));
-            break;
-        case TOK_NOT:
-            fprintf(out,
-                "    not %s\n"
-                "    and %s, 1\n",
-                get_register(rhs_reg, SIZE_BOOL),
-                get_register(rhs_reg, SIZE_BOOL)
-            );
-            break;
+// Records a use of `value` at `position` in `block`. A value used within a
+// loop it is defined outside of is needed until the end of that loop.
+static void add_use(IrValue value, IrBlockId block, uint32_t position) {
+    ++uses[value];
 
-        default:
-            fprintf(stderr, "error: unknown unary operation '%s'\n", token_strs[expr->binary.op.type]);
-            return -1;
+    IrBlockId loop = headers[block] ? block : loops[block];
+    for(; loop != IR_NONE && block_starts[loop] > positions[value]; loop = loops[loop]) {
+        if(loop_ends[loop] > position)
+            position = loop_ends[loop];
     }
-    return rhs_reg;
+    if(position > ends[value])
+        ends[value] = position;
 }
 
-static int write_binary(Expr* expr, FILE* out) {
-    const int lhs_reg = write_assembly_for_expr(expr->binary.lhs, out);
-    const int rhs_reg = write_assembly_for_expr(expr->binary.rhs, out);
+static void build_intervals(void) {
+    uint32_t position = 0;
+    for(IrBlockId b = 0; b < fn->n_blocks; ++b) {
+        const IrBlock* block = &fn->blocks[b];
+        block_starts[b] = position;
+        for(uint32_t i = 0; i < block->n_insts; ++i) {
+            positions[block->insts[i]] = position;
+            ends[block->insts[i]] = position;
+            uses[block->insts[i]] = 0;
+            ++position;
+        }
+        block_ends[b] = position - 1;
+    }
 
-    switch(expr->binary.op.type) {
-        case TOK_PLUS:
-            fprintf(out, "    add %s, %s\n",
-                get_register(lhs_reg, SIZE_INT),
-                get_register(rhs_reg, SIZE_INT)
-            );
-            break;
-        case TOK_MINUS:
-            fprintf(out, "    sub %s, %s\n",
-                get_register(lhs_reg, SIZE_INT),
-                get_register(rhs_reg, SIZE_INT)
-            );
-            break;
-        case TOK_STAR:
-            fprintf(out, "    imul %s, %s\n",
-                get_register(lhs_reg, SIZE_INT),
-                get_register(rhs_reg, SIZE_INT)
-            );
-            break;
-        case TOK_SLASH:
-            fprintf(out, 
-                "    mov rax, %s\n"
-                "    xor rdx, rdx\n"
-                "    idiv %s\n"
-                "    mov %s, rax\n",
-                get_register(lhs_reg, SIZE_INT),
-                get_register(rhs_reg, SIZE_INT),
-                get_register(lhs_reg, SIZE_INT)
-            );
-            break;
-        case TOK_EQUAL_EQUAL:
-            fprintf(out, 
-                "    cmp %s, %s\n"
-                "    mov %s, 0\n"
-                "    mov rax, 1\n"
-                "    cmove %s, rax\n",
-                get_register(lhs_reg, SIZE_INT),
-                get_register(rhs_reg, SIZE_INT),
-                get_register(lhs_reg, SIZE_INT),
-                get_register(lhs_reg, SIZE_INT)
-            );
-            break;
-         case TOK_BANG_EQUAL:
-            fprintf(out, 
-                "    cmp %s, %s\n"
-                "    mov %s, 0\n"
-                "    mov rax, 1\n"
-                "    cmovne %s, rax\n",
-                get_register(lhs_reg, SIZE_INT),
-                get_register(rhs_reg, SIZE_INT),
-                get_register(lhs_reg, SIZE_INT),
-                get_register(lhs_reg, SIZE_INT)
-            );
-            break;
-        case TOK_LESS:
-            fprintf(out, 
-                "    cmp %s, %s\n"
-                "    mov %s, 0\n"
-                "    mov rax, 1\n"
-                "    cmovl %s, rax\n",
-                get_register(lhs_reg, SIZE_INT),
-                get_register(rhs_reg, SIZE_INT),
-                get_register(lhs_reg, SIZE_INT),
-                get_register(lhs_reg, SIZE_INT)
-            );
-            break;
-        case TOK_LESS_EQUAL:
-            fprintf(out, 
-                "    cmp %s, %s\n"
-                "    mov %s, 0\n"
-                "    mov rax, 1\n"
-                "    cmovle %s, rax\n",
-                get_register(lhs_reg, SIZE_INT),
-                get_register(rhs_reg, SIZE_INT),
-                get_register(lhs_reg, SIZE_INT),
-                get_register(lhs_reg, SIZE_INT)
-            );
+    find_loops();
+
+    for(IrBlockId b = 0; b < fn->n_blocks; ++b) {
+        const IrBlock* block = &fn->blocks[b];
+        for(uint32_t i = 0; i < block->n_insts; ++i) {
+            const IrInst* inst = ir_inst(fn, block->insts[i]);
+            const IrValue* args = ir_args(fn, inst);
+            for(uint32_t j = 0; j < inst->n_args; ++j) {
+                // A phi takes its operand at the end of the predecessor
+                if(inst->op == IR_PHI)
+                    add_use(args[j], block->preds[j], block_ends[block->preds[j]]);
+                else
+                    add_use(args[j], b, positions[block->insts[i]]);
+            }
+        }
+    }
+}
+
+// Spilled values which are still live, ordered by the end of their interval
+// in a binary heap so that their slots can be released
+typedef struct {
+    uint32_t end;
+    int slot;
+} ActiveSlot;
+
+static ActiveSlot* active_slots = NULL;
+static uint32_t n_active_slots = 0;
+static uint32_t active_slots_capacity = 0;
+// Slots no longer in use, and the position from which each has been free
+typedef struct {
+    int slot;
+    uint32_t since;
+} FreeSlot;
+
+static FreeSlot* free_slots = NULL;
+static uint32_t n_free_slots = 0;
+static uint32_t free_slots_capacity = 0;
+
+static void push_active_slot(uint32_t end, int slot) {
+    if(n_active_slots == active_slots_capacity) {
+        active_slots_capacity = active_slots_capacity ? active_slots_capacity * 2 : 64;
+        active_slots = realloc(active_slots, sizeof(ActiveSlot) * active_slots_capacity);
+    }
+
+    uint32_t i = n_active_slots++;
+    while(i && active_slots[(i - 1) / 2].end > end) {
+        active_slots[i] = active_slots[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    active_slots[i] = (ActiveSlot) { .end = end, .slot = slot };
+}
+
+static void pop_active_slot(void) {
+    const ActiveSlot last = active_slots[--n_active_slots];
+    uint32_t i = 0;
+    for(;;) {
+        uint32_t child = i * 2 + 1;
+        if(child >= n_active_slots)
             break;
-        case TOK_GREATER:
-            fprintf(out, 
-                "    cmp %s, %s\n"
-                "    mov %s, 0\n"
-                "    mov rax, 1\n"
-                "    cmovg %s, rax\n",
-                get_register(lhs_reg, SIZE_INT),
-                get_register(rhs_reg, SIZE_INT),
-                get_register(lhs_reg, SIZE_INT),
-                get_register(lhs_reg, SIZE_INT)
-            );
+        if(child + 1 < n_active_slots && active_slots[child + 1].end < active_slots[child].end)
+            ++child;
+        if(active_slots[child].end >= last.end)
             break;
-        case TOK_GREATER_EQUAL:
-            fprintf(out, 
-                "    cmp %s, %s\n"
-                "    mov %s, 0\n"
-                "    mov rax, 1\n"
-                "    cmovge %s, rax\n",
-                get_register(lhs_reg, SIZE_INT),
-                get_register(rhs_reg, SIZE_INT),
-                get_register(lhs_reg, SIZE_INT),
-                get_register(lhs_reg, SIZE_INT)
-            );
+        active_slots[i] = active_slots[child];
+        i = child;
+    }
+    if(n_active_slots)
+        active_slots[i] = last;
+}
+
+// Finds a slot for a value live from `start` to `end`. A value spilled after
+// it was given a register moves to the slot for the whole of its interval,
+// so the slot must have been free since the value was defined.
+static int allocate_slot(uint32_t start, uint32_t end) {
+    int slot = n_regs + n_slots;
+    for(uint32_t i = n_free_slots; i-- > 0;) {
+        if(free_slots[i].since <= start) {
+            slot = free_slots[i].slot;
+            free_slots[i] = free_slots[--n_free_slots];
             break;
-        default:
-            fprintf(stderr, "error: unknown binary operation '%s'\n", token_strs[expr->binary.op.type]);
-            return -1;
+        }
     }
+    if(slot == (int)(n_regs + n_slots))
+        ++n_slots;
+    push_active_slot(end, slot);
+    return slot;
+}
 
-    free_register(rhs_reg);
-    return lhs_reg;
+static void free_slot(int slot, uint32_t since) {
+    if(n_free_slots == free_slots_capacity) {
+        free_slots_capacity = free_slots_capacity ? free_slots_capacity * 2 : 64;
+        free_slots = realloc(free_slots, sizeof(FreeSlot) * free_slots_capacity);
+    }
+    free_slots[n_free_slots++] = (FreeSlot) { .slot = slot, .since = since };
 }
 
-static int write_grouping(Expr* expr, FILE* out) {
-    return write_assembly_for_expr(expr->grouping.expr, out);
+// A comparison made just before the branch which is its only use sets the
+// flags the branch tests, rather than a value
+static const IrInst* fused_compare(IrBlockId b) {
+    const IrBlock* block = &fn->blocks[b];
+    const IrInst* branch = ir_terminator(fn, b);
+    if(block->n_insts < 2 || branch->op != IR_BRANCH)
+        return NULL;
+
+    const IrValue condition = ir_args(fn, branch)[0];
+    const IrInst* inst = ir_inst(fn, condition);
+    if(block->insts[block->n_insts - 2] != condition || uses[condition] != 1 || inst->op < IR_EQ || inst->op > IR_GE)
+        return NULL;
+    return inst;
 }
 
-size_t if_counter = 0;
+// A call which the block returns the result of straight away becomes a jump,
+// leaving the callee to return to the caller's caller. Top-level statements
+// do not return, and callees taking arguments on the stack would find them
+// gone, so neither is done this way.
+static const IrInst* tail_call(IrBlockId b) {
+    const IrBlock* block = &fn->blocks[b];
+    const IrInst* ret = ir_terminator(fn, b);
+    if(fn->symbol == SYMBOL_NONE || block->n_insts < 2 || ret->op != IR_RET)
+        return NULL;
+
+    const IrValue call = block->insts[block->n_insts - 2];
+    const IrInst* inst = ir_inst(fn, call);
+    if(inst->op != IR_CALL || inst->n_args > n_arg_regs || (ret->n_args && ir_args(fn, ret)[0] != call))
+        return NULL;
+    return inst;
+}
 
-static int write_if(Expr* expr, FILE* out) {
-    const size_t count = if_counter++;
-    int cond_reg = write_assembly_for_expr(expr->if_stmt.condition, out);
-    fprintf(out,
-        "    cmp %s, 0\n"
-        "    je _else_%lu\n",
-        get_register(cond_reg, SIZE_BOOL), count
-    );
-    free_register(cond_reg);
+// Constants which fit in a sign-extended 32-bit immediate, and addresses of
+// strings, are written out wherever they are used. Wider constants are moved
+// into a location like any other value.
+static bool is_immediate(const IrInst* inst) {
+    return inst->op == IR_STRING || (inst->op == IR_CONST && inst->imm == (int32_t)inst->imm);
+}
+
+// Dividing traps by zero, and by -1 when it overflows
+static bool may_trap(const IrInst* inst) {
+    if(inst->op != IR_DIV)
+        return false;
+    const IrInst* divisor = ir_inst(fn, ir_args(fn, inst)[1]);
+    return divisor->op != IR_CONST || divisor->imm == 0 || divisor->imm == -1;
+}
+
+static bool needs_location(const IrInst* inst, IrValue value) {
+    return uses[value] && !is_immediate(inst);
+}
+
+static void allocate_registers(void) {
+    IrValue active[n_regs]; // Value held by each register, or IR_NONE
+    for(size_t r = 0; r < n_regs; ++r) {
+        active[r] = IR_NONE;
+        used_regs[r] = false;
+    }
+    n_slots = 0;
+    n_active_slots = 0;
+    n_free_slots = 0;
+
+    for(IrBlockId b = 0; b < fn->n_blocks; ++b) {
+        const IrBlock* block = &fn->blocks[b];
+        for(uint32_t i = 0; i < block->n_insts; ++i) {
+            const IrValue value = block->insts[i];
+            const IrInst* inst = ir_inst(fn, value);
+            const uint32_t start = positions[value];
+            locs[value] = is_immediate(inst) ? LOC_IMM : LOC_NONE;
+            if(!needs_location(inst, value) || fused_compare(b) == inst)
+                continue;
+
+            // Values whose intervals have ended give up their locations
+            while(n_active_slots && active_slots[0].end <= start) {
+                free_slot(active_slots[0].slot, active_slots[0].end);
+                pop_active_slot();
+            }
+            int reg = LOC_NONE;
+            for(size_t r = 0; r < n_regs; ++r) {
+                if(active[r] != IR_NONE && ends[active[r]] <= start)
+                    active[r] = IR_NONE;
+                if(active[r] == IR_NONE && reg == LOC_NONE)
+                    reg = r;
+            }
+
+            // Otherwise the value needed furthest in the future is spilled
+            if(reg == LOC_NONE) {
+                size_t furthest = 0;
+                for(size_t r = 1; r < n_regs; ++r) {
+                    if(ends[active[r]] > ends[active[furthest]])
+                        furthest = r;
+                }
+
+                if(ends[active[furthest]] <= ends[value]) {
+                    locs[value] = allocate_slot(start, ends[value]);
+                    continue;
+                }
+                locs[active[furthest]] = allocate_slot(positions[active[furthest]], ends[active[furthest]]);
+                reg = furthest;
+            }
 
-    for(size_t i = 0; i < expr->if_stmt.if_body_len; ++i)
-        free_register(write_assembly_for_expr(expr->if_stmt.if_body[i], out));
-    fprintf(out, "    jmp _end_%lu\n", count);
+            active[reg] = value;
+            locs[value] = reg;
+            used_regs[reg] = true;
+        }
+    }
 
-    fprintf(out, "_else_%lu:\n", count);
-    for(size_t i = 0; i < expr->if_stmt.else_body_len; ++i)
-        free_register(write_assembly_for_expr(expr->if_stmt.else_body[i], out));
-    
-    fprintf(out, "_end_%lu:\n", count);
-    return -1;
+    n_saved = 0;
+    for(size_t r = 0; r < n_regs; ++r)
+        n_saved += used_regs[r];
 }
 
-static int write_variable_definition(Expr* expr, FILE* out) {
-    if(!expr->var_def.initial_value)
-        return -1;
+// Operands are formatted into a small ring of buffers, so that several can
+// be used by a single instruction
+static const char* operand(IrValue value) {
+    static char buffers[4][64];
+    static size_t next = 0;
+    char* buffer = buffers[next++ % 4];
+
+    const IrInst* inst = ir_inst(fn, value);
+    const int loc = locs[value];
+    if(loc == LOC_IMM && inst->op == IR_STRING)
+        snprintf(buffer, 64, "str_%u", inst->global_id);
+    else if(loc == LOC_IMM)
+        snprintf(buffer, 64, "%lld", (long long)inst->imm);
+    else if(loc < (int)n_regs)
+        return qregs[loc];
+    else
+        snprintf(buffer, 64, "qword [rbp - %u]", 8 * (n_saved + loc - (int)n_regs + 1));
+    return buffer;
+}
 
-    const int val_reg = write_assembly_for_expr(expr->var_def.initial_value, out);
-    fprintf(out, "    mov [g_%s], %s\n", expr->var_def.identifier, get_register(val_reg, get_type_size(symbol_get(expr->var_def.identifier).type)));
-    free_register(val_reg);
+static bool in_register(IrValue value) {
+    return locs[value] >= 0 && locs[value] < (int)n_regs;
+}
 
-    return -1;
+static bool is_register(IrValue value, const char* reg) {
+    return in_register(value) && strcmp(qregs[locs[value]], reg) == 0;
 }
 
-static int write_assign(Expr* expr, FILE* out) {
-    const int val_reg = write_assembly_for_expr(expr->assign.expr, out);
-    const size_t var_size = get_type_size(symbol_get(expr->assign.identifier).type);
+static void load(const char* reg, IrValue value, FILE* out) {
+    if(!is_register(value, reg))
+        fprintf(out, "    mov %s, %s\n", reg, operand(value));
+}
 
-    switch(expr->assign.op.type) {
-        case TOK_EQUAL:
-            fprintf(out, "    mov [g_%s], %s\n", expr->assign.identifier, get_register(val_reg, var_size));
-            break;
-        case TOK_PLUS_EQUAL: {
-            const int temp = allocate_register();
-            fprintf(out,
-                "    mov %s, [g_%s]\n"
-                "    add %s, %s\n"
-                "    mov [g_%s], %s\n",
-                get_register(temp, var_size), expr->assign.identifier,
-                get_register(temp, var_size), get_register(val_reg, var_size),
-                expr->assign.identifier, get_register(temp, var_size)
-            );
-            free_register(temp);
-            break;
+static void store(IrValue value, const char* reg, FILE* out) {
+    if(!is_register(value, reg))
+        fprintf(out, "    mov %s, %s\n", operand(value), reg);
+}
+
+// Register an instruction computes its result in: the result's own if it has
+// one, otherwise scratch space
+static const char* work_register(IrValue value) {
+    return in_register(value) ? qregs[locs[value]] : "r11";
+}
+
+static void write_prologue(FILE* out) {
+    if(fn->symbol == SYMBOL_NONE)
+        fprintf(out, "\n_init_%lu:\n", n_inits);
+    else
+        fprintf(out, "\nfn_%s:\n", intern_str(symbol_at(fn->symbol)->identifier));
+
+    const size_t n_params = fn->symbol == SYMBOL_NONE ? 0 : symbol_at(fn->symbol)->n_params;
+    has_frame = n_saved || n_slots || n_params > n_arg_regs;
+    if(has_frame) {
+        fprintf(out,
+            "    push rbp\n"
+            "    mov rbp, rsp\n"
+        );
+        for(size_t r = 0; r < n_regs; ++r) {
+            if(used_regs[r])
+                fprintf(out, "    push %s\n", qregs[r]);
         }
-        case TOK_MINUS_EQUAL: {
-            const int temp = allocate_register();
-            fprintf(out,
-                "    mov %s, [g_%s]\n"
-                "    sub %s, %s\n"
-                "    mov [g_%s], %s\n",
-                get_register(temp, var_size), expr->assign.identifier,
-                get_register(temp, var_size), get_register(val_reg, var_size),
-                expr->assign.identifier, get_register(temp, var_size)
-            );
-            free_register(temp);
-            break;
+        if(n_slots)
+            fprintf(out, "    sub rsp, %u\n", 8 * n_slots);
+    }
+
+    // Parameters arrive in registers, and then above the return address in
+    // the order they were given
+    const IrBlock* entry = &fn->blocks[IR_ENTRY];
+    for(uint32_t i = 0; i < entry->n_insts; ++i) {
+        const IrValue value = entry->insts[i];
+        const IrInst* inst = ir_inst(fn, value);
+        if(inst->op != IR_PARAM || locs[value] == LOC_NONE)
+            continue;
+
+        if(inst->param < n_arg_regs) {
+            store(value, arg_regs[inst->param], out);
+        } else {
+            fprintf(out, "    mov r11, [rbp + %lu]\n", 16 + 8 * (inst->param - n_arg_regs));
+            store(value, "r11", out);
         }
-        case TOK_STAR_EQUAL: {
-            const int temp = allocate_register();
-            fprintf(out,
-                "    mov %s, [g_%s]\n"
-                "    imul %s, %s\n"
-                "    mov [g_%s], %s\n",
-                get_register(temp, var_size), expr->assign.identifier,
-                get_register(temp, var_size), get_register(val_reg, var_size),
-                expr->assign.identifier, get_register(temp, var_size)
-            );
-            free_register(temp);
-            break;
+    }
+}
+
+// Restores the registers and stack pointer the caller had
+static void write_teardown(FILE* out) {
+    if(has_frame) {
+        if(n_slots)
+            fprintf(out, "    lea rsp, [rbp - %u]\n", 8 * n_saved);
+        for(size_t r = n_regs; r-- > 0;) {
+            if(used_regs[r])
+                fprintf(out, "    pop %s\n", qregs[r]);
         }
-        case TOK_SLASH_EQUAL:
-            fprintf(out,
-                "    mov rax, [g_%s]\n"
-                "    xor rdx, rdx\n"
-                "    idiv %s\n"
-                "    mov [g_%s], rax\n",
-                expr->assign.identifier,
-                get_register(val_reg, var_size),
-                expr->assign.identifier
-            );
-            break;
+        fprintf(out, "    pop rbp\n");
     }
-    free_register(val_reg);
-    return -1;
 }
 
-static size_t while_counter = 0;
+static void write_epilogue(FILE* out) {
+    write_teardown(out);
+    if(fn->symbol == SYMBOL_NONE)
+        fprintf(out, "    jmp _init_%lu\n", n_inits + 1);
+    else
+        fprintf(out, "    ret\n");
+}
 
-static int write_while_loop(Expr* expr, FILE* out) {
-    const size_t while_count = while_counter++;
-    fprintf(out, "while_%lu:\n", while_count);
+// Condition codes of the comparisons, and of their negations
+static const char* condition_codes[] = {
+    [IR_EQ] = "e",
+    [IR_NE] = "ne",
+    [IR_LT] = "l",
+    [IR_LE] = "le",
+    [IR_GT] = "g",
+    [IR_GE] = "ge",
+};
+
+static const char* negated_codes[] = {
+    [IR_EQ] = "ne",
+    [IR_NE] = "e",
+    [IR_LT] = "ge",
+    [IR_LE] = "g",
+    [IR_GT] = "le",
+    [IR_GE] = "l",
+};
+
+static void write_compare(const IrInst* inst, FILE* out) {
+    const IrValue* args = ir_args(fn, inst);
+    const char* lhs = in_register(args[0]) ? operand(args[0]) : "r11";
+    load(lhs, args[0], out);
+    fprintf(out, "    cmp %s, %s\n", lhs, operand(args[1]));
+}
 
-    const int cond_reg = write_assembly_for_expr(expr->while_loop.condition, out);
-    fprintf(out,
-        "    cmp %s, 0\n"
-        "    jz while_%lu_end\n",
-        get_register(cond_reg, SIZE_BOOL),
-        while_count
-    );
+static void write_binary(IrValue value, const IrInst* inst, FILE* out) {
+    IrValue lhs = ir_args(fn, inst)[0];
+    IrValue rhs = ir_args(fn, inst)[1];
 
-    for(size_t i = 0; i < expr->while_loop.body_len; ++i)
-        free_register(write_assembly_for_expr(expr->while_loop.body[i], out));
+    // The left operand is moved into the result's register first, which must
+    // not overwrite the right operand
+    if(in_register(value) && locs[rhs] == locs[value] && inst->op != IR_SUB) {
+        rhs = lhs;
+        lhs = ir_args(fn, inst)[1];
+    }
+    const char* reg = locs[rhs] == locs[value] && lhs != rhs ? "r11" : work_register(value);
 
-    fprintf(out,
-        "    jmp while_%lu\n"
-        "while_%lu_end:\n",
-        while_count,
-        while_count
-    );
-    
-    free_register(cond_reg);
-    return -1;
+    load(reg, lhs, out);
+    switch(inst->op) {
+        case IR_ADD:
+            fprintf(out, "    add %s, %s\n", reg, operand(rhs));
+            break;
+        case IR_SUB:
+            fprintf(out, "    sub %s, %s\n", reg, operand(rhs));
+            break;
+        default:
+            if(locs[rhs] == LOC_IMM)
+                fprintf(out, "    imul %s, %s, %s\n", reg, reg, operand(rhs));
+            else
+                fprintf(out, "    imul %s, %s\n", reg, operand(rhs));
+            break;
+    }
+    store(value, reg, out);
 }
 
-static size_t get_fn_stack_size(Symbol symbol) {
-    size_t stack_size = 0;
-    for(size_t i = 0; i < symbol.n_params; ++i) {
-        stack_size += get_type_size(symbol.param_types[i]);
+static void write_call(IrValue value, const IrInst* inst, FILE* out) {
+    const IrValue* args = ir_args(fn, inst);
+    const uint32_t n_pushed = inst->n_args > n_arg_regs ? inst->n_args - n_arg_regs : 0;
+
+    for(uint32_t i = inst->n_args; i-- > n_arg_regs;) {
+        if(ir_inst(fn, args[i])->op == IR_STRING) {
+            load("r11", args[i], out);
+            fprintf(out, "    push r11\n");
+        } else {
+            fprintf(out, "    push %s\n", operand(args[i]));
+        }
     }
-    return stack_size;
-}
+    for(uint32_t i = 0; i < inst->n_args && i < n_arg_regs; ++i)
+        load(arg_regs[i], args[i], out);
 
-static int write_fn_def(Expr* expr, FILE* out) {
-    fprintf(out, "\nfn_%s:\n", expr->fn_def.identifier);
+    if(tail_call(ir_inst(fn, value)->block) == inst) {
+        write_teardown(out);
+        fprintf(out, "    jmp fn_%s\n", intern_str(symbol_at(inst->symbol)->identifier));
+        return;
+    }
+    fprintf(out, "    call fn_%s\n", intern_str(symbol_at(inst->symbol)->identifier));
+    if(n_pushed)
+        fprintf(out, "    add rsp, %u\n", 8 * n_pushed);
+    if(locs[value] != LOC_NONE)
+        store(value, "rax", out);
+}
 
-    if(expr->fn_def.n_params) {
-        const size_t stack_size = get_fn_stack_size(expr->parent_fn);
-        fprintf(out, "    enter %lu, 0\n", stack_size);
-        
-        size_t offset = 0;
-        for(size_t i = 0; i < expr->fn_def.n_params; ++i) {
-            const size_t type_size = get_type_size(expr->fn_def.param_types[i]);
-            fprintf(out, "    mov [rsp + %lu], %s\n", offset, get_register(i, type_size));
-            offset += type_size;
+static void write_store(const IrInst* inst, FILE* out) {
+    const IrValue value = ir_args(fn, inst)[0];
+    const char* identifier = intern_str(symbol_at(inst->symbol)->identifier);
+
+    if(symbol_at(inst->symbol)->type == VAL_BOOL) {
+        if(locs[value] == LOC_IMM) {
+            fprintf(out, "    mov byte [g_%s], %s\n", identifier, operand(value));
+        } else if(in_register(value)) {
+            fprintf(out, "    mov byte [g_%s], %s\n", identifier, bregs[locs[value]]);
+        } else {
+            load("r11", value, out);
+            fprintf(out, "    mov byte [g_%s], r11b\n", identifier);
         }
+        return;
     }
 
-    for(size_t i = 0; i < expr->fn_def.body_len; ++i) {
-        free_register(write_assembly_for_expr(expr->fn_def.body[i], out));
+    if(in_register(value) || (locs[value] == LOC_IMM && ir_inst(fn, value)->op == IR_CONST)) {
+        fprintf(out, "    mov qword [g_%s], %s\n", identifier, operand(value));
+    } else {
+        load("r11", value, out);
+        fprintf(out, "    mov qword [g_%s], r11\n", identifier);
     }
+}
 
-    return -1;
+// Moves the operands of the phis of `succ` taken from `block` into place.
+// The moves happen at once, so any which would overwrite a value another
+// still needs are held back, and cycles are broken through a scratch
+// register.
+typedef struct {
+    int dst;
+    int src; // Location, or LOC_IMM for `value` itself
+    IrValue value;
+} Move;
+
+static Move* moves = NULL;
+static uint32_t moves_capacity = 0;
+
+static const char* location(int loc, IrValue value) {
+    static char buffers[2][64];
+    static size_t next = 0;
+
+    if(loc == LOC_TEMP)
+        return "r10";
+    if(loc == LOC_IMM)
+        return operand(value);
+    if(loc < (int)n_regs)
+        return qregs[loc];
+
+    char* buffer = buffers[next++ % 2];
+    snprintf(buffer, 64, "qword [rbp - %u]", 8 * (n_saved + loc - (int)n_regs + 1));
+    return buffer;
 }
 
-static int write_fn_call(Expr* expr, FILE* out) {
-    for(size_t i = 0; i < expr->fn_call.fn_symbol.n_params; ++i) {
-        const int reg = write_assembly_for_expr(expr->fn_call.param_exprs[i], out);
-        if(reg == -1) {
-            return -1;
-        }
+static bool is_memory(int loc) {
+    return loc >= (int)n_regs;
+}
+
+static void write_move(const Move* move, FILE* out) {
+    const bool via_scratch = (is_memory(move->dst) && is_memory(move->src))
+        || (is_memory(move->dst) && move->src == LOC_IMM && ir_inst(fn, move->value)->op == IR_STRING);
+    if(via_scratch) {
+        fprintf(out, "    mov r11, %s\n", location(move->src, move->value));
+        fprintf(out, "    mov %s, r11\n", location(move->dst, move->value));
+    } else {
+        fprintf(out, "    mov %s, %s\n", location(move->dst, move->value), location(move->src, move->value));
+    }
+}
+
+static uint32_t collect_moves(IrBlockId block, IrBlockId succ) {
+    const IrBlock* target = &fn->blocks[succ];
+    const uint32_t index = ir_pred_index(fn, succ, block);
+    uint32_t n_moves = 0;
 
-        const size_t type_size = get_type_size(expr->fn_call.fn_symbol.param_types[i]);
-        fprintf(out, "    mov %s, %s\n", get_register(i, type_size), get_register(reg, type_size));
+    for(uint32_t i = 0; i < target->n_insts; ++i) {
+        const IrValue phi = target->insts[i];
+        const IrInst* inst = ir_inst(fn, phi);
+        if(inst->op != IR_PHI)
+            break;
+        if(locs[phi] == LOC_NONE)
+            continue;
+
+        const IrValue arg = ir_args(fn, inst)[index];
+        if(locs[arg] == locs[phi])
+            continue;
 
-        free_register(reg);
+        if(n_moves == moves_capacity) {
+            moves_capacity = moves_capacity ? moves_capacity * 2 : 16;
+            moves = realloc(moves, sizeof(Move) * moves_capacity);
+        }
+        moves[n_moves++] = (Move) { .dst = locs[phi], .src = locs[arg], .value = arg };
     }
-    
-    const int reg = allocate_register();
+    return n_moves;
+}
 
-    fprintf(out,
-        "    call fn_%s\n"
-        "    mov %s, rax\n",
-        expr->fn_call.fn_symbol.identifier,
-        get_register(reg, get_type_size(expr->fn_call.fn_symbol.return_type))
-    );
+static void write_moves(uint32_t n_moves, FILE* out) {
+    while(n_moves) {
+        // A move is safe once no other move still reads its destination
+        uint32_t ready = n_moves;
+        for(uint32_t i = 0; i < n_moves && ready == n_moves; ++i) {
+            ready = i;
+            for(uint32_t j = 0; j < n_moves; ++j) {
+                if(j != i && moves[j].src == moves[i].dst) {
+                    ready = n_moves;
+                    break;
+                }
+            }
+        }
 
-    return reg;
+        if(ready == n_moves) {
+            ready = 0;
+            fprintf(out, "    mov r10, %s\n", location(moves[0].dst, IR_NONE));
+            for(uint32_t j = 1; j < n_moves; ++j) {
+                if(moves[j].src == moves[0].dst)
+                    moves[j].src = LOC_TEMP;
+            }
+        }
+
+        write_move(&moves[ready], out);
+        moves[ready] = moves[--n_moves];
+    }
 }
 
-static int write_return(Expr* expr, FILE* out) {
-    const int reg = write_assembly_for_expr(expr->op_return.value_expr, out);
-    fprintf(out, "    mov rax, %s\n", get_register(reg, SIZE_INT));
+static void write_edge(IrBlockId block, IrBlockId succ, bool fallthrough, FILE* out) {
+    write_moves(collect_moves(block, succ), out);
+    if(!fallthrough || succ != block + 1)
+        fprintf(out, "    jmp .b%u\n", succ);
+}
+
+static void write_branch(IrBlockId b, const IrInst* branch, FILE* out) {
+    const IrValue condition = ir_args(fn, branch)[0];
+    const IrBlockId if_true = branch->targets[0];
+    const IrBlockId if_false = branch->targets[1];
 
-    if(expr->parent_fn.n_params) {
-        fprintf(out, "    leave\n");
+    if(locs[condition] == LOC_IMM) {
+        write_edge(b, ir_inst(fn, condition)->imm ? if_true : if_false, true, out);
+        return;
     }
 
-    fprintf(out, "    ret\n");
+    const char* taken;
+    const char* not_taken;
+    const IrInst* compare = fused_compare(b);
+    if(compare) {
+        write_compare(compare, out);
+        taken = condition_codes[compare->op];
+        not_taken = negated_codes[compare->op];
+    } else {
+        if(in_register(condition))
+            fprintf(out, "    test %s, %s\n", operand(condition), operand(condition));
+        else
+            fprintf(out, "    cmp %s, 0\n", operand(condition));
+        taken = "ne";
+        not_taken = "e";
+    }
 
-    free_register(reg);
-    return -1;
+    if(!collect_moves(b, if_false)) {
+        fprintf(out, "    j%s .b%u\n", not_taken, if_false);
+        write_edge(b, if_true, true, out);
+    } else if(!collect_moves(b, if_true)) {
+        fprintf(out, "    j%s .b%u\n", taken, if_true);
+        write_edge(b, if_false, true, out);
+    } else {
+        fprintf(out, "    j%s .e%u\n", not_taken, b);
+        write_edge(b, if_true, false, out);
+        fprintf(out, ".e%u:\n", b);
+        write_edge(b, if_false, true, out);
+    }
 }
 
-static int write_assembly_for_expr(Expr* expr, FILE* out) {
-    switch(expr->tag) {
-        case EXPR_LITERAL:
-            return write_literal(expr, out);
-        case EXPR_UNARY:
-            return write_unary(expr, out);
-        case EXPR_BINARY:
-            return write_binary(expr, out);
-        case EXPR_GROUPING:
-            return write_grouping(expr, out);
-        case EXPR_IF:
-            return write_if(expr, out);
-        case EXPR_VAR_DEF:
-            return write_variable_definition(expr, out);
-        case EXPR_ASSIGN:
-            return write_assign(expr, out);
-        case EXPR_WHILE:
-            return write_while_loop(expr, out);
-        case EXPR_FN_DEF:
-            return write_fn_def(expr, out);
-        case EXPR_FN_CALL:
-            return write_fn_call(expr, out);
-        case EXPR_RETURN:
-            return write_return(expr, out);
+static void write_inst(IrBlockId b, IrValue value, FILE* out) {
+    const IrInst* inst = ir_inst(fn, value);
+    const IrValue* args = ir_args(fn, inst);
+
+    switch(inst->op) {
+        case IR_CONST:
+            if(locs[value] != LOC_IMM) {
+                const char* reg = work_register(value);
+                fprintf(out, "    mov %s, %lld\n", reg, (long long)inst->imm);
+                store(value, reg, out);
+            }
+            break;
+
+        // Strings are used in place, and parameters are moved into place by
+        // the prologue
+        case IR_STRING:
+        case IR_PARAM:
+        case IR_PHI:
+            break;
+
+        case IR_LOAD: {
+            const char* reg = work_register(value);
+            const char* identifier = intern_str(symbol_at(inst->symbol)->identifier);
+            if(inst->type == VAL_BOOL)
+                fprintf(out, "    movzx %s, byte [g_%s]\n", reg, identifier);
+            else
+                fprintf(out, "    mov %s, qword [g_%s]\n", reg, identifier);
+            store(value, reg, out);
+            break;
+        }
+
+        case IR_STORE:
+            write_store(inst, out);
+            break;
+
+        case IR_NEG:
+        case IR_NOT: {
+            const char* reg = work_register(value);
+            load(reg, args[0], out);
+            if(inst->op == IR_NEG)
+                fprintf(out, "    neg %s\n", reg);
+            else
+                fprintf(out, "    xor %s, 1\n", reg);
+            store(value, reg, out);
+            break;
+        }
+
+        case IR_ADD:
+        case IR_SUB:
+        case IR_MUL:
+            write_binary(value, inst, out);
+            break;
+
+        case IR_DIV:
+            load("rax", args[0], out);
+            fprintf(out, "    cqo\n");
+            if(locs[args[1]] == LOC_IMM) {
+                load("rcx", args[1], out);
+                fprintf(out, "    idiv rcx\n");
+            } else {
+                fprintf(out, "    idiv %s\n", operand(args[1]));
+            }
+            if(locs[value] != LOC_NONE)
+                store(value, "rax", out);
+            break;
+
+        case IR_EQ:
+        case IR_NE:
+        case IR_LT:
+        case IR_LE:
+        case IR_GT:
+        case IR_GE:
+            if(fused_compare(b) == inst)
+                break;
+            write_compare(inst, out);
+            if(in_register(value)) {
+                fprintf(out,
+                    "    set%s %s\n"
+                    "    movzx %s, %s\n",
+                    condition_codes[inst->op], bregs[locs[value]],
+                    dregs[locs[value]], bregs[locs[value]]
+                );
+            } else {
+                fprintf(out,
+                    "    set%s al\n"
+                    "    movzx eax, al\n",
+                    condition_codes[inst->op]
+                );
+                store(value, "rax", out);
+            }
+            break;
+
+        case IR_CALL:
+            write_call(value, inst, out);
+            break;
+
+        case IR_JUMP:
+            write_edge(b, inst->targets[0], true, out);
+            break;
+
+        case IR_BRANCH:
+            write_branch(b, inst, out);
+            break;
+
+        case IR_RET:
+            if(tail_call(b))
+                break;
+            if(inst->n_args)
+                load("rax", args[0], out);
+            write_epilogue(out);
+            break;
     }
 }
 
-bool generate_assembly(Expr** exprs, size_t n_exprs, const char* output_path) {
-    initialize_registers();
+static void write_function(const IrFunction* function, FILE* out) {
+    fn = function;
+    grow_arrays();
+    build_intervals();
+    allocate_registers();
+
+    write_prologue(out);
+    for(IrBlockId b = 0; b < fn->n_blocks; ++b) {
+        const IrBlock* block = &fn->blocks[b];
+        if(b != IR_ENTRY)
+            fprintf(out, ".b%u:\n", b);
+
+        for(uint32_t i = 0; i < block->n_insts; ++i) {
+            const IrValue value = block->insts[i];
+            const IrInst* inst = ir_inst(fn, value);
+
+            // Values nothing uses need not be computed, unless computing them
+            // has an effect, as dividing by zero does
+            const bool has_effect = inst->op == IR_STORE || inst->op == IR_CALL || ir_is_terminator(inst->op) || may_trap(inst);
+            if(has_effect || uses[value])
+                write_inst(b, value, out);
+        }
+    }
+
+    if(fn->symbol == SYMBOL_NONE)
+        ++n_inits;
+}
 
+// Code is generated incrementally so that top-level expressions can be
+// written out and freed as soon as they have been checked. Globals are only
+// known once every expression has been seen, so they are written last.
+FILE* codegen_begin(const char* output_path) {
     FILE* output_file = fopen(output_path, "w");
     if(!output_file) {
         fprintf(stderr, "error: failed to open file '%s' for writing\n", output_path);
-        return false;
+        return NULL;
     }
 
-    write_globals(output_file);
+    n_inits = 0;
     write_preamble(output_file);
+    return output_file;
+}
 
-    for(size_t i = 0; i < n_exprs; ++i) {
-        const int reg = write_assembly_for_expr(exprs[i], output_file);
-        if(reg != -1)
-            free_register(reg); // We won't be needing this register for now
-    }
+void codegen_write_program(const IrProgram* program, FILE* out) {
+    for(size_t i = 0; i < program->n_fns; ++i)
+        write_function(&program->fns[i], out);
+}
+
+void codegen_end(FILE* out) {
+    // The last top-level statement continues here, back into `_start`
+    fprintf(out, "\n_init_%lu:\n    ret\n\n", n_inits);
+    write_globals(out);
+    fclose(out);
+
+    free(positions);
+    free(ends);
+    free(uses);
+    free(locs);
+    free(block_starts);
+    free(block_ends);
+    free(loops);
+    free(loop_ends);
+    free(headers);
+    free(worklist);
+    free(active_slots);
+    free(free_slots);
+    free(moves);
+    positions = ends = uses = NULL;
+    locs = NULL;
+    block_starts = block_ends = loop_ends = NULL;
+    loops = worklist = NULL;
+    headers = NULL;
+    active_slots = NULL;
+    free_slots = NULL;
+    moves = NULL;
+    values_capacity = blocks_capacity = 0;
+    active_slots_capacity = free_slots_capacity = moves_capacity = 0;
+}
+
+bool generate_assembly(const IrProgram* program, const char* output_path) {
+    FILE* output_file = codegen_begin(output_path);
+    if(!output_file)
+        return false;
 
-    fclose(output_file);
+    codegen_write_program(program, output_file);
+    codegen_end(output_file);
     return true;
 }
@@ -3,9 +3,14 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdio.h>
 
-#include "expr.h"
+#include "ir.h"
 
-bool generate_assembly(Expr** exprs, size_t n_exprs, const char* output_path);
+FILE* codegen_begin(const char* output_path);
+void codegen_write_program(const IrProgram* program, FILE* out);
+void codegen_end(FILE* out);
+
+bool generate_assembly(const IrProgram* program, const char* output_path);
 
 #endif // CODEGEN_H
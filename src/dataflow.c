@@ -0,0 +1,321 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cfg.h"
+#include "dataflow.h"
+#include "expr.h"
+#include "symbol.h"
+#include "token.h"
+
+void dataflow_init(Dataflow* flow, const Cfg* cfg, DataflowDirection direction, DataflowMeet meet, uint32_t n_bits) {
+    const uint32_t n_words = n_bits ? (n_bits + 63) / 64 : 1;
+    const size_t n = (size_t)cfg->n_blocks * n_words;
+
+    *flow = (Dataflow) {
+        .direction = direction,
+        .meet = meet,
+        .n_bits = n_bits,
+        .n_words = n_words,
+        .gen = calloc(n, sizeof(uint64_t)),
+        .kill = calloc(n, sizeof(uint64_t)),
+        .in = calloc(n, sizeof(uint64_t)),
+        .out = calloc(n, sizeof(uint64_t)),
+    };
+}
+
+void dataflow_free(Dataflow* flow) {
+    free(flow->gen);
+    free(flow->kill);
+    free(flow->in);
+    free(flow->out);
+    *flow = (Dataflow) { 0 };
+}
+
+// Blocks waiting to be recomputed, kept as a ring buffer which holds each
+// block at most once
+static BlockId* worklist = NULL;
+static bool* on_worklist = NULL;
+static uint32_t worklist_capacity = 0;
+
+static void reserve_worklist(uint32_t n_blocks) {
+    if(n_blocks <= worklist_capacity)
+        return;
+
+    worklist_capacity = n_blocks;
+    worklist = realloc(worklist, sizeof(BlockId) * worklist_capacity);
+    on_worklist = realloc(on_worklist, sizeof(bool) * worklist_capacity);
+}
+
+// Iterates `out = gen | (in & ~kill)` to a fixed point. The sets flowing into
+// the entry block, or out of the exit block for a backward problem, are fixed
+// to `boundary`.
+void dataflow_solve(Dataflow* flow, const Cfg* cfg, const uint64_t* boundary) {
+    const bool forward = flow->direction == DATAFLOW_FORWARD;
+    const BlockId start = forward ? CFG_ENTRY : CFG_EXIT;
+    const uint64_t identity = flow->meet == DATAFLOW_INTERSECTION ? UINT64_MAX : 0;
+    const uint32_t n_words = flow->n_words;
+    const uint32_t n_blocks = cfg->n_blocks;
+
+    // Every block starts out with the most optimistic value and is queued in
+    // program order, or reverse program order when flowing backwards
+    reserve_worklist(n_blocks);
+    for(uint32_t i = 0; i < n_blocks; ++i) {
+        memset(dataflow_set(flow, flow->out, i), identity ? 0xff : 0, sizeof(uint64_t) * n_words);
+        worklist[i] = forward ? i : n_blocks - 1 - i;
+        on_worklist[i] = true;
+    }
+    uint32_t head = 0;
+    uint32_t len = n_blocks;
+
+    while(len) {
+        const BlockId block = worklist[head];
+        head = (head + 1) % n_blocks;
+        --len;
+        on_worklist[block] = false;
+
+        const BasicBlock* bb = &cfg->blocks[block];
+        uint64_t* in = dataflow_set(flow, flow->in, block);
+        uint64_t* out = dataflow_set(flow, flow->out, block);
+
+        if(block == start) {
+            memcpy(in, boundary, sizeof(uint64_t) * n_words);
+        } else {
+            const BlockId* neighbours = forward ? cfg_preds(cfg, block) : bb->succs;
+            const uint32_t n_neighbours = forward ? bb->n_preds : cfg_n_succs(bb);
+
+            for(uint32_t w = 0; w < n_words; ++w)
+                in[w] = identity;
+            for(uint32_t i = 0; i < n_neighbours; ++i) {
+                const uint64_t* from = dataflow_set(flow, flow->out, neighbours[i]);
+                for(uint32_t w = 0; w < n_words; ++w)
+                    in[w] = identity ? in[w] & from[w] : in[w] | from[w];
+            }
+        }
+
+        const uint64_t* gen = dataflow_set(flow, flow->gen, block);
+        const uint64_t* kill = dataflow_set(flow, flow->kill, block);
+        bool changed = false;
+        for(uint32_t w = 0; w < n_words; ++w) {
+            const uint64_t value = gen[w] | (in[w] & ~kill[w]);
+            changed |= value != out[w];
+            out[w] = value;
+        }
+        if(!changed)
+            continue;
+
+        const BlockId* dependents = forward ? bb->succs : cfg_preds(cfg, block);
+        const uint32_t n_dependents = forward ? cfg_n_succs(bb) : bb->n_preds;
+        for(uint32_t i = 0; i < n_dependents; ++i) {
+            if(on_worklist[dependents[i]])
+                continue;
+            on_worklist[dependents[i]] = true;
+            worklist[(head + len++) % n_blocks] = dependents[i];
+        }
+    }
+}
+
+static uint32_t find_slot(const VarSet* vars, SymbolId symbol) {
+    const uint32_t mask = vars->n_slots - 1;
+    uint32_t slot = (uint32_t)(symbol * 2654435761u) & mask;
+    while(vars->slots[slot] && vars->symbols[vars->slots[slot] - 1] != symbol)
+        slot = (slot + 1) & mask;
+    return slot;
+}
+
+// Index of `symbol`, which must be one of the globals in `vars`
+uint32_t var_index(const VarSet* vars, SymbolId symbol) {
+    return vars->slots[find_slot(vars, symbol)] - 1;
+}
+
+void var_set_free(VarSet* vars) {
+    free(vars->symbols);
+    free(vars->slots);
+    *vars = (VarSet) { 0 };
+}
+
+static void var_add(VarSet* vars, SymbolId symbol) {
+    const uint32_t slot = find_slot(vars, symbol);
+    if(vars->slots[slot])
+        return;
+
+    if(vars->n_vars == vars->capacity) {
+        vars->capacity = vars->capacity ? vars->capacity * 2 : 16;
+        vars->symbols = realloc(vars->symbols, sizeof(SymbolId) * vars->capacity);
+    }
+    vars->symbols[vars->n_vars++] = symbol;
+    vars->slots[slot] = vars->n_vars;
+}
+
+// Global whose value `expr` reads or writes, if any
+static SymbolId expr_global(const Expr* expr) {
+    switch(expr->tag) {
+        case EXPR_VARIABLE:
+            return expr->variable.param == PARAM_NONE ? expr->variable.symbol : SYMBOL_NONE;
+        case EXPR_ASSIGN:
+            return expr->assign.symbol;
+        case EXPR_VAR_DEF:
+            return expr->var_def.symbol;
+        default:
+            return SYMBOL_NONE;
+    }
+}
+
+// Collects the globals `cfg` refers to. The table is sized for every node of
+// the function's items referring to a different global, so it never fills.
+static void collect_vars(VarSet* vars, const Cfg* cfg) {
+    uint32_t n_nodes = 0;
+    for(uint32_t i = 0; i < cfg->n_items; ++i)
+        n_nodes += cfg->items[i].last - cfg->items[i].first + 1;
+
+    *vars = (VarSet) { .n_slots = 16 };
+    while(vars->n_slots < n_nodes * 2)
+        vars->n_slots *= 2;
+    vars->slots = calloc(vars->n_slots, sizeof(uint32_t));
+
+    for(uint32_t i = 0; i < cfg->n_items; ++i) {
+        for(Expr* expr = cfg->items[i].first; expr <= cfg->items[i].last; ++expr) {
+            const SymbolId symbol = expr_global(expr);
+            if(symbol != SYMBOL_NONE)
+                var_add(vars, symbol);
+        }
+    }
+}
+
+// Whether `expr` stores a new value into a global. Definitions without an
+// initial value store nothing.
+static bool is_def(const Expr* expr) {
+    return expr->tag == EXPR_ASSIGN || (expr->tag == EXPR_VAR_DEF && expr->var_def.initial_value);
+}
+
+// Use and def sets of each block are found by scanning its items in
+// evaluation order, so only uses preceding any def in the block count
+void liveness_analyze(Liveness* live, const Cfg* cfg) {
+    collect_vars(&live->vars, cfg);
+    const uint32_t n_vars = live->vars.n_vars;
+    dataflow_init(&live->flow, cfg, DATAFLOW_BACKWARD, DATAFLOW_UNION, n_vars);
+
+    for(BlockId b = 0; b < cfg->n_blocks; ++b) {
+        uint64_t* use = dataflow_set(&live->flow, live->flow.gen, b);
+        uint64_t* def = dataflow_set(&live->flow, live->flow.kill, b);
+        const BasicBlock* block = &cfg->blocks[b];
+
+        for(uint32_t i = block->first_item; i < block->first_item + block->n_items; ++i) {
+            for(Expr* expr = cfg->items[i].first; expr <= cfg->items[i].last; ++expr) {
+                // The called function may read any global
+                if(expr->tag == EXPR_FN_CALL) {
+                    for(uint32_t w = 0; w < live->flow.n_words; ++w)
+                        use[w] |= ~def[w];
+                    continue;
+                }
+
+                const SymbolId symbol = expr_global(expr);
+                if(symbol == SYMBOL_NONE)
+                    continue;
+
+                const uint32_t var = var_index(&live->vars, symbol);
+                const bool reads = expr->tag == EXPR_VARIABLE || (expr->tag == EXPR_ASSIGN && expr->op != TOK_EQUAL);
+                if(reads && !bits_test(def, var))
+                    bits_set(use, var);
+                if(is_def(expr))
+                    bits_set(def, var);
+            }
+        }
+    }
+
+    // Every global may be read once the function has returned
+    uint64_t* boundary = malloc(sizeof(uint64_t) * live->flow.n_words);
+    memset(boundary, 0xff, sizeof(uint64_t) * live->flow.n_words);
+    dataflow_solve(&live->flow, cfg, boundary);
+    free(boundary);
+}
+
+void liveness_free(Liveness* live) {
+    var_set_free(&live->vars);
+    dataflow_free(&live->flow);
+}
+
+void reaching_defs_analyze(ReachingDefs* reaching, const Cfg* cfg) {
+    collect_vars(&reaching->vars, cfg);
+    const uint32_t n_vars = reaching->vars.n_vars;
+
+    reaching->defs = NULL;
+    reaching->n_defs = 0;
+    uint32_t defs_capacity = 0;
+    for(BlockId b = 0; b < cfg->n_blocks; ++b) {
+        const BasicBlock* block = &cfg->blocks[b];
+        for(uint32_t i = block->first_item; i < block->first_item + block->n_items; ++i) {
+            for(Expr* expr = cfg->items[i].first; expr <= cfg->items[i].last; ++expr) {
+                if(!is_def(expr))
+                    continue;
+                if(reaching->n_defs == defs_capacity) {
+                    defs_capacity = defs_capacity ? defs_capacity * 2 : 16;
+                    reaching->defs = realloc(reaching->defs, sizeof(Expr*) * defs_capacity);
+                }
+                reaching->defs[reaching->n_defs++] = expr;
+            }
+        }
+    }
+
+    Dataflow* flow = &reaching->flow;
+    dataflow_init(flow, cfg, DATAFLOW_FORWARD, DATAFLOW_UNION, reaching->n_defs);
+    const uint32_t n_words = flow->n_words;
+
+    // Definitions of each variable, all of which a new definition kills
+    uint64_t* var_defs = calloc((size_t)n_vars * n_words, sizeof(uint64_t));
+    for(uint32_t d = 0; d < reaching->n_defs; ++d)
+        bits_set(&var_defs[(size_t)var_index(&reaching->vars, expr_global(reaching->defs[d])) * n_words], d);
+
+    // Definitions were numbered block by block, so they are met in order here
+    uint32_t d = 0;
+    for(BlockId b = 0; b < cfg->n_blocks; ++b) {
+        uint64_t* gen = dataflow_set(flow, flow->gen, b);
+        uint64_t* kill = dataflow_set(flow, flow->kill, b);
+
+        const BasicBlock* block = &cfg->blocks[b];
+        for(uint32_t i = block->first_item; i < block->first_item + block->n_items; ++i) {
+            for(Expr* expr = cfg->items[i].first; expr <= cfg->items[i].last; ++expr) {
+                if(!is_def(expr))
+                    continue;
+
+                const uint64_t* killed = &var_defs[(size_t)var_index(&reaching->vars, expr_global(expr)) * n_words];
+                for(uint32_t w = 0; w < n_words; ++w) {
+                    gen[w] &= ~killed[w];
+                    kill[w] |= killed[w];
+                }
+                bits_set(gen, d++);
+            }
+        }
+    }
+    free(var_defs);
+
+    // No definition made by the function reaches its entry
+    uint64_t* boundary = calloc(n_words, sizeof(uint64_t));
+    dataflow_solve(flow, cfg, boundary);
+    free(boundary);
+}
+
+void reaching_defs_free(ReachingDefs* reaching) {
+    var_set_free(&reaching->vars);
+    free(reaching->defs);
+    dataflow_free(&reaching->flow);
+}
+
+// A return has been reached along every path into the exit block. Blocks
+// following a return have no predecessors and so never fall through to it.
+bool definitely_returns(const Cfg* cfg) {
+    Dataflow flow;
+    dataflow_init(&flow, cfg, DATAFLOW_FORWARD, DATAFLOW_INTERSECTION, 1);
+
+    for(BlockId b = 0; b < cfg->n_blocks; ++b) {
+        if(cfg->blocks[b].returns)
+            bits_set(dataflow_set(&flow, flow.gen, b), 0);
+    }
+
+    const uint64_t boundary = 0;
+    dataflow_solve(&flow, cfg, &boundary);
+    const bool returns = bits_test(dataflow_set(&flow, flow.in, CFG_EXIT), 0);
+    dataflow_free(&flow);
+    return returns;
+}
@@ -0,0 +1,92 @@
+#ifndef DATAFLOW_H
+#define DATAFLOW_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "cfg.h"
+#include "symbol.h"
+
+typedef enum {
+    DATAFLOW_FORWARD,
+    DATAFLOW_BACKWARD,
+} DataflowDirection;
+
+typedef enum {
+    DATAFLOW_UNION, // A fact holds if it holds along any path
+    DATAFLOW_INTERSECTION, // A fact holds if it holds along every path
+} DataflowMeet;
+
+// A gen/kill bit-vector problem over the blocks of a CFG. Each block's sets
+// are `n_words` words long and stored at `block * n_words`. `in` and `out`
+// are relative to the direction of the problem: for a backward problem `in`
+// holds at the end of a block and `out` at its start.
+typedef struct {
+    DataflowDirection direction;
+    DataflowMeet meet;
+    uint32_t n_bits;
+    uint32_t n_words;
+    uint64_t* gen;
+    uint64_t* kill;
+    uint64_t* in;
+    uint64_t* out;
+} Dataflow;
+
+void dataflow_init(Dataflow* flow, const Cfg* cfg, DataflowDirection direction, DataflowMeet meet, uint32_t n_bits);
+void dataflow_solve(Dataflow* flow, const Cfg* cfg, const uint64_t* boundary);
+void dataflow_free(Dataflow* flow);
+
+static inline uint64_t* dataflow_set(const Dataflow* flow, uint64_t* sets, BlockId block) {
+    return &sets[(size_t)block * flow->n_words];
+}
+
+static inline bool bits_test(const uint64_t* set, uint32_t bit) {
+    return set[bit / 64] >> (bit % 64) & 1;
+}
+
+static inline void bits_set(uint64_t* set, uint32_t bit) {
+    set[bit / 64] |= (uint64_t)1 << (bit % 64);
+}
+
+static inline void bits_clear(uint64_t* set, uint32_t bit) {
+    set[bit / 64] &= ~((uint64_t)1 << (bit % 64));
+}
+
+// The globals a function refers to, numbered densely so they can index bit
+// vectors. Parameters are never assigned and so are not tracked.
+typedef struct {
+    SymbolId* symbols;
+    uint32_t n_vars;
+    uint32_t capacity;
+    uint32_t* slots; // Open addressing by symbol, holding index + 1 or 0 if empty
+    uint32_t n_slots;
+} VarSet;
+
+uint32_t var_index(const VarSet* vars, SymbolId symbol);
+void var_set_free(VarSet* vars);
+
+// A global is live wherever its current value may still be read: later in
+// the function, by a function it calls, or once it has returned
+typedef struct {
+    VarSet vars;
+    Dataflow flow;
+} Liveness;
+
+// The definitions of globals made in the function which may reach each
+// block, numbered block by block in evaluation order. Definitions made by
+// called functions are not tracked.
+typedef struct {
+    VarSet vars;
+    Expr** defs;
+    uint32_t n_defs;
+    Dataflow flow;
+} ReachingDefs;
+
+void liveness_analyze(Liveness* live, const Cfg* cfg);
+void liveness_free(Liveness* live);
+void reaching_defs_analyze(ReachingDefs* reaching, const Cfg* cfg);
+void reaching_defs_free(ReachingDefs* reaching);
+bool definitely_returns(const Cfg* cfg);
+
+#endif // DATAFLOW_H
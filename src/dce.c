@@ -0,0 +1,347 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cfg.h"
+#include "dataflow.h"
+#include "dce.h"
+#include "expr.h"
+#include "token.h"
+#include "value.h"
+
+// Dead code is found per function, with the CFG and liveness, and marked in
+// `dead`, which is indexed like the nodes of the tree being processed. The
+// bodies of every statement are then relinked without the marked
+// statements. Removed nodes stay in the tree but are no longer reachable
+// from its root.
+static bool* dead = NULL;
+static uint32_t* live_nodes = NULL; // Reachable nodes of each relinked statement
+static uint32_t nodes_capacity = 0;
+
+static Cfg cfg = { 0 };
+static bool* reachable = NULL;
+static BlockId* pending = NULL;
+static uint32_t blocks_capacity = 0;
+
+// Statements to relink, innermost lists being followed first
+static Expr** cursors = NULL;
+static size_t n_cursors = 0;
+static size_t cursors_capacity = 0;
+
+DceStats dce_stats = { 0 };
+
+static size_t subtree_len(Expr* expr) {
+    return expr - expr_first_node(expr) + 1;
+}
+
+// Whether dividing by `divisor` cannot trap, as it can by zero and, when it
+// overflows, by -1
+static bool is_safe_divisor(Expr* divisor) {
+    while(divisor->tag == EXPR_GROUPING)
+        divisor = expr_child(divisor, divisor->grouping.expr);
+
+    return divisor->tag == EXPR_LITERAL && divisor->literal.tag == VAL_INT
+        && divisor->literal.val_int != 0 && divisor->literal.val_int != -1;
+}
+
+// Whether evaluating `expr` can have no effect other than producing its value
+static bool is_pure(Expr* expr) {
+    for(Expr* node = expr_first_node(expr); node <= expr; ++node) {
+        switch(node->tag) {
+            case EXPR_LITERAL:
+            case EXPR_VARIABLE:
+            case EXPR_UNARY:
+            case EXPR_GROUPING:
+                break;
+            case EXPR_BINARY:
+                if(node->op == TOK_SLASH && !is_safe_divisor(expr_child(node, node->binary.rhs)))
+                    return false;
+                break;
+            default:
+                return false;
+        }
+    }
+    return true;
+}
+
+// Value of a condition which is a bool literal, possibly parenthesised
+static bool constant_condition(Expr* condition, bool* value) {
+    while(condition->tag == EXPR_GROUPING)
+        condition = expr_child(condition, condition->grouping.expr);
+
+    if(condition->tag != EXPR_LITERAL || condition->literal.tag != VAL_BOOL)
+        return false;
+    *value = condition->literal.val_bool;
+    return true;
+}
+
+// Blocks reachable from the entry, not following the branch a constant
+// condition never takes
+static void find_reachable(void) {
+    if(cfg.n_blocks > blocks_capacity) {
+        blocks_capacity = cfg.n_blocks;
+        reachable = realloc(reachable, sizeof(bool) * blocks_capacity);
+        pending = realloc(pending, sizeof(BlockId) * blocks_capacity);
+    }
+    memset(reachable, 0, sizeof(bool) * cfg.n_blocks);
+
+    uint32_t n_pending = 0;
+    reachable[CFG_ENTRY] = true;
+    pending[n_pending++] = CFG_ENTRY;
+
+    while(n_pending) {
+        const BasicBlock* block = &cfg.blocks[pending[--n_pending]];
+        uint32_t first = 0;
+        uint32_t n_succs = cfg_n_succs(block);
+
+        bool taken;
+        if(block->branches && constant_condition(cfg.items[block->first_item + block->n_items - 1].last, &taken)) {
+            first = taken ? 0 : 1;
+            n_succs = first + 1;
+        }
+
+        for(uint32_t i = first; i < n_succs; ++i) {
+            const BlockId succ = block->succs[i];
+            if(!reachable[succ]) {
+                reachable[succ] = true;
+                pending[n_pending++] = succ;
+            }
+        }
+    }
+}
+
+// Walks each block's items backwards from the globals live at its end,
+// marking stores of pure values which are overwritten before being read
+static void mark_dead_stores(const ExprTree* tree, const Liveness* live) {
+    uint64_t* live_now = malloc(sizeof(uint64_t) * live->flow.n_words);
+
+    for(BlockId b = 0; b < cfg.n_blocks; ++b) {
+        if(!reachable[b])
+            continue;
+        const BasicBlock* block = &cfg.blocks[b];
+        memcpy(live_now, dataflow_set(&live->flow, live->flow.in, b), sizeof(uint64_t) * live->flow.n_words);
+
+        for(uint32_t i = block->first_item + block->n_items; i-- > block->first_item;) {
+            const CfgItem item = cfg.items[i];
+            Expr* stmt = item.last;
+
+            const bool is_store = (stmt->tag == EXPR_ASSIGN && stmt->op == TOK_EQUAL)
+                || (stmt->tag == EXPR_VAR_DEF && stmt->var_def.initial_value);
+            if(is_store) {
+                const SymbolId symbol = stmt->tag == EXPR_ASSIGN ? stmt->assign.symbol : stmt->var_def.symbol;
+                const uint32_t var = var_index(&live->vars, symbol);
+                if(!bits_test(live_now, var) && is_pure(expr_child(stmt, stmt->tag == EXPR_ASSIGN ? stmt->assign.expr : stmt->var_def.initial_value))) {
+                    dead[stmt - tree->nodes] = true;
+                    ++dce_stats.dead_stores;
+                    continue;
+                }
+            }
+
+            for(Expr* expr = item.last; expr >= item.first; --expr) {
+                if(expr->tag == EXPR_FN_CALL) {
+                    memset(live_now, 0xff, sizeof(uint64_t) * live->flow.n_words);
+                } else if(expr->tag == EXPR_VARIABLE && expr->variable.param == PARAM_NONE) {
+                    bits_set(live_now, var_index(&live->vars, expr->variable.symbol));
+                } else if(expr->tag == EXPR_ASSIGN) {
+                    const uint32_t var = var_index(&live->vars, expr->assign.symbol);
+                    if(expr->op == TOK_EQUAL)
+                        bits_clear(live_now, var);
+                    else
+                        bits_set(live_now, var);
+                } else if(expr->tag == EXPR_VAR_DEF && expr->var_def.initial_value) {
+                    bits_clear(live_now, var_index(&live->vars, expr->var_def.symbol));
+                }
+            }
+        }
+    }
+
+    free(live_now);
+}
+
+static void analyze_fn(const ExprTree* tree, Expr* fn) {
+    cfg_build(&cfg, fn);
+    find_reachable();
+
+    for(BlockId b = 0; b < cfg.n_blocks; ++b) {
+        if(reachable[b])
+            continue;
+        const BasicBlock* block = &cfg.blocks[b];
+        for(uint32_t i = block->first_item; i < block->first_item + block->n_items; ++i)
+            dead[cfg.items[i].last - tree->nodes] = true;
+        if(block->n_items)
+            ++dce_stats.unreachable_blocks;
+    }
+
+    Liveness live;
+    liveness_analyze(&live, &cfg);
+    mark_dead_stores(tree, &live);
+    liveness_free(&live);
+}
+
+static void push_cursor(Expr* stmt) {
+    if(n_cursors == cursors_capacity) {
+        cursors_capacity = cursors_capacity ? cursors_capacity * 2 : 64;
+        cursors = realloc(cursors, sizeof(Expr*) * cursors_capacity);
+    }
+    cursors[n_cursors++] = stmt;
+}
+
+// Number of nodes still reachable from `expr`. Only statements with bodies
+// can lose nodes, and they are relinked before any body containing them.
+static uint32_t live_len(const ExprTree* tree, Expr* expr) {
+    switch(expr->tag) {
+        case EXPR_IF:
+        case EXPR_WHILE:
+        case EXPR_FN_DEF:
+            return live_nodes[expr - tree->nodes];
+        default:
+            return subtree_len(expr);
+    }
+}
+
+// Whether `stmt` can be dropped from its body. An if statement with a
+// constant condition is instead replaced by the body it always takes, which
+// is returned through `splice`.
+static bool is_removable(const ExprTree* tree, Expr* stmt, Expr** splice) {
+    *splice = NULL;
+    bool value;
+
+    switch(stmt->tag) {
+        case EXPR_LITERAL:
+        case EXPR_VARIABLE:
+        case EXPR_UNARY:
+        case EXPR_BINARY:
+        case EXPR_GROUPING:
+            // The value of an expression statement is discarded
+            return is_pure(stmt);
+
+        case EXPR_IF: {
+            Expr* condition = expr_child(stmt, stmt->if_stmt.condition);
+            if(dead[condition - tree->nodes])
+                return true;
+            if(constant_condition(condition, &value)) {
+                *splice = expr_child(stmt, value ? stmt->if_stmt.if_body : stmt->if_stmt.else_body);
+                return true;
+            }
+            return !stmt->if_stmt.if_body && !stmt->if_stmt.else_body && is_pure(condition);
+        }
+
+        case EXPR_WHILE: {
+            Expr* condition = expr_child(stmt, stmt->while_loop.condition);
+            return dead[condition - tree->nodes] || (constant_condition(condition, &value) && !value);
+        }
+
+        default:
+            return dead[stmt - tree->nodes];
+    }
+}
+
+// Rebuilds the body starting at `head`, one of `parent`'s children, and
+// returns the reference to its new first statement. Statements keep their
+// relative order, so every `next` still points forwards. The nodes left in
+// the body are added to `n_live`.
+static ExprRef relink(const ExprTree* tree, Expr* parent, ExprRef head, uint32_t* n_live) {
+    Expr* first = NULL;
+    Expr* last = NULL;
+
+    push_cursor(expr_child(parent, head));
+    while(n_cursors) {
+        Expr* stmt = cursors[--n_cursors];
+        if(!stmt)
+            continue;
+        push_cursor(expr_next(stmt));
+
+        Expr* splice;
+        if(is_removable(tree, stmt, &splice)) {
+            push_cursor(splice);
+            ++dce_stats.statements;
+            continue;
+        }
+
+        if(last)
+            last->next = stmt - last;
+        else
+            first = stmt;
+        last = stmt;
+        *n_live += live_len(tree, stmt);
+    }
+
+    if(!last)
+        return 0;
+    last->next = 0;
+    return parent - first;
+}
+
+// Children come before their parents, so every body is relinked before the
+// body containing it
+static void relink_tree(const ExprTree* tree) {
+    for(uint32_t i = 0; i < tree->len; ++i) {
+        Expr* expr = &tree->nodes[i];
+        uint32_t n_live = 1;
+
+        switch(expr->tag) {
+            case EXPR_IF:
+                n_live += subtree_len(expr_child(expr, expr->if_stmt.condition));
+                expr->if_stmt.if_body = relink(tree, expr, expr->if_stmt.if_body, &n_live);
+                expr->if_stmt.else_body = relink(tree, expr, expr->if_stmt.else_body, &n_live);
+                break;
+            case EXPR_WHILE:
+                n_live += subtree_len(expr_child(expr, expr->while_loop.condition));
+                expr->while_loop.body = relink(tree, expr, expr->while_loop.body, &n_live);
+                break;
+            case EXPR_FN_DEF:
+                expr->fn_def.body = relink(tree, expr, expr->fn_def.body, &n_live);
+                break;
+            default:
+                continue;
+        }
+        live_nodes[i] = n_live;
+    }
+}
+
+void eliminate_dead_code(ExprTree* trees, size_t n_trees) {
+    for(size_t i = 0; i < n_trees; ++i) {
+        const ExprTree* tree = &trees[i];
+        if(tree->len > nodes_capacity) {
+            nodes_capacity = tree->len;
+            dead = realloc(dead, sizeof(bool) * nodes_capacity);
+            live_nodes = realloc(live_nodes, sizeof(uint32_t) * nodes_capacity);
+        }
+        memset(dead, 0, sizeof(bool) * tree->len);
+
+        for(uint32_t j = 0; j < tree->len; ++j) {
+            if(tree->nodes[j].tag == EXPR_FN_DEF)
+                analyze_fn(tree, &tree->nodes[j]);
+        }
+        relink_tree(tree);
+
+        dce_stats.nodes += tree->len - live_len(tree, expr_tree_root(tree));
+    }
+}
+
+void dce_report(void) {
+    printf("dce: removed %lu statements (%lu nodes), %lu unreachable blocks and %lu dead stores\n",
+        dce_stats.statements,
+        dce_stats.nodes,
+        dce_stats.unreachable_blocks,
+        dce_stats.dead_stores
+    );
+}
+
+void dce_free(void) {
+    free(dead);
+    free(live_nodes);
+    dead = NULL;
+    live_nodes = NULL;
+    nodes_capacity = 0;
+    free(reachable);
+    free(pending);
+    reachable = NULL;
+    pending = NULL;
+    blocks_capacity = 0;
+    free(cursors);
+    cursors = NULL;
+    cursors_capacity = 0;
+    cfg_free(&cfg);
+}
@@ -0,0 +1,21 @@
+#ifndef DCE_H
+#define DCE_H
+
+#include <stddef.h>
+
+#include "expr.h"
+
+typedef struct {
+    size_t statements;
+    size_t nodes;
+    size_t unreachable_blocks;
+    size_t dead_stores;
+} DceStats;
+
+extern DceStats dce_stats;
+
+void eliminate_dead_code(ExprTree* trees, size_t n_trees);
+void dce_report(void);
+void dce_free(void);
+
+#endif // DCE_H
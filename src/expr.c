@@ -1,170 +1,261 @@
 #include <stdlib.h>
 #include <stdio.h>
 
+#include "arena.h"
 #include "expr.h"
+#include "global.h"
+#include "intern.h"
 #include "parser.h"
 #include "symbol.h"
 #include "token.h"
+#include "walk.h"
 
-Expr* expr_create_literal(Value value) {
-    Expr* result = malloc(sizeof(Expr));
-    result->tag = EXPR_LITERAL;
-    result->parent_fn = parent_fn;
-    result->literal.value = value;
-    return result;
+// Finished trees are copied into this arena, so they are torn down with a
+// single call
+static Arena expr_arena = { 0 };
+
+// Nodes of the tree currently being built
+static Expr* building = NULL;
+static uint32_t building_len = 0;
+static uint32_t building_capacity = 0;
+
+static ExprId expr_alloc(ExprTag tag) {
+    if(building_len == building_capacity) {
+        building_capacity = building_capacity ? building_capacity * 2 : 256;
+        building = realloc(building, sizeof(Expr) * building_capacity);
+    }
+
+    const ExprId id = building_len++;
+    building[id].tag = tag;
+    building[id].op = TOK_EOF;
+    building[id].type = VAL_NONE;
+    building[id].size = 0;
+    building[id].offset = 0;
+    building[id].next = 0;
+    return id;
+}
+
+// Pointers into the tree being built are only valid until the next node is
+// created
+Expr* expr_get(ExprId id) {
+    return &building[id];
+}
+
+// Drops node `from` and every node created after it
+void expr_discard(ExprId from) {
+    if(from < building_len)
+        building_len = from;
+}
+
+// First node of the subtree rooted at `expr`. A node's first child is created
+// before its others, and every child before the node itself.
+Expr* expr_first_node(Expr* expr) {
+    for(;;) {
+        ExprRef first;
+        switch(expr->tag) {
+            case EXPR_UNARY: first = expr->unary.rhs; break;
+            case EXPR_BINARY: first = expr->binary.lhs; break;
+            case EXPR_GROUPING: first = expr->grouping.expr; break;
+            case EXPR_IF: first = expr->if_stmt.condition; break;
+            case EXPR_VAR_DEF: first = expr->var_def.initial_value; break;
+            case EXPR_ASSIGN: first = expr->assign.expr; break;
+            case EXPR_WHILE: first = expr->while_loop.condition; break;
+            case EXPR_FN_DEF: first = expr->fn_def.body; break;
+            case EXPR_FN_CALL: first = expr->fn_call.params; break;
+            case EXPR_RETURN: first = expr->op_return.value_expr; break;
+            default: first = 0; break;
+        }
+
+        if(!first)
+            return expr;
+        expr = expr_child(expr, first);
+    }
+}
+
+// Chains a list of expressions, such as a body, together through their
+// `next` fields and returns the first, or EXPR_NONE if the list is empty
+ExprId expr_link(const ExprId* exprs, size_t len) {
+    if(!len)
+        return EXPR_NONE;
+
+    for(size_t i = 0; i + 1 < len; ++i)
+        building[exprs[i]].next = exprs[i + 1] - exprs[i];
+    building[exprs[len - 1]].next = 0;
+    return exprs[0];
+}
+
+// Distance from `parent` back to an optional child
+static ExprRef ref(ExprId parent, ExprId child) {
+    return child == EXPR_NONE ? 0 : parent - child;
 }
 
-Expr* expr_create_unary(Token op, Expr* rhs) {
-    Expr* result = malloc(sizeof(Expr));
-    result->tag = EXPR_UNARY;
-    result->parent_fn = parent_fn;
-    result->unary.op = op;
-    result->unary.rhs = rhs;
-    return result;
+ExprId expr_create_literal(Token tok) {
+    const ExprId id = expr_alloc(EXPR_LITERAL);
+    Expr* result = &building[id];
+    result->offset = tok.offset;
+    result->literal.parent_fn = parent_fn;
+    switch(tok.type) {
+        case TOK_INT:
+            result->literal.tag = VAL_INT;
+            result->literal.val_int = (int)tok.payload;
+            break;
+        case TOK_BOOL:
+            result->literal.tag = VAL_BOOL;
+            result->literal.val_bool = tok.payload;
+            break;
+        case TOK_STRING:
+            result->literal.tag = VAL_STRING;
+            result->literal.global_id = tok.payload;
+            break;
+        case TOK_IDENTIFIER:
+            result->literal.tag = VAL_IDENTIFIER;
+            result->literal.identifier = tok.payload;
+            break;
+
+        default:
+            result->literal.tag = VAL_NONE;
+            break;
+    }
+    return id;
 }
 
-Expr* expr_create_binary(Expr* lhs, Token op, Expr* rhs) {
-    Expr* result = malloc(sizeof(Expr));
-    result->tag = EXPR_BINARY;
-    result->parent_fn = parent_fn;
-    result->binary.lhs = lhs;
-    result->binary.op = op;
-    result->binary.rhs = rhs;
-    return result;
+ExprId expr_create_unary(Token op, ExprId rhs) {
+    if(rhs == EXPR_NONE)
+        return EXPR_NONE;
+
+    const ExprId id = expr_alloc(EXPR_UNARY);
+    Expr* result = &building[id];
+    result->op = op.type;
+    result->offset = op.offset;
+    result->unary.rhs = ref(id, rhs);
+    return id;
 }
 
-Expr* expr_create_grouping(Expr* expr) {
-    Expr* result = malloc(sizeof(Expr));
-    result->tag = EXPR_GROUPING;
-    result->parent_fn = parent_fn;
-    result->grouping.expr = expr;
-    return result;
+ExprId expr_create_binary(ExprId lhs, Token op, ExprId rhs) {
+    if(lhs == EXPR_NONE || rhs == EXPR_NONE)
+        return EXPR_NONE;
+
+    const ExprId id = expr_alloc(EXPR_BINARY);
+    Expr* result = &building[id];
+    result->op = op.type;
+    result->offset = op.offset;
+    result->binary.lhs = ref(id, lhs);
+    result->binary.rhs = ref(id, rhs);
+    return id;
 }
 
-Expr* expr_create_if(Expr* condition, Expr** if_body, size_t if_body_len, Expr** else_body, size_t else_body_len) {
-    Expr* result = malloc(sizeof(Expr));
-    result->tag = EXPR_IF;
-    result->parent_fn = parent_fn;
-    result->if_stmt.condition = condition;
-    result->if_stmt.if_body = if_body;
-    result->if_stmt.if_body_len = if_body_len;
-    result->if_stmt.else_body = else_body;
-    result->if_stmt.else_body_len = else_body_len;
-    return result;
+ExprId expr_create_grouping(ExprId expr) {
+    if(expr == EXPR_NONE)
+        return EXPR_NONE;
+
+    const ExprId id = expr_alloc(EXPR_GROUPING);
+    building[id].grouping.expr = ref(id, expr);
+    return id;
+}
+
+// Bodies may be empty, in which case they are passed as EXPR_NONE
+ExprId expr_create_if(Token keyword, ExprId condition, ExprId if_body, ExprId else_body) {
+    if(condition == EXPR_NONE)
+        return EXPR_NONE;
+
+    const ExprId id = expr_alloc(EXPR_IF);
+    Expr* result = &building[id];
+    result->offset = keyword.offset;
+    result->if_stmt.condition = ref(id, condition);
+    result->if_stmt.if_body = ref(id, if_body);
+    result->if_stmt.else_body = ref(id, else_body);
+    return id;
 }
 
-Expr* expr_create_var_def(const char* identifier, ValueTag type, Expr* initial_value) {
-    Expr* result = malloc(sizeof(Expr));
-    result->tag = EXPR_VAR_DEF;
-    result->parent_fn = parent_fn;
-    result->var_def.identifier = identifier;
+// `initial_value` is optional
+ExprId expr_create_var_def(SymbolId symbol, ValueTag type, ExprId initial_value) {
+    const ExprId id = expr_alloc(EXPR_VAR_DEF);
+    Expr* result = &building[id];
+    result->var_def.symbol = symbol;
     result->var_def.type = type;
-    result->var_def.initial_value = initial_value;
-    return result;    
+    result->var_def.initial_value = ref(id, initial_value);
+    return id;
 }
 
-Expr* expr_create_assign(const char* identifier, Token op, Expr* expr) {
-    Expr* result = malloc(sizeof(Expr));
-    result->tag = EXPR_ASSIGN;
-    result->parent_fn = parent_fn;
+ExprId expr_create_assign(InternId identifier, Token op, ExprId expr) {
+    if(expr == EXPR_NONE)
+        return EXPR_NONE;
+
+    const ExprId id = expr_alloc(EXPR_ASSIGN);
+    Expr* result = &building[id];
+    result->op = op.type;
+    result->offset = op.offset;
     result->assign.identifier = identifier;
-    result->assign.op = op;
-    result->assign.expr = expr;
-    return result;    
+    result->assign.expr = ref(id, expr);
+    return id;
 }
 
-Expr* expr_create_while(Expr* condition, Expr** body, size_t body_len) {
-    Expr* result = malloc(sizeof(Expr));
-    result->tag = EXPR_WHILE;
-    result->parent_fn = parent_fn;
-    result->while_loop.condition = condition;
-    result->while_loop.body = body;
-    result->while_loop.body_len = body_len;
-    return result;    
+ExprId expr_create_while(Token keyword, ExprId condition, ExprId body) {
+    if(condition == EXPR_NONE)
+        return EXPR_NONE;
+
+    const ExprId id = expr_alloc(EXPR_WHILE);
+    Expr* result = &building[id];
+    result->offset = keyword.offset;
+    result->while_loop.condition = ref(id, condition);
+    result->while_loop.body = ref(id, body);
+    return id;
 }
 
-Expr* expr_create_fn_def(const char* identifier, const char** param_identifiers, ValueTag* param_types, size_t n_params, ValueTag return_type, struct _Expr** body, size_t body_len) {
-    Expr* result = malloc(sizeof(Expr));
-    result->tag = EXPR_FN_DEF;
-    result->parent_fn = parent_fn;
-    result->fn_def.identifier = identifier;
-    result->fn_def.param_identifiers = param_identifiers;
-    result->fn_def.param_types = param_types;
-    result->fn_def.n_params = n_params;
-    result->fn_def.return_type = return_type;
-    result->fn_def.body = body;
-    result->fn_def.body_len = body_len;
-    return result;    
+ExprId expr_create_fn_def(SymbolId symbol, ExprId body) {
+    const ExprId id = expr_alloc(EXPR_FN_DEF);
+    Expr* result = &building[id];
+    result->fn_def.symbol = symbol;
+    result->fn_def.body = ref(id, body);
+    return id;
 }
 
-Expr* expr_create_fn_call(const Symbol fn_symbol, struct _Expr** param_exprs) {
-    Expr* result = malloc(sizeof(Expr));
-    result->tag = EXPR_FN_CALL;
-    result->parent_fn = parent_fn;
-    result->fn_call.fn_symbol = fn_symbol;
-    result->fn_call.param_exprs = param_exprs;
-    return result;
+ExprId expr_create_fn_call(Token identifier, SymbolId symbol, ExprId params) {
+    const ExprId id = expr_alloc(EXPR_FN_CALL);
+    Expr* result = &building[id];
+    result->offset = identifier.offset;
+    result->fn_call.symbol = symbol;
+    result->fn_call.params = ref(id, params);
+    return id;
 }
 
-Expr* expr_create_return(Token op, Expr* value_expr) {
-    Expr* result = malloc(sizeof(Expr));
-    result->tag = EXPR_RETURN;
-    result->parent_fn = parent_fn;
-    result->op_return.op = op;
-    result->op_return.value_expr = value_expr;
-    return result;
+ExprId expr_create_return(Token op, ExprId value_expr) {
+    if(value_expr == EXPR_NONE)
+        return EXPR_NONE;
+
+    const ExprId id = expr_alloc(EXPR_RETURN);
+    Expr* result = &building[id];
+    result->op = op.type;
+    result->offset = op.offset;
+    result->op_return.parent_fn = parent_fn;
+    result->op_return.value_expr = ref(id, value_expr);
+    return id;
 }
 
-void expr_free(Expr* expr) {
-    switch(expr->tag) {
-        case EXPR_LITERAL:
-            if(expr->literal.value.tag == VAL_STRING)
-                free((void*)expr->literal.value.val_string);
-            break;
-        case EXPR_UNARY:
-            expr_free(expr->unary.rhs);
-            break;
-        case EXPR_BINARY:
-            expr_free(expr->binary.lhs);
-            expr_free(expr->binary.rhs);
-            break;
-        case EXPR_GROUPING:
-            expr_free(expr->grouping.expr);
-            break;
-        case EXPR_IF:
-            expr_free(expr->if_stmt.condition);
-            for(size_t i = 0; i < expr->if_stmt.if_body_len; ++i)
-                expr_free(expr->if_stmt.if_body[i]);
-            for(size_t i = 0; i < expr->if_stmt.else_body_len; ++i)
-                expr_free(expr->if_stmt.else_body[i]);
-            break;
-        case EXPR_VAR_DEF:
-            if(expr->var_def.initial_value)
-                expr_free(expr->var_def.initial_value);
-            free((void*)expr->var_def.identifier);
-            break;
-        case EXPR_ASSIGN:
-            expr_free(expr->assign.expr);
-            free((void*)expr->assign.identifier);
-            break;
-        case EXPR_WHILE:
-            expr_free(expr->while_loop.condition);
-            for(size_t i = 0; i < expr->while_loop.body_len; ++i)
-                expr_free(expr->while_loop.body[i]);
-            break;
-        case EXPR_FN_DEF:
-            for(size_t i = 0; i < expr->fn_def.body_len; ++i)
-                expr_free(expr->fn_def.body[i]);
-            for(size_t i = 0; i < expr->fn_def.n_params; ++i)
-                free((void*)expr->fn_def.param_identifiers[i]);
-            free((void*)expr->fn_def.identifier);
-            free((void*)expr->fn_def.param_types);
-            break;
-        case EXPR_RETURN:
-            break;
-    }
+// Moves the tree that has been built into the arena with a single copy and
+// starts a new one
+ExprTree expr_finish_tree(void) {
+    const ExprTree tree = (ExprTree) {
+        .nodes = arena_copy(&expr_arena, building, sizeof(Expr) * building_len),
+        .len = building_len,
+    };
+    building_len = 0;
+    return tree;
+}
+
+// Releases every tree at once
+void expr_free_all(void) {
+    arena_free(&expr_arena);
+    free(building);
+    building = NULL;
+    building_len = building_capacity = 0;
+}
 
-    free(expr);
+// Releases every expression but keeps memory around for the next ones. Used
+// when top-level expressions are freed as soon as they have been compiled.
+void expr_reset(void) {
+    arena_reset(&expr_arena);
+    building_len = 0;
 }
 
 #define print_with_indent(...) \
@@ -173,30 +264,32 @@ void expr_free(Expr* expr) {
         printf(__VA_ARGS__); \
     } while(0)
 
-static void token_print(Token tok) {
-    printf("%s\n", token_strs[tok.type]);
+static void token_print(TokenType type) {
+    printf("%s\n", token_strs[type]);
 }
 
-static void token_print_with_indent(Token tok, size_t indent) {
+static void token_print_with_indent(TokenType type, size_t indent) {
     for(size_t i = 0; i < indent; ++i) {
         printf("\033[2m.\033[0m");
     }
-    token_print(tok);
+    token_print(type);
 }
 
-static void value_print(Value value) {
-    switch(value.tag) {
+static void value_print(const Expr* literal) {
+    switch(literal->literal.tag) {
         case VAL_INT:
-            printf("int = %i\n", value.val_int);
+            printf("int = %i\n", literal->literal.val_int);
             break;
         case VAL_BOOL:
-            printf("bool = %s\n", value.val_bool ? "true" : "false");
+            printf("bool = %s\n", literal->literal.val_bool ? "true" : "false");
             break;
-        case VAL_STRING:
-            printf("string = %s\n", value.val_string);
+        case VAL_STRING: {
+            const Value* value = global_get(literal->literal.global_id);
+            printf("string = %.*s\n", (int)value->val_string_len, value->val_string);
             break;
+        }
         case VAL_IDENTIFIER:
-            printf("identifier = %s\n", value.identifier);
+            printf("identifier = %s\n", intern_str(literal->literal.identifier));
             break;
         case VAL_NONE:
             printf("none\n");
@@ -207,81 +300,133 @@ static void value_print(Value value) {
     }
 }
 
-static void value_print_with_indent(Value value, size_t indent) {
+static void value_print_with_indent(const Expr* literal, size_t indent) {
     for(size_t i = 0; i < indent; ++i) {
         printf("\033[2m.\033[0m");
     }
-    value_print(value);
+    value_print(literal);
 }
 
-static void expr_print_with_indent(Expr* expr, size_t indent) {
+// Prints one step of an expression. `indent` is carried in each frame's data.
+static void expr_print_step(ExprWalk* walk, Expr* expr, uint32_t step, size_t indent) {
     switch(expr->tag) {
         case EXPR_LITERAL:
-            value_print_with_indent(expr->literal.value, indent);
+            value_print_with_indent(expr, indent);
+            break;
+        case EXPR_VARIABLE: {
+            const Symbol* symbol = symbol_at(expr->variable.symbol);
+            if(expr->variable.param == PARAM_NONE)
+                print_with_indent("global = %s\n", intern_str(symbol->identifier));
+            else
+                print_with_indent("param = %s\n", intern_str(symbol->param_identifiers[expr->variable.param]));
             break;
+        }
         case EXPR_UNARY:
-            token_print_with_indent(expr->unary.op, indent);
-            expr_print_with_indent(expr->unary.rhs, indent + 1);
+            token_print_with_indent(expr->op, indent);
+            walk_push(walk, expr_child(expr, expr->unary.rhs), 0, indent + 1);
             break;
         case EXPR_BINARY:
-            expr_print_with_indent(expr->binary.lhs, indent + 1);
-            token_print_with_indent(expr->binary.op, indent);
-            expr_print_with_indent(expr->binary.rhs, indent + 1);
+            if(step == 0) {
+                walk_push(walk, expr, 1, indent);
+                walk_push(walk, expr_child(expr, expr->binary.lhs), 0, indent + 1);
+            } else {
+                token_print_with_indent(expr->op, indent);
+                walk_push(walk, expr_child(expr, expr->binary.rhs), 0, indent + 1);
+            }
             break;
         case EXPR_GROUPING:
-            expr_print_with_indent(expr->grouping.expr, indent + 1);
+            walk_push(walk, expr_child(expr, expr->grouping.expr), 0, indent + 1);
             break;
         case EXPR_IF:
-            print_with_indent("if\n");
-            expr_print_with_indent(expr->if_stmt.condition, indent + 1);
-            print_with_indent("then\n");
-            for(size_t i = 0; i < expr->if_stmt.if_body_len; ++i)
-                expr_print_with_indent(expr->if_stmt.if_body[i], indent + 1);
-            if(expr->if_stmt.else_body) {
-                print_with_indent("else\n");
-                for(size_t i = 0; i < expr->if_stmt.else_body_len; ++i)
-                    expr_print_with_indent(expr->if_stmt.else_body[i], indent + 1);
+            switch(step) {
+                case 0:
+                    print_with_indent("if\n");
+                    walk_push(walk, expr, 1, indent);
+                    walk_push(walk, expr_child(expr, expr->if_stmt.condition), 0, indent + 1);
+                    break;
+                case 1:
+                    print_with_indent("then\n");
+                    walk_push(walk, expr, 2, indent);
+                    walk_push_list(walk, expr_child(expr, expr->if_stmt.if_body), 0, indent + 1);
+                    break;
+                case 2:
+                    walk_push(walk, expr, 3, indent);
+                    if(expr->if_stmt.else_body) {
+                        print_with_indent("else\n");
+                        walk_push_list(walk, expr_child(expr, expr->if_stmt.else_body), 0, indent + 1);
+                    }
+                    break;
+                default:
+                    print_with_indent("end\n");
+                    break;
             }
-            print_with_indent("end\n");
             break;
         case EXPR_VAR_DEF:
-            print_with_indent("var %s: %s =\n", expr->var_def.identifier, type_strs[expr->var_def.type]);
-            expr_print_with_indent(expr->var_def.initial_value, indent + 1);
+            print_with_indent("var %s: %s =\n", intern_str(symbol_at(expr->var_def.symbol)->identifier), type_strs[expr->var_def.type]);
+            if(expr->var_def.initial_value)
+                walk_push(walk, expr_child(expr, expr->var_def.initial_value), 0, indent + 1);
             break;
         case EXPR_ASSIGN:
-            print_with_indent("%s %s\n", expr->assign.identifier, token_strs[expr->assign.op.type]);
-            expr_print_with_indent(expr->assign.expr, indent + 1);
+            print_with_indent("%s %s\n", intern_str(symbol_at(expr->assign.symbol)->identifier), token_strs[expr->op]);
+            walk_push(walk, expr_child(expr, expr->assign.expr), 0, indent + 1);
             break;
         case EXPR_WHILE:
-            print_with_indent("while\n");
-            expr_print_with_indent(expr->while_loop.condition, indent + 1);
-            print_with_indent("do\n");
-            for(size_t i = 0; i < expr->while_loop.body_len; ++i)
-                expr_print_with_indent(expr->while_loop.body[i], indent + 1);
-            print_with_indent("end\n");
+            switch(step) {
+                case 0:
+                    print_with_indent("while\n");
+                    walk_push(walk, expr, 1, indent);
+                    walk_push(walk, expr_child(expr, expr->while_loop.condition), 0, indent + 1);
+                    break;
+                case 1:
+                    print_with_indent("do\n");
+                    walk_push(walk, expr, 2, indent);
+                    walk_push_list(walk, expr_child(expr, expr->while_loop.body), 0, indent + 1);
+                    break;
+                default:
+                    print_with_indent("end\n");
+                    break;
+            }
             break;
-        case EXPR_FN_DEF:
-            print_with_indent("fn %s (", expr->fn_def.identifier);
-            for(size_t i = 0; i < expr->fn_def.n_params; ++i) {
+        case EXPR_FN_DEF: {
+            if(step == 1) {
+                print_with_indent("end\n");
+                break;
+            }
+
+            const Symbol* fn = symbol_at(expr->fn_def.symbol);
+            print_with_indent("fn %s (", intern_str(fn->identifier));
+            for(size_t i = 0; i < fn->n_params; ++i) {
                 printf(
                     "%s: %s%s",
-                    expr->fn_def.param_identifiers[i],
-                    type_strs[expr->fn_def.param_types[i]],
-                    i == expr->fn_def.n_params - 1 ? "" : ", "
+                    intern_str(fn->param_identifiers[i]),
+                    type_strs[fn->param_types[i]],
+                    i == fn->n_params - 1 ? "" : ", "
                 );
             }
-            printf(") %s\n", type_strs[expr->fn_def.return_type]);
-            for(size_t i = 0; i < expr->fn_def.body_len; ++i)
-                expr_print_with_indent(expr->fn_def.body[i], indent + 1);
-            print_with_indent("end\n");
+            printf(") %s\n", type_strs[fn->return_type]);
+            walk_push(walk, expr, 1, indent);
+            walk_push_list(walk, expr_child(expr, expr->fn_def.body), 0, indent + 1);
+            break;
+        }
+        case EXPR_FN_CALL:
+            print_with_indent("call %s\n", intern_str(symbol_at(expr->fn_call.symbol)->identifier));
+            walk_push_list(walk, expr_child(expr, expr->fn_call.params), 0, indent + 1);
             break;
         case EXPR_RETURN:
             print_with_indent("return\n");
-            expr_print_with_indent(expr->op_return.value_expr, indent + 1);
+            walk_push(walk, expr_child(expr, expr->op_return.value_expr), 0, indent + 1);
             break;
     }
 }
 
+// Assignments are printed by symbol, so names must have been resolved
 void expr_print(Expr* expr) {
-    expr_print_with_indent(expr, 0);
+    ExprWalk walk = { 0 };
+    walk_push(&walk, expr, 0, 0);
+
+    ExprFrame frame;
+    while(walk_pop(&walk, &frame))
+        expr_print_step(&walk, frame.expr, frame.step, frame.data);
+
+    walk_free(&walk);
 }
@@ -1,11 +1,15 @@
 #ifndef EXPR_H
 #define EXPR_H
 
+#include <stdbool.h>
+#include <stdint.h>
+
 #include "symbol.h"
 #include "token.h"
 
 typedef enum {
     EXPR_LITERAL,
+    EXPR_VARIABLE,
     EXPR_UNARY,
     EXPR_BINARY,
     EXPR_GROUPING,
@@ -18,68 +22,126 @@ typedef enum {
     EXPR_RETURN,
 } ExprTag;
 
+// Index of a node within the tree currently being built
+typedef uint32_t ExprId;
+#define EXPR_NONE UINT32_MAX
+
+// Distance back from a node to one of its children. Children always precede
+// their parent, so 0 is free to mean "no child".
+typedef uint32_t ExprRef;
+
+#define PARAM_NONE UINT32_MAX
+
+// Expressions are kept small so that passes over large programs touch as
+// few cache lines as possible. Symbols are referred to by ID and operators by
+// their token type, with lengths and IDs stored as 32-bit integers.
 typedef struct _Expr {
-    ExprTag tag;
-    Symbol parent_fn;
+    ExprTag tag : 8;
+    TokenType op : 8; // Operator of unary, binary, assign and return expressions
+    ValueTag type : 8; // Filled in by the typechecker, VAL_NONE for statements
+    unsigned size : 8; // Size in bytes of a value of `type`, 0 if it has none
+    uint32_t offset; // Source offset of the operator, literal or keyword token, or of the function called, otherwise 0
+    uint32_t next; // Distance forward to the next expression of the same body, 0 for the last
     union {
-        struct { Value value; } literal;
-        struct { Token op; struct _Expr* rhs; } unary;
-        struct { struct _Expr* lhs; Token op; struct _Expr* rhs; } binary;
-        struct { struct _Expr* expr; } grouping;
         struct {
-            struct _Expr* condition;
-            struct _Expr** if_body;
-            size_t if_body_len;
-            struct _Expr** else_body;
-            size_t else_body_len;
+            ValueTag tag;
+            union {
+                int val_int;
+                bool val_bool;
+                uint32_t global_id; // Strings are stored as globals
+                InternId identifier;
+            };
+            SymbolId parent_fn; // Function whose parameters the identifier may refer to
+        } literal;
+        // Identifier literals are replaced by variables once names are resolved
+        struct {
+            SymbolId symbol; // Global variable, or the function owning the parameter
+            uint32_t param; // Index of the parameter, PARAM_NONE for globals
+            uint32_t frame_offset; // Offset of the parameter within its function's frame
+        } variable;
+        struct { ExprRef rhs; } unary;
+        struct { ExprRef lhs; ExprRef rhs; } binary;
+        struct { ExprRef expr; } grouping;
+        struct {
+            ExprRef condition;
+            ExprRef if_body; // First expression of each body
+            ExprRef else_body;
         } if_stmt;
         struct {
-            const char* identifier;
+            SymbolId symbol;
             ValueTag type;
-            struct _Expr* initial_value;
+            ExprRef initial_value;
         } var_def;
         struct {
-            const char* identifier;
-            Token op;
-            struct _Expr* expr;
+            union {
+                InternId identifier; // Until names are resolved
+                SymbolId symbol;
+            };
+            ExprRef expr;
         } assign;
         struct {
-            struct _Expr* condition;
-            struct _Expr** body;
-            size_t body_len;
+            ExprRef condition;
+            ExprRef body;
         } while_loop;
         struct {
-            const char* identifier;
-            const char** param_identifiers;
-            ValueTag* param_types;
-            size_t n_params;
-            ValueTag return_type;
-            struct _Expr** body;
-            size_t body_len;
+            SymbolId symbol; // Name and signature live in the symbol table
+            ExprRef body;
         } fn_def;
         struct {
-            Symbol fn_symbol;
-            struct _Expr** param_exprs;
+            SymbolId symbol;
+            ExprRef params; // Linked like a body, one per parameter of `symbol`
         } fn_call;
         struct {
-            Token op;
-            struct _Expr* value_expr;
+            SymbolId parent_fn;
+            ExprRef value_expr;
         } op_return;
     };
 } Expr;
 
-Expr* expr_create_literal(Value value);
-Expr* expr_create_unary(Token op, Expr* rhs);
-Expr* expr_create_binary(Expr* lhs, Token op, Expr* rhs);
-Expr* expr_create_grouping(Expr* expr);
-Expr* expr_create_if(Expr* condition, Expr** if_body, size_t if_body_len, Expr** else_body, size_t else_body_len);
-Expr* expr_create_var_def(const char* identifier, ValueTag type, Expr* initial_value);
-Expr* expr_create_assign(const char* identifier, Token op, Expr* expr);
-Expr* expr_create_while(Expr* condition, Expr** body, size_t body_len);
-Expr* expr_create_fn_def(const char* identifier, const char** param_identifiers, ValueTag* param_types, size_t n_params, ValueTag return_type, struct _Expr** body, size_t body_len);
-Expr* expr_create_fn_call(const Symbol fn_symbol, struct _Expr** param_exprs);
-Expr* expr_create_return(Token op, Expr* value_expr);
-void expr_free(Expr* expr);
+_Static_assert(sizeof(Expr) <= 28, "Expr nodes should stay within 28 bytes");
+
+// The nodes of one top-level expression stored contiguously in post-order, so
+// every child comes before its parent and the root is last. A tree contains
+// no pointers and can be copied or written out as a single block.
+typedef struct {
+    Expr* nodes;
+    uint32_t len;
+} ExprTree;
+
+static inline Expr* expr_child(Expr* expr, ExprRef ref) {
+    return ref ? expr - ref : NULL;
+}
+
+static inline Expr* expr_next(Expr* expr) {
+    return expr->next ? expr + expr->next : NULL;
+}
+
+static inline Expr* expr_tree_root(const ExprTree* tree) {
+    return &tree->nodes[tree->len - 1];
+}
+
+// Nodes are appended to the tree being built as they are created, which
+// gives post-order for free when children are created before their parents.
+// A failure to create a node, including any of its children having failed,
+// is signalled by EXPR_NONE.
+Expr* expr_get(ExprId id);
+void expr_discard(ExprId from);
+ExprId expr_link(const ExprId* exprs, size_t len);
+ExprId expr_create_literal(Token tok);
+ExprId expr_create_unary(Token op, ExprId rhs);
+ExprId expr_create_binary(ExprId lhs, Token op, ExprId rhs);
+ExprId expr_create_grouping(ExprId expr);
+ExprId expr_create_if(Token keyword, ExprId condition, ExprId if_body, ExprId else_body);
+ExprId expr_create_var_def(SymbolId symbol, ValueTag type, ExprId initial_value);
+ExprId expr_create_assign(InternId identifier, Token op, ExprId expr);
+ExprId expr_create_while(Token keyword, ExprId condition, ExprId body);
+ExprId expr_create_fn_def(SymbolId symbol, ExprId body);
+ExprId expr_create_fn_call(Token identifier, SymbolId symbol, ExprId params);
+ExprId expr_create_return(Token op, ExprId value_expr);
+ExprTree expr_finish_tree(void);
+Expr* expr_first_node(Expr* expr);
+void expr_free_all(void);
+void expr_reset(void);
 
 void expr_print(Expr* expr);
 
@@ -0,0 +1,107 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+#include "intern.h"
+
+// Each distinct spelling is stored once, NUL-terminated
+static Arena intern_arena = { 0 };
+
+static const char** interned_strs = NULL;
+static uint32_t* interned_lens = NULL;
+static size_t interned_capacity = 0;
+size_t n_interned = 0;
+
+// Open addressing table of `id + 1`, zero marks an empty slot
+static uint32_t* slots = NULL;
+static uint32_t* slot_hashes = NULL;
+static size_t n_slots = 0;
+
+static uint32_t hash_str(const char* str, size_t len) {
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    for(size_t i = 0; i < len; ++i) {
+        hash ^= (unsigned char)str[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static const char* store_str(const char* str, size_t len) {
+    char* result = arena_alloc(&intern_arena, len + 1);
+    memcpy(result, str, len);
+    result[len] = '\0';
+    return result;
+}
+
+static void grow_slots(void) {
+    const size_t new_n_slots = n_slots ? n_slots * 2 : 1024;
+    uint32_t* new_slots = calloc(new_n_slots, sizeof(uint32_t));
+    uint32_t* new_hashes = malloc(sizeof(uint32_t) * new_n_slots);
+
+    for(size_t i = 0; i < n_slots; ++i) {
+        if(!slots[i])
+            continue;
+
+        size_t j = slot_hashes[i] & (new_n_slots - 1);
+        while(new_slots[j])
+            j = (j + 1) & (new_n_slots - 1);
+        new_slots[j] = slots[i];
+        new_hashes[j] = slot_hashes[i];
+    }
+
+    free(slots);
+    free(slot_hashes);
+    slots = new_slots;
+    slot_hashes = new_hashes;
+    n_slots = new_n_slots;
+}
+
+InternId intern(const char* str, size_t len) {
+    // Keep the load factor at or below one half
+    if((n_interned + 1) * 2 > n_slots)
+        grow_slots();
+
+    const uint32_t hash = hash_str(str, len);
+    size_t i = hash & (n_slots - 1);
+    while(slots[i]) {
+        const InternId id = slots[i] - 1;
+        if(slot_hashes[i] == hash && interned_lens[id] == len && memcmp(interned_strs[id], str, len) == 0)
+            return id;
+        i = (i + 1) & (n_slots - 1);
+    }
+
+    if(n_interned == interned_capacity) {
+        interned_capacity = interned_capacity ? interned_capacity * 2 : 256;
+        interned_strs = realloc(interned_strs, sizeof(const char*) * interned_capacity);
+        interned_lens = realloc(interned_lens, sizeof(uint32_t) * interned_capacity);
+    }
+
+    const InternId id = n_interned++;
+    interned_strs[id] = store_str(str, len);
+    interned_lens[id] = len;
+    slots[i] = id + 1;
+    slot_hashes[i] = hash;
+    return id;
+}
+
+const char* intern_str(InternId id) {
+    return interned_strs[id];
+}
+
+size_t intern_len(InternId id) {
+    return interned_lens[id];
+}
+
+void intern_free_all(void) {
+    arena_free(&intern_arena);
+
+    free(interned_strs);
+    free(interned_lens);
+    free(slots);
+    free(slot_hashes);
+    interned_strs = NULL;
+    interned_lens = NULL;
+    slots = slot_hashes = NULL;
+    n_interned = interned_capacity = n_slots = 0;
+}
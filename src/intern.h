@@ -0,0 +1,18 @@
+#ifndef INTERN_H
+#define INTERN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Dense ID of an interned spelling. Equal spellings always map to the same
+// ID, so names can be compared and hashed as integers.
+typedef uint32_t InternId;
+
+extern size_t n_interned;
+
+InternId intern(const char* str, size_t len);
+const char* intern_str(InternId id);
+size_t intern_len(InternId id);
+void intern_free_all(void);
+
+#endif // INTERN_H
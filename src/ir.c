@@ -0,0 +1,516 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "intern.h"
+#include "ir.h"
+#include "symbol.h"
+#include "value.h"
+
+const char* ir_op_strs[] = {
+    "const",
+    "string",
+    "param",
+    "load",
+    "store",
+    "neg",
+    "not",
+    "add",
+    "sub",
+    "mul",
+    "div",
+    "eq",
+    "ne",
+    "lt",
+    "le",
+    "gt",
+    "ge",
+    "call",
+    "phi",
+    "jump",
+    "branch",
+    "ret",
+};
+
+IrFunction* ir_add_function(IrProgram* program, SymbolId symbol) {
+    if(program->n_fns == program->capacity) {
+        program->capacity = program->capacity ? program->capacity * 2 : 16;
+        program->fns = realloc(program->fns, sizeof(IrFunction) * program->capacity);
+    }
+
+    IrFunction* fn = &program->fns[program->n_fns++];
+    *fn = (IrFunction) { .symbol = symbol };
+    return fn;
+}
+
+IrBlockId ir_add_block(IrFunction* fn) {
+    if(fn->n_blocks == fn->blocks_capacity) {
+        fn->blocks_capacity = fn->blocks_capacity ? fn->blocks_capacity * 2 : 16;
+        fn->blocks = realloc(fn->blocks, sizeof(IrBlock) * fn->blocks_capacity);
+    }
+
+    fn->blocks[fn->n_blocks] = (IrBlock) { 0 };
+    return fn->n_blocks++;
+}
+
+void ir_add_pred(IrFunction* fn, IrBlockId block, IrBlockId pred) {
+    IrBlock* b = &fn->blocks[block];
+    if(b->n_preds == b->preds_capacity) {
+        b->preds_capacity = b->preds_capacity ? b->preds_capacity * 2 : 2;
+        b->preds = realloc(b->preds, sizeof(IrBlockId) * b->preds_capacity);
+    }
+    b->preds[b->n_preds++] = pred;
+}
+
+// Creates an instruction with room for `n_args` operands, which is not yet
+// part of any block
+IrValue ir_new_inst(IrFunction* fn, IrOp op, ValueTag type, uint32_t n_args) {
+    if(fn->n_insts == fn->insts_capacity) {
+        fn->insts_capacity = fn->insts_capacity ? fn->insts_capacity * 2 : 64;
+        fn->insts = realloc(fn->insts, sizeof(IrInst) * fn->insts_capacity);
+    }
+    if(fn->n_args + n_args > fn->args_capacity) {
+        while(fn->n_args + n_args > fn->args_capacity)
+            fn->args_capacity = fn->args_capacity ? fn->args_capacity * 2 : 64;
+        fn->args = realloc(fn->args, sizeof(IrValue) * fn->args_capacity);
+    }
+
+    fn->insts[fn->n_insts] = (IrInst) {
+        .op = op,
+        .type = type,
+        .block = IR_NONE,
+        .first_arg = fn->n_args,
+        .n_args = n_args,
+    };
+    for(uint32_t i = 0; i < n_args; ++i)
+        fn->args[fn->n_args + i] = IR_NONE;
+    fn->n_args += n_args;
+
+    return fn->n_insts++;
+}
+
+// Gives `value` room for `n_args` operands, keeping those it already has. A
+// longer list is moved to the end of the operand storage.
+void ir_set_n_args(IrFunction* fn, IrValue value, uint32_t n_args) {
+    if(n_args > fn->insts[value].n_args) {
+        if(fn->n_args + n_args > fn->args_capacity) {
+            while(fn->n_args + n_args > fn->args_capacity)
+                fn->args_capacity = fn->args_capacity ? fn->args_capacity * 2 : 64;
+            fn->args = realloc(fn->args, sizeof(IrValue) * fn->args_capacity);
+        }
+
+        IrInst* inst = &fn->insts[value];
+        memcpy(&fn->args[fn->n_args], &fn->args[inst->first_arg], sizeof(IrValue) * inst->n_args);
+        for(uint32_t i = inst->n_args; i < n_args; ++i)
+            fn->args[fn->n_args + i] = IR_NONE;
+        inst->first_arg = fn->n_args;
+        fn->n_args += n_args;
+    }
+    fn->insts[value].n_args = n_args;
+}
+
+void ir_insert(IrFunction* fn, IrBlockId block, uint32_t index, IrValue value) {
+    IrBlock* b = &fn->blocks[block];
+    if(b->n_insts == b->insts_capacity) {
+        b->insts_capacity = b->insts_capacity ? b->insts_capacity * 2 : 8;
+        b->insts = realloc(b->insts, sizeof(IrValue) * b->insts_capacity);
+    }
+
+    memmove(&b->insts[index + 1], &b->insts[index], sizeof(IrValue) * (b->n_insts - index));
+    b->insts[index] = value;
+    ++b->n_insts;
+    fn->insts[value].block = block;
+}
+
+void ir_append(IrFunction* fn, IrBlockId block, IrValue value) {
+    ir_insert(fn, block, fn->blocks[block].n_insts, value);
+}
+
+// Moves the instructions of `block` from `index` onwards into a new block,
+// which takes over its edges to its successors. `block` is left without a
+// terminator.
+IrBlockId ir_split_block(IrFunction* fn, IrBlockId block, uint32_t index) {
+    const IrBlockId tail = ir_add_block(fn);
+    for(uint32_t i = index; i < fn->blocks[block].n_insts; ++i)
+        ir_append(fn, tail, fn->blocks[block].insts[i]);
+    fn->blocks[block].n_insts = index;
+
+    const IrInst* terminator = ir_terminator(fn, tail);
+    for(uint32_t i = 0; terminator && i < ir_n_succs(terminator); ++i) {
+        IrBlock* succ = &fn->blocks[terminator->targets[i]];
+        succ->preds[ir_pred_index(fn, terminator->targets[i], block)] = tail;
+    }
+    return tail;
+}
+
+// Drops the edge from the `index`th predecessor of `block`, along with the
+// operands its phis take from it
+void ir_remove_pred(IrFunction* fn, IrBlockId block, uint32_t index) {
+    IrBlock* b = &fn->blocks[block];
+    for(uint32_t i = 0; i < b->n_insts; ++i) {
+        IrInst* phi = ir_inst(fn, b->insts[i]);
+        if(phi->op != IR_PHI)
+            break;
+        IrValue* args = ir_args(fn, phi);
+        memmove(&args[index], &args[index + 1], sizeof(IrValue) * (phi->n_args - index - 1));
+        --phi->n_args;
+    }
+    memmove(&b->preds[index], &b->preds[index + 1], sizeof(IrBlockId) * (b->n_preds - index - 1));
+    --b->n_preds;
+}
+
+static IrValue resolve(IrValue* forward, IrValue value) {
+    while(forward[value] != value)
+        value = forward[value] = forward[forward[value]];
+    return value;
+}
+
+// Replaces every use of a value by `forward[value]`, which maps the values
+// kept to themselves, and removes the values replaced. Chains of
+// replacements are followed to their end.
+void ir_forward_values(IrFunction* fn, IrValue* forward) {
+    for(IrBlockId b = 0; b < fn->n_blocks; ++b) {
+        IrBlock* block = &fn->blocks[b];
+        uint32_t n_insts = 0;
+        for(uint32_t i = 0; i < block->n_insts; ++i) {
+            const IrValue value = block->insts[i];
+            IrInst* inst = ir_inst(fn, value);
+            if(forward[value] != value) {
+                inst->block = IR_NONE;
+                continue;
+            }
+            for(uint32_t j = 0; j < inst->n_args; ++j)
+                ir_args(fn, inst)[j] = resolve(forward, ir_args(fn, inst)[j]);
+            block->insts[n_insts++] = value;
+        }
+        block->n_insts = n_insts;
+    }
+}
+
+// A phi whose operands are all the same value, or itself, is replaced by
+// that value. Removing one phi can make others trivial, so this is repeated
+// until nothing changes. `forward` needs room for every instruction.
+void ir_remove_trivial_phis(IrFunction* fn, IrValue* forward) {
+    for(IrValue v = 0; v < fn->n_insts; ++v)
+        forward[v] = v;
+
+    bool changed = true;
+    bool removed = false;
+    while(changed) {
+        changed = false;
+        for(IrBlockId b = 0; b < fn->n_blocks; ++b) {
+            const IrBlock* block = &fn->blocks[b];
+            for(uint32_t i = 0; i < block->n_insts; ++i) {
+                const IrValue phi = block->insts[i];
+                const IrInst* inst = ir_inst(fn, phi);
+                if(inst->op != IR_PHI)
+                    break;
+                if(forward[phi] != phi)
+                    continue;
+
+                IrValue same = IR_NONE;
+                bool trivial = true;
+                for(uint32_t j = 0; j < inst->n_args && trivial; ++j) {
+                    const IrValue arg = resolve(forward, ir_args(fn, inst)[j]);
+                    if(arg == phi || arg == same)
+                        continue;
+                    trivial = same == IR_NONE;
+                    same = arg;
+                }
+
+                if(trivial && same != IR_NONE) {
+                    forward[phi] = same;
+                    changed = removed = true;
+                }
+            }
+        }
+    }
+
+    if(removed)
+        ir_forward_values(fn, forward);
+}
+
+// Position of `pred` among the predecessors of `block`, and so of the operand
+// its phis take from it
+uint32_t ir_pred_index(const IrFunction* fn, IrBlockId block, IrBlockId pred) {
+    const IrBlock* b = &fn->blocks[block];
+    for(uint32_t i = 0; i < b->n_preds; ++i) {
+        if(b->preds[i] == pred)
+            return i;
+    }
+    return IR_NONE;
+}
+
+ValueTag ir_return_type(const IrFunction* fn) {
+    return fn->symbol == SYMBOL_NONE ? VAL_NONE : symbol_at(fn->symbol)->return_type;
+}
+
+// Renumbers blocks in reverse postorder, which places every block after its
+// dominator and the blocks of a loop between its header and the code
+// following it. Blocks which are unreachable from the entry are removed.
+void ir_sort_blocks(IrFunction* fn) {
+    IrBlockId* order = malloc(sizeof(IrBlockId) * fn->n_blocks);
+    IrBlockId* renumber = malloc(sizeof(IrBlockId) * fn->n_blocks);
+    uint32_t* stack = malloc(sizeof(uint32_t) * fn->n_blocks * 2);
+    for(IrBlockId b = 0; b < fn->n_blocks; ++b)
+        renumber[b] = IR_NONE;
+
+    // Depth-first, following the false edge of a branch first so that the
+    // true edge ends up laid out straight after it
+    uint32_t n_order = 0;
+    uint32_t depth = 0;
+    renumber[IR_ENTRY] = 0;
+    stack[depth++] = IR_ENTRY;
+    stack[depth++] = 0;
+    while(depth) {
+        const IrBlockId block = stack[depth - 2];
+        const IrInst* terminator = ir_terminator(fn, block);
+        const uint32_t n_succs = terminator ? ir_n_succs(terminator) : 0;
+        const uint32_t visited = stack[depth - 1]++;
+
+        if(visited == n_succs) {
+            order[n_order++] = block;
+            depth -= 2;
+            continue;
+        }
+
+        const IrBlockId succ = terminator->targets[n_succs - 1 - visited];
+        if(renumber[succ] == IR_NONE) {
+            renumber[succ] = 0;
+            stack[depth++] = succ;
+            stack[depth++] = 0;
+        }
+    }
+    free(stack);
+
+    for(IrBlockId b = 0; b < fn->n_blocks; ++b)
+        renumber[b] = IR_NONE;
+    for(uint32_t i = 0; i < n_order; ++i)
+        renumber[order[n_order - 1 - i]] = i;
+
+    // Edges from removed blocks are dropped along with their phi operands
+    for(IrBlockId b = 0; b < fn->n_blocks; ++b) {
+        IrBlock* block = &fn->blocks[b];
+        if(renumber[b] == IR_NONE)
+            continue;
+
+        uint32_t n_preds = 0;
+        for(uint32_t i = 0; i < block->n_preds; ++i) {
+            if(renumber[block->preds[i]] == IR_NONE)
+                continue;
+
+            for(uint32_t j = 0; j < block->n_insts; ++j) {
+                IrInst* phi = ir_inst(fn, block->insts[j]);
+                if(phi->op != IR_PHI)
+                    break;
+                ir_args(fn, phi)[n_preds] = ir_args(fn, phi)[i];
+            }
+            block->preds[n_preds++] = renumber[block->preds[i]];
+        }
+
+        for(uint32_t j = 0; j < block->n_insts; ++j) {
+            IrInst* inst = ir_inst(fn, block->insts[j]);
+            if(inst->op == IR_PHI)
+                inst->n_args = n_preds;
+            inst->block = renumber[b];
+            if(inst->op == IR_JUMP || inst->op == IR_BRANCH) {
+                for(uint32_t k = 0; k < ir_n_succs(inst); ++k)
+                    inst->targets[k] = renumber[inst->targets[k]];
+            }
+        }
+        block->n_preds = n_preds;
+    }
+
+    IrBlock* blocks = malloc(sizeof(IrBlock) * (n_order ? n_order : 1));
+    for(IrBlockId b = 0; b < fn->n_blocks; ++b) {
+        if(renumber[b] != IR_NONE) {
+            blocks[renumber[b]] = fn->blocks[b];
+        } else {
+            for(uint32_t j = 0; j < fn->blocks[b].n_insts; ++j)
+                ir_inst(fn, fn->blocks[b].insts[j])->block = IR_NONE;
+            free(fn->blocks[b].insts);
+            free(fn->blocks[b].preds);
+        }
+    }
+
+    free(fn->blocks);
+    fn->blocks = blocks;
+    fn->n_blocks = fn->blocks_capacity = n_order;
+
+    free(order);
+    free(renumber);
+}
+
+// Joins each block ending in a jump to the block it jumps to, when that is
+// its only predecessor. Phis of such a block have a single operand, and must
+// have been removed beforehand.
+// Blocks are in reverse postorder, so a block's dominators all have lower
+// numbers than it
+IrBlockId ir_common_dominator(const IrBlockId* idoms, IrBlockId a, IrBlockId b) {
+    while(a != b) {
+        while(a > b)
+            a = idoms[a];
+        while(b > a)
+            b = idoms[b];
+    }
+    return a;
+}
+
+// Fills `idoms` with the immediate dominator of each block, by the iterative
+// algorithm of Cooper, Harvey and Kennedy. Blocks must be sorted.
+void ir_find_dominators(const IrFunction* fn, IrBlockId* idoms) {
+    idoms[IR_ENTRY] = IR_ENTRY;
+    for(IrBlockId b = 1; b < fn->n_blocks; ++b)
+        idoms[b] = IR_NONE;
+
+    bool changed = true;
+    while(changed) {
+        changed = false;
+        for(IrBlockId b = 1; b < fn->n_blocks; ++b) {
+            const IrBlock* block = &fn->blocks[b];
+            IrBlockId idom = IR_NONE;
+            for(uint32_t i = 0; i < block->n_preds; ++i) {
+                const IrBlockId pred = block->preds[i];
+                if(idoms[pred] == IR_NONE)
+                    continue;
+                idom = idom == IR_NONE ? pred : ir_common_dominator(idoms, pred, idom);
+            }
+            if(idoms[b] != idom) {
+                idoms[b] = idom;
+                changed = true;
+            }
+        }
+    }
+}
+
+void ir_merge_blocks(IrFunction* fn) {
+    bool merged = false;
+    for(IrBlockId b = 0; b < fn->n_blocks; ++b) {
+        for(;;) {
+            const IrInst* jump = ir_terminator(fn, b);
+            const IrBlockId succ = jump && jump->op == IR_JUMP ? jump->targets[0] : IR_NONE;
+            if(succ == IR_NONE || succ == b || fn->blocks[succ].n_preds != 1)
+                break;
+
+            ir_inst(fn, fn->blocks[b].insts[--fn->blocks[b].n_insts])->block = IR_NONE;
+            for(uint32_t i = 0; i < fn->blocks[succ].n_insts; ++i)
+                ir_append(fn, b, fn->blocks[succ].insts[i]);
+            fn->blocks[succ].n_insts = 0;
+            fn->blocks[succ].n_preds = 0;
+
+            const IrInst* terminator = ir_terminator(fn, b);
+            for(uint32_t i = 0; i < ir_n_succs(terminator); ++i) {
+                const IrBlockId target = terminator->targets[i];
+                fn->blocks[target].preds[ir_pred_index(fn, target, succ)] = b;
+            }
+            merged = true;
+        }
+    }
+
+    // The blocks emptied are no longer reachable
+    if(merged)
+        ir_sort_blocks(fn);
+}
+
+void ir_function_free(IrFunction* fn) {
+    for(IrBlockId b = 0; b < fn->n_blocks; ++b) {
+        free(fn->blocks[b].insts);
+        free(fn->blocks[b].preds);
+    }
+    free(fn->blocks);
+    free(fn->insts);
+    free(fn->args);
+    *fn = (IrFunction) { 0 };
+}
+
+void ir_program_reset(IrProgram* program) {
+    for(size_t i = 0; i < program->n_fns; ++i)
+        ir_function_free(&program->fns[i]);
+    program->n_fns = 0;
+}
+
+void ir_program_free(IrProgram* program) {
+    ir_program_reset(program);
+    free(program->fns);
+    *program = (IrProgram) { 0 };
+}
+
+static const char* fn_name(const IrFunction* fn) {
+    return fn->symbol == SYMBOL_NONE ? "<top-level>" : intern_str(symbol_at(fn->symbol)->identifier);
+}
+
+static void print_inst(const IrFunction* fn, IrValue value, FILE* out) {
+    const IrInst* inst = ir_inst(fn, value);
+    const IrValue* args = ir_args(fn, inst);
+
+    fprintf(out, "    ");
+    if(inst->type != VAL_NONE)
+        fprintf(out, "%%%u = ", value);
+    fprintf(out, "%s", ir_op_strs[inst->op]);
+    if(inst->type != VAL_NONE)
+        fprintf(out, " %s", type_strs[inst->type]);
+
+    switch(inst->op) {
+        case IR_CONST:
+            fprintf(out, " %lld", (long long)inst->imm);
+            break;
+        case IR_STRING:
+            fprintf(out, " str_%u", inst->global_id);
+            break;
+        case IR_PARAM:
+            fprintf(out, " %u", inst->param);
+            break;
+        case IR_LOAD:
+        case IR_STORE:
+        case IR_CALL:
+            fprintf(out, " %s%s", intern_str(symbol_at(inst->symbol)->identifier), inst->n_args ? "," : "");
+            break;
+        default:
+            break;
+    }
+
+    if(inst->op == IR_PHI) {
+        const IrBlock* block = &fn->blocks[inst->block];
+        for(uint32_t i = 0; i < inst->n_args; ++i)
+            fprintf(out, "%s [%%%u, b%u]", i ? "," : "", args[i], block->preds[i]);
+    } else {
+        for(uint32_t i = 0; i < inst->n_args; ++i)
+            fprintf(out, "%s %%%u", i ? "," : "", args[i]);
+    }
+
+    if(inst->op == IR_JUMP)
+        fprintf(out, " b%u", inst->targets[0]);
+    else if(inst->op == IR_BRANCH)
+        fprintf(out, ", b%u, b%u", inst->targets[0], inst->targets[1]);
+    fprintf(out, "\n");
+}
+
+void ir_print_function(const IrFunction* fn, FILE* out) {
+    fprintf(out, "fn %s(", fn_name(fn));
+    if(fn->symbol != SYMBOL_NONE) {
+        const Symbol* symbol = symbol_at(fn->symbol);
+        for(size_t i = 0; i < symbol->n_params; ++i)
+            fprintf(out, "%s%s", i ? ", " : "", type_strs[symbol->param_types[i]]);
+        fprintf(out, ") %s {\n", type_strs[symbol->return_type]);
+    } else {
+        fprintf(out, ") {\n");
+    }
+
+    for(IrBlockId b = 0; b < fn->n_blocks; ++b) {
+        const IrBlock* block = &fn->blocks[b];
+        fprintf(out, "b%u:", b);
+        for(uint32_t i = 0; i < block->n_preds; ++i)
+            fprintf(out, "%s b%u", i ? "," : " ; preds", block->preds[i]);
+        fprintf(out, "\n");
+
+        for(uint32_t i = 0; i < block->n_insts; ++i)
+            print_inst(fn, block->insts[i], out);
+    }
+    fprintf(out, "}\n\n");
+}
+
+void ir_print_program(const IrProgram* program, FILE* out) {
+    for(size_t i = 0; i < program->n_fns; ++i)
+        ir_print_function(&program->fns[i], out);
+}
@@ -0,0 +1,206 @@
+#ifndef IR_H
+#define IR_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "expr.h"
+#include "symbol.h"
+#include "value.h"
+
+typedef enum {
+    IR_CONST,
+    IR_STRING,
+    IR_PARAM,
+    IR_LOAD,
+    IR_STORE,
+    IR_NEG,
+    IR_NOT,
+    IR_ADD,
+    IR_SUB,
+    IR_MUL,
+    IR_DIV,
+    IR_EQ,
+    IR_NE,
+    IR_LT,
+    IR_LE,
+    IR_GT,
+    IR_GE,
+    IR_CALL,
+    IR_PHI,
+    IR_JUMP,
+    IR_BRANCH,
+    IR_RET,
+} IrOp;
+
+extern const char* ir_op_strs[];
+
+// Every value is defined by exactly one instruction and is named by that
+// instruction's index within its function
+typedef uint32_t IrValue;
+typedef uint32_t IrBlockId;
+#define IR_NONE UINT32_MAX
+
+#define IR_ENTRY 0
+
+typedef struct {
+    IrOp op : 8;
+    ValueTag type : 8; // VAL_NONE for instructions which define no value
+    IrBlockId block; // IR_NONE once the instruction has been removed
+    uint32_t first_arg; // Operands are stored contiguously in the function's `args`
+    uint32_t n_args;
+    union {
+        int64_t imm; // IR_CONST
+        uint32_t global_id; // IR_STRING
+        uint32_t param; // IR_PARAM
+        SymbolId symbol; // Global or function of IR_LOAD, IR_STORE and IR_CALL
+        IrBlockId targets[2]; // IR_JUMP, and IR_BRANCH taken when true then false
+    };
+} IrInst;
+
+// Phis come first and the terminator last. A phi has one operand per
+// predecessor, in the order of `preds`.
+typedef struct {
+    IrValue* insts;
+    uint32_t n_insts;
+    uint32_t insts_capacity;
+    IrBlockId* preds;
+    uint32_t n_preds;
+    uint32_t preds_capacity;
+} IrBlock;
+
+// A function in SSA form. Globals are only accessed through loads and stores,
+// while parameters and temporaries are values. The top-level statements of a
+// tree are built into a function without a symbol, which is run before
+// `main`.
+typedef struct {
+    SymbolId symbol; // SYMBOL_NONE for top-level statements
+    IrInst* insts;
+    uint32_t n_insts;
+    uint32_t insts_capacity;
+    IrValue* args;
+    uint32_t n_args;
+    uint32_t args_capacity;
+    IrBlock* blocks;
+    uint32_t n_blocks;
+    uint32_t blocks_capacity;
+} IrFunction;
+
+typedef struct {
+    IrFunction* fns;
+    size_t n_fns;
+    size_t capacity;
+} IrProgram;
+
+static inline IrInst* ir_inst(const IrFunction* fn, IrValue value) {
+    return &fn->insts[value];
+}
+
+static inline IrValue* ir_args(const IrFunction* fn, const IrInst* inst) {
+    return &fn->args[inst->first_arg];
+}
+
+static inline bool ir_is_terminator(IrOp op) {
+    return op == IR_JUMP || op == IR_BRANCH || op == IR_RET;
+}
+
+static inline IrInst* ir_terminator(const IrFunction* fn, IrBlockId block) {
+    const IrBlock* b = &fn->blocks[block];
+    if(!b->n_insts)
+        return NULL;
+    IrInst* last = ir_inst(fn, b->insts[b->n_insts - 1]);
+    return ir_is_terminator(last->op) ? last : NULL;
+}
+
+static inline uint32_t ir_n_succs(const IrInst* terminator) {
+    switch(terminator->op) {
+        case IR_JUMP: return 1;
+        case IR_BRANCH: return 2;
+        default: return 0;
+    }
+}
+
+IrFunction* ir_add_function(IrProgram* program, SymbolId symbol);
+IrBlockId ir_add_block(IrFunction* fn);
+void ir_add_pred(IrFunction* fn, IrBlockId block, IrBlockId pred);
+IrValue ir_new_inst(IrFunction* fn, IrOp op, ValueTag type, uint32_t n_args);
+void ir_set_n_args(IrFunction* fn, IrValue value, uint32_t n_args);
+void ir_insert(IrFunction* fn, IrBlockId block, uint32_t index, IrValue value);
+void ir_append(IrFunction* fn, IrBlockId block, IrValue value);
+IrBlockId ir_split_block(IrFunction* fn, IrBlockId block, uint32_t index);
+void ir_remove_pred(IrFunction* fn, IrBlockId block, uint32_t index);
+void ir_forward_values(IrFunction* fn, IrValue* forward);
+void ir_remove_trivial_phis(IrFunction* fn, IrValue* forward);
+uint32_t ir_pred_index(const IrFunction* fn, IrBlockId block, IrBlockId pred);
+ValueTag ir_return_type(const IrFunction* fn);
+void ir_sort_blocks(IrFunction* fn);
+IrBlockId ir_common_dominator(const IrBlockId* idoms, IrBlockId a, IrBlockId b);
+void ir_find_dominators(const IrFunction* fn, IrBlockId* idoms);
+void ir_merge_blocks(IrFunction* fn);
+void ir_function_free(IrFunction* fn);
+void ir_program_reset(IrProgram* program);
+void ir_program_free(IrProgram* program);
+
+void ir_print_function(const IrFunction* fn, FILE* out);
+void ir_print_program(const IrProgram* program, FILE* out);
+
+void ir_build_tree(IrProgram* program, const ExprTree* tree);
+void ir_build_free(void);
+
+bool ir_verify(const IrFunction* fn);
+bool ir_verify_program(const IrProgram* program);
+void ir_verify_free(void);
+
+void ir_fold_constants(IrProgram* program, bool whole_program);
+void ir_fold_free(void);
+
+#define IR_INLINE_THRESHOLD 16
+
+void ir_inline_calls(IrProgram* program, long threshold);
+void ir_inline_free(void);
+
+void ir_eliminate_tail_calls(IrProgram* program);
+void ir_tail_free(void);
+
+// What calling a function may do besides return its result
+typedef enum {
+    IR_PURE, // Neither loads nor stores globals
+    IR_READ_ONLY, // Loads globals but stores to none
+    IR_WRITING, // Stores to globals
+} IrPurity;
+
+// Globals a function may load or store to, unless it may touch `all` of them
+typedef struct {
+    SymbolId* symbols;
+    uint32_t n_symbols;
+    bool all;
+} IrGlobals;
+
+typedef struct {
+    IrPurity purity;
+    IrGlobals reads;
+    IrGlobals writes;
+    bool may_not_return; // Loops or recurses, and so may never return
+    bool may_trap; // Divides by what may be zero
+} IrSummary;
+
+void ir_summarize_functions(const IrProgram* program);
+const IrSummary* ir_summary(SymbolId symbol);
+void ir_remove_dead_calls(IrProgram* program);
+void ir_print_summaries(const IrProgram* program, FILE* out);
+void ir_summary_free(void);
+
+void ir_number_values(IrProgram* program);
+void ir_gvn_free(void);
+
+void ir_hoist_invariants(IrProgram* program);
+void ir_licm_free(void);
+
+#define IR_UNROLL_FACTOR 4
+
+bool ir_unroll_loops(IrProgram* program, long factor);
+void ir_unroll_free(void);
+
+#endif // IR_H
@@ -0,0 +1,611 @@
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "expr.h"
+#include "ir.h"
+#include "symbol.h"
+#include "token.h"
+#include "value.h"
+#include "walk.h"
+
+// Globals are read and written as SSA values within a function, using the
+// construction of Braun et al.: each block records the value of every global
+// it assigns, and a read searches backwards through predecessors, placing
+// phis where paths meet. Every assignment is also stored straight away, so
+// memory is always up to date for callees and once the function returns. A
+// call may assign any global, so the values a block recorded before it are
+// forgotten and later reads load the global again.
+
+#define PENDING (IR_NONE - 1)
+
+// Step at which a statement of a body is revisited to discard its value
+#define STEP_DISCARD UINT32_MAX
+
+typedef struct {
+    bool sealed; // All predecessors are known
+    uint32_t epoch; // Calls made in the block so far
+    uint32_t incomplete; // First phi placed before the block was sealed
+} BlockState;
+
+typedef struct {
+    IrValue phi;
+    SymbolId symbol;
+    uint32_t next;
+} IncompletePhi;
+
+// Value of `symbol` at the end of `block`, or at the current point of the
+// block being built. Slots from previous functions have an older generation.
+typedef struct {
+    uint32_t generation;
+    IrBlockId block;
+    SymbolId symbol;
+    uint32_t epoch;
+    IrValue value;
+} DefSlot;
+
+// Phi whose operands still have to be read from its predecessors
+typedef struct {
+    IrValue phi;
+    SymbolId symbol;
+} PhiTask;
+
+static IrFunction* fn = NULL;
+static IrBlockId current = IR_NONE;
+static IrValue* params = NULL;
+static size_t params_capacity = 0;
+
+static BlockState* states = NULL;
+static uint32_t states_capacity = 0;
+static IncompletePhi* incomplete = NULL;
+static uint32_t n_incomplete = 0;
+static uint32_t incomplete_capacity = 0;
+
+static DefSlot* defs = NULL;
+static uint32_t n_def_slots = 0;
+static uint32_t n_defs = 0;
+static uint32_t generation = 0;
+
+static PhiTask* tasks = NULL;
+static uint32_t n_tasks = 0;
+static uint32_t tasks_capacity = 0;
+static IrBlockId* chain = NULL;
+static uint32_t n_chain = 0;
+static uint32_t chain_capacity = 0;
+static IrValue* forward = NULL;
+static uint32_t forward_capacity = 0;
+
+static ExprWalk walk = { 0 };
+static IrValue* results = NULL;
+static size_t n_results = 0;
+static size_t results_capacity = 0;
+
+// Instruction computing each binary and compound assignment operator
+static const IrOp binary_ops[TOK_EOF + 1] = {
+    [TOK_PLUS] = IR_ADD,
+    [TOK_MINUS] = IR_SUB,
+    [TOK_STAR] = IR_MUL,
+    [TOK_SLASH] = IR_DIV,
+    [TOK_EQUAL_EQUAL] = IR_EQ,
+    [TOK_BANG_EQUAL] = IR_NE,
+    [TOK_LESS] = IR_LT,
+    [TOK_LESS_EQUAL] = IR_LE,
+    [TOK_GREATER] = IR_GT,
+    [TOK_GREATER_EQUAL] = IR_GE,
+    [TOK_PLUS_EQUAL] = IR_ADD,
+    [TOK_MINUS_EQUAL] = IR_SUB,
+    [TOK_STAR_EQUAL] = IR_MUL,
+    [TOK_SLASH_EQUAL] = IR_DIV,
+};
+
+static void push_result(IrValue value) {
+    if(n_results == results_capacity) {
+        results_capacity = results_capacity ? results_capacity * 2 : 64;
+        results = realloc(results, sizeof(IrValue) * results_capacity);
+    }
+    results[n_results++] = value;
+}
+
+static IrValue pop_result(void) {
+    return results[--n_results];
+}
+
+static IrBlockId new_block(void) {
+    const IrBlockId block = ir_add_block(fn);
+    if(block >= states_capacity) {
+        states_capacity = states_capacity ? states_capacity * 2 : 64;
+        states = realloc(states, sizeof(BlockState) * states_capacity);
+    }
+    states[block] = (BlockState) { .incomplete = IR_NONE };
+    return block;
+}
+
+static uint32_t def_hash(IrBlockId block, SymbolId symbol) {
+    return (block * 0x9e3779b1u) ^ (symbol * 0x85ebca77u);
+}
+
+static DefSlot* def_slot(IrBlockId block, SymbolId symbol) {
+    const uint32_t mask = n_def_slots - 1;
+    for(uint32_t i = def_hash(block, symbol) & mask;; i = (i + 1) & mask) {
+        DefSlot* slot = &defs[i];
+        if(slot->generation != generation || (slot->block == block && slot->symbol == symbol))
+            return slot;
+    }
+}
+
+static void def_write(IrBlockId block, SymbolId symbol, IrValue value) {
+    if((n_defs + 1) * 2 > n_def_slots) {
+        DefSlot* old = defs;
+        const uint32_t n_old = n_def_slots;
+        n_def_slots = n_def_slots ? n_def_slots * 2 : 1024;
+        defs = calloc(n_def_slots, sizeof(DefSlot));
+        for(uint32_t i = 0; i < n_old; ++i) {
+            if(old[i].generation == generation)
+                *def_slot(old[i].block, old[i].symbol) = old[i];
+        }
+        free(old);
+    }
+
+    DefSlot* slot = def_slot(block, symbol);
+    if(slot->generation != generation)
+        ++n_defs;
+    *slot = (DefSlot) {
+        .generation = generation,
+        .block = block,
+        .symbol = symbol,
+        .epoch = states[block].epoch,
+        .value = value,
+    };
+}
+
+static bool def_read(IrBlockId block, SymbolId symbol, IrValue* value) {
+    if(!n_def_slots)
+        return false;
+    const DefSlot* slot = def_slot(block, symbol);
+    if(slot->generation != generation || slot->epoch != states[block].epoch)
+        return false;
+    *value = slot->value;
+    return true;
+}
+
+// Adds `value` at the end of `block`, before its terminator if it has one
+static void append_before_terminator(IrBlockId block, IrValue value) {
+    const uint32_t n_insts = fn->blocks[block].n_insts;
+    ir_insert(fn, block, ir_terminator(fn, block) ? n_insts - 1 : n_insts, value);
+}
+
+static IrValue add_phi(IrBlockId block, SymbolId symbol, uint32_t n_args) {
+    const IrValue phi = ir_new_inst(fn, IR_PHI, symbol_at(symbol)->type, n_args);
+    const IrBlock* b = &fn->blocks[block];
+    uint32_t index = 0;
+    while(index < b->n_insts && ir_inst(fn, b->insts[index])->op == IR_PHI)
+        ++index;
+    ir_insert(fn, block, index, phi);
+    return phi;
+}
+
+static void push_task(IrValue phi, SymbolId symbol) {
+    if(n_tasks == tasks_capacity) {
+        tasks_capacity = tasks_capacity ? tasks_capacity * 2 : 64;
+        tasks = realloc(tasks, sizeof(PhiTask) * tasks_capacity);
+    }
+    tasks[n_tasks++] = (PhiTask) { .phi = phi, .symbol = symbol };
+}
+
+// Value of `symbol` at the end of `block`. Chains of blocks with a single
+// predecessor are followed without recursion, and a phi placed where paths
+// meet has its operands read later, from `tasks`.
+static IrValue lookup(IrBlockId block, SymbolId symbol) {
+    IrValue value;
+    n_chain = 0;
+
+    while(!def_read(block, symbol, &value)) {
+        const IrBlock* b = &fn->blocks[block];
+
+        // Memory holds the global on entry and after a call
+        if(block == IR_ENTRY || states[block].epoch || !b->n_preds) {
+            value = ir_new_inst(fn, IR_LOAD, symbol_at(symbol)->type, 0);
+            ir_inst(fn, value)->symbol = symbol;
+            append_before_terminator(block, value);
+            break;
+        }
+
+        if(!states[block].sealed) {
+            value = add_phi(block, symbol, 0);
+            if(n_incomplete == incomplete_capacity) {
+                incomplete_capacity = incomplete_capacity ? incomplete_capacity * 2 : 64;
+                incomplete = realloc(incomplete, sizeof(IncompletePhi) * incomplete_capacity);
+            }
+            incomplete[n_incomplete] = (IncompletePhi) { .phi = value, .symbol = symbol, .next = states[block].incomplete };
+            states[block].incomplete = n_incomplete++;
+            break;
+        }
+
+        if(b->n_preds > 1) {
+            value = add_phi(block, symbol, b->n_preds);
+            push_task(value, symbol);
+            break;
+        }
+
+        if(n_chain == chain_capacity) {
+            chain_capacity = chain_capacity ? chain_capacity * 2 : 64;
+            chain = realloc(chain, sizeof(IrBlockId) * chain_capacity);
+        }
+        chain[n_chain++] = block;
+        block = b->preds[0];
+    }
+
+    def_write(block, symbol, value);
+    for(uint32_t i = 0; i < n_chain; ++i)
+        def_write(chain[i], symbol, value);
+    return value;
+}
+
+static void fill_phis(void) {
+    while(n_tasks) {
+        const PhiTask task = tasks[--n_tasks];
+        const IrBlockId block = ir_inst(fn, task.phi)->block;
+        for(uint32_t i = 0; i < fn->blocks[block].n_preds; ++i) {
+            const IrValue value = lookup(fn->blocks[block].preds[i], task.symbol);
+            ir_args(fn, ir_inst(fn, task.phi))[i] = value;
+        }
+    }
+}
+
+static IrValue read_variable(SymbolId symbol) {
+    const IrValue value = lookup(current, symbol);
+    fill_phis();
+    return value;
+}
+
+static void seal(IrBlockId block) {
+    for(uint32_t i = states[block].incomplete; i != IR_NONE; i = incomplete[i].next) {
+        ir_set_n_args(fn, incomplete[i].phi, fn->blocks[block].n_preds);
+        push_task(incomplete[i].phi, incomplete[i].symbol);
+    }
+    states[block].sealed = true;
+    states[block].incomplete = IR_NONE;
+    fill_phis();
+}
+
+static IrValue emit(IrOp op, ValueTag type, const IrValue* args, uint32_t n_args) {
+    const IrValue value = ir_new_inst(fn, op, type, n_args);
+    if(n_args)
+        memcpy(ir_args(fn, ir_inst(fn, value)), args, sizeof(IrValue) * n_args);
+    ir_append(fn, current, value);
+    return value;
+}
+
+static void emit_store(SymbolId symbol, IrValue value) {
+    ir_inst(fn, emit(IR_STORE, VAL_NONE, &value, 1))->symbol = symbol;
+    def_write(current, symbol, value);
+}
+
+static void emit_jump(IrBlockId target) {
+    ir_inst(fn, emit(IR_JUMP, VAL_NONE, NULL, 0))->targets[0] = target;
+    ir_add_pred(fn, target, current);
+}
+
+static void emit_branch(IrValue condition, IrBlockId if_true, IrBlockId if_false) {
+    IrInst* inst = ir_inst(fn, emit(IR_BRANCH, VAL_NONE, &condition, 1));
+    inst->targets[0] = if_true;
+    inst->targets[1] = if_false;
+    ir_add_pred(fn, if_true, current);
+    ir_add_pred(fn, if_false, current);
+}
+
+// Resumes `expr` at `step` once `child` has been built
+static IrValue build_child(Expr* expr, uint32_t step, uint32_t data, Expr* child) {
+    walk_push(&walk, expr, step, data);
+    walk_push(&walk, child, 0, 0);
+    return PENDING;
+}
+
+static IrValue build_literal(Expr* expr) {
+    IrValue value;
+    switch(expr->literal.tag) {
+        case VAL_INT:
+            value = emit(IR_CONST, VAL_INT, NULL, 0);
+            ir_inst(fn, value)->imm = expr->literal.val_int;
+            return value;
+        case VAL_BOOL:
+            value = emit(IR_CONST, VAL_BOOL, NULL, 0);
+            ir_inst(fn, value)->imm = expr->literal.val_bool;
+            return value;
+        case VAL_STRING:
+            value = emit(IR_STRING, VAL_STRING, NULL, 0);
+            ir_inst(fn, value)->global_id = expr->literal.global_id;
+            return value;
+        // Identifiers have been resolved into variables
+        default:
+            return IR_NONE;
+    }
+}
+
+static IrValue build_assign(Expr* expr, uint32_t step) {
+    if(step == 0)
+        return build_child(expr, 1, 0, expr_child(expr, expr->assign.expr));
+
+    IrValue value = pop_result();
+    if(expr->op != TOK_EQUAL) {
+        // The right-hand side is evaluated before the variable is read
+        const IrValue args[2] = { read_variable(expr->assign.symbol), value };
+        value = emit(binary_ops[expr->op], symbol_at(expr->assign.symbol)->type, args, 2);
+    }
+    emit_store(expr->assign.symbol, value);
+    return IR_NONE;
+}
+
+// An if statement is given consecutive blocks for its body, its else body if
+// it has one, and the code following it. The first is carried in `data`.
+static IrValue build_if(Expr* expr, uint32_t step, IrBlockId then_block) {
+    const bool has_else = expr->if_stmt.else_body != 0;
+    const IrBlockId join = then_block + (has_else ? 2 : 1);
+
+    switch(step) {
+        case 0:
+            return build_child(expr, 1, 0, expr_child(expr, expr->if_stmt.condition));
+
+        case 1: {
+            const IrValue condition = pop_result();
+            then_block = new_block();
+            if(has_else)
+                new_block();
+            new_block();
+
+            emit_branch(condition, then_block, then_block + 1);
+            seal(then_block);
+            if(has_else)
+                seal(then_block + 1);
+
+            current = then_block;
+            walk_push(&walk, expr, 2, then_block);
+            walk_push_list(&walk, expr_child(expr, expr->if_stmt.if_body), STEP_DISCARD, 0);
+            return PENDING;
+        }
+
+        case 2:
+            if(current != IR_NONE)
+                emit_jump(join);
+            if(has_else) {
+                current = then_block + 1;
+                walk_push(&walk, expr, 3, then_block);
+                walk_push_list(&walk, expr_child(expr, expr->if_stmt.else_body), STEP_DISCARD, 0);
+                return PENDING;
+            }
+            break;
+
+        default:
+            if(current != IR_NONE)
+                emit_jump(join);
+            break;
+    }
+
+    // The code following is unreachable if both bodies return
+    seal(join);
+    current = fn->blocks[join].n_preds ? join : IR_NONE;
+    return IR_NONE;
+}
+
+// A loop is given consecutive blocks for its condition, its body and the
+// code following it. The first is carried in `data`.
+static IrValue build_while(Expr* expr, uint32_t step, IrBlockId header) {
+    switch(step) {
+        case 0:
+            header = new_block();
+            new_block();
+            new_block();
+
+            emit_jump(header);
+            current = header;
+            return build_child(expr, 1, header, expr_child(expr, expr->while_loop.condition));
+
+        case 1:
+            emit_branch(pop_result(), header + 1, header + 2);
+            seal(header + 1);
+            seal(header + 2);
+
+            current = header + 1;
+            walk_push(&walk, expr, 2, header);
+            walk_push_list(&walk, expr_child(expr, expr->while_loop.body), STEP_DISCARD, 0);
+            return PENDING;
+
+        default:
+            if(current != IR_NONE)
+                emit_jump(header);
+            seal(header);
+            current = header + 2;
+            return IR_NONE;
+    }
+}
+
+// Parameters are built in order, leaving their values on the results stack
+static IrValue build_fn_call(Expr* expr, uint32_t step) {
+    const Symbol* callee = symbol_at(expr->fn_call.symbol);
+    if(step == 0) {
+        walk_push(&walk, expr, 1, 0);
+        walk_push_list(&walk, expr_child(expr, expr->fn_call.params), 0, 0);
+        return PENDING;
+    }
+
+    n_results -= callee->n_params;
+    const IrValue value = emit(IR_CALL, callee->return_type, &results[n_results], callee->n_params);
+    ir_inst(fn, value)->symbol = expr->fn_call.symbol;
+
+    // The callee may have assigned any global
+    ++states[current].epoch;
+    return value;
+}
+
+static IrValue build_return(Expr* expr, uint32_t step) {
+    if(step == 0 && expr->op_return.value_expr)
+        return build_child(expr, 1, 0, expr_child(expr, expr->op_return.value_expr));
+
+    // Top-level statements return nothing, but still evaluate the value
+    const IrValue value = step ? pop_result() : IR_NONE;
+    emit(IR_RET, VAL_NONE, &value, value != IR_NONE && fn->symbol != SYMBOL_NONE);
+    current = IR_NONE;
+    return IR_NONE;
+}
+
+static IrValue build_expr(const ExprFrame* frame) {
+    Expr* expr = frame->expr;
+    const uint32_t step = frame->step;
+
+    switch(expr->tag) {
+        case EXPR_LITERAL:
+            return build_literal(expr);
+
+        case EXPR_VARIABLE:
+            if(expr->variable.param != PARAM_NONE)
+                return params[expr->variable.param];
+            return read_variable(expr->variable.symbol);
+
+        case EXPR_UNARY: {
+            if(step == 0)
+                return build_child(expr, 1, 0, expr_child(expr, expr->unary.rhs));
+            const IrValue rhs = pop_result();
+            return emit(expr->op == TOK_NOT ? IR_NOT : IR_NEG, expr->type, &rhs, 1);
+        }
+
+        case EXPR_BINARY: {
+            if(step == 0) {
+                walk_push(&walk, expr, 1, 0);
+                walk_push(&walk, expr_child(expr, expr->binary.rhs), 0, 0);
+                walk_push(&walk, expr_child(expr, expr->binary.lhs), 0, 0);
+                return PENDING;
+            }
+            n_results -= 2;
+            return emit(binary_ops[expr->op], expr->type, &results[n_results], 2);
+        }
+
+        case EXPR_GROUPING:
+            if(step == 0)
+                return build_child(expr, 1, 0, expr_child(expr, expr->grouping.expr));
+            return pop_result();
+
+        case EXPR_IF:
+            return build_if(expr, step, frame->data);
+
+        case EXPR_VAR_DEF:
+            if(!expr->var_def.initial_value)
+                return IR_NONE;
+            if(step == 0)
+                return build_child(expr, 1, 0, expr_child(expr, expr->var_def.initial_value));
+            emit_store(expr->var_def.symbol, pop_result());
+            return IR_NONE;
+
+        case EXPR_ASSIGN:
+            return build_assign(expr, step);
+        case EXPR_WHILE:
+            return build_while(expr, step, frame->data);
+        case EXPR_FN_CALL:
+            return build_fn_call(expr, step);
+        case EXPR_RETURN:
+            return build_return(expr, step);
+
+        // Nested functions are built separately
+        case EXPR_FN_DEF:
+            return IR_NONE;
+    }
+    return IR_NONE;
+}
+
+// Builds the body of `fn_def`, or the top-level statement `expr` if it is
+// not a function, into a new function of `program`
+static void build_function(IrProgram* program, Expr* expr) {
+    const SymbolId symbol = expr->tag == EXPR_FN_DEF ? expr->fn_def.symbol : SYMBOL_NONE;
+    fn = ir_add_function(program, symbol);
+    ++generation;
+    n_defs = 0;
+    n_incomplete = 0;
+
+    current = new_block();
+    seal(current);
+
+    if(symbol != SYMBOL_NONE) {
+        const Symbol* fn_symbol = symbol_at(symbol);
+        if(fn_symbol->n_params > params_capacity) {
+            params_capacity = fn_symbol->n_params;
+            params = realloc(params, sizeof(IrValue) * params_capacity);
+        }
+        for(size_t i = 0; i < fn_symbol->n_params; ++i) {
+            params[i] = emit(IR_PARAM, fn_symbol->param_types[i], NULL, 0);
+            ir_inst(fn, params[i])->param = i;
+        }
+        walk_push_list(&walk, expr_child(expr, expr->fn_def.body), STEP_DISCARD, 0);
+    } else {
+        walk_push(&walk, expr, STEP_DISCARD, 0);
+        walk_push(&walk, expr, 0, 0);
+    }
+
+    ExprFrame frame;
+    while(walk_pop(&walk, &frame)) {
+        if(frame.step == STEP_DISCARD) {
+            --n_results;
+            continue;
+        }
+        // Statements following a return are never run
+        if(current == IR_NONE && frame.step == 0) {
+            push_result(IR_NONE);
+            continue;
+        }
+
+        const IrValue value = build_expr(&frame);
+        if(value != PENDING)
+            push_result(value);
+    }
+
+    if(current != IR_NONE)
+        emit(IR_RET, VAL_NONE, NULL, 0);
+
+    if(fn->n_insts > forward_capacity) {
+        forward_capacity = fn->n_insts;
+        forward = realloc(forward, sizeof(IrValue) * forward_capacity);
+    }
+    ir_remove_trivial_phis(fn, forward);
+    ir_sort_blocks(fn);
+    ir_merge_blocks(fn);
+
+    // Top-level declarations without initial values have nothing to run
+    if(symbol == SYMBOL_NONE && fn->n_blocks == 1 && fn->blocks[IR_ENTRY].n_insts == 1) {
+        ir_function_free(fn);
+        --program->n_fns;
+    }
+}
+
+// Adds a function to `program` for every function defined in `tree`, and one
+// for the tree itself if it is a top-level statement
+void ir_build_tree(IrProgram* program, const ExprTree* tree) {
+    for(uint32_t i = 0; i < tree->len; ++i) {
+        if(tree->nodes[i].tag == EXPR_FN_DEF)
+            build_function(program, &tree->nodes[i]);
+    }
+
+    Expr* root = expr_tree_root(tree);
+    if(root->tag != EXPR_FN_DEF)
+        build_function(program, root);
+}
+
+void ir_build_free(void) {
+    free(params);
+    free(states);
+    free(incomplete);
+    free(defs);
+    free(tasks);
+    free(chain);
+    free(forward);
+    free(results);
+    params = NULL;
+    states = NULL;
+    incomplete = NULL;
+    defs = NULL;
+    tasks = NULL;
+    chain = NULL;
+    forward = NULL;
+    results = NULL;
+    params_capacity = states_capacity = incomplete_capacity = 0;
+    n_def_slots = n_defs = tasks_capacity = chain_capacity = forward_capacity = 0;
+    n_results = results_capacity = 0;
+    walk_free(&walk);
+}
@@ -0,0 +1,481 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ir.h"
+#include "symbol.h"
+#include "value.h"
+
+// Constants are found by sparse conditional constant propagation (Wegman and
+// Zadeck). Every value starts out unknown and is only lowered, to a constant
+// and then to varying, so the analysis ends. Blocks are only evaluated once
+// an edge into them is known to be taken, which lets constants flow through
+// phis whose other operands come from branches never taken.
+typedef enum {
+    LATTICE_UNKNOWN,
+    LATTICE_CONSTANT,
+    LATTICE_VARYING,
+} Lattice;
+
+static IrFunction* fn = NULL;
+static Lattice* lattice = NULL;
+static int64_t* constants = NULL;
+static uint32_t* use_starts = NULL; // Users of each value are `users[use_starts[v]..use_starts[v + 1]]`
+static IrValue* users = NULL;
+static IrValue* values = NULL; // Worklist of values whose lattice has been lowered
+static IrValue* forward = NULL;
+static uint32_t values_capacity = 0;
+static uint32_t users_capacity = 0;
+static uint32_t n_values = 0;
+
+static uint32_t* edge_starts = NULL; // Whether the edge from each predecessor is taken is `taken[edge_starts[b] + i]`
+static bool* taken = NULL;
+static bool* reached = NULL;
+static IrBlockId* blocks = NULL; // Worklist of blocks reached by a newly taken edge
+static uint32_t blocks_capacity = 0;
+static uint32_t edges_capacity = 0;
+static uint32_t n_blocks = 0;
+
+// Globals every store gives the same constant, found over the whole program
+typedef struct {
+    uint32_t n_stores;
+    bool varying;
+    int64_t value;
+    size_t last_store; // Index of the last top-level function which stores it
+} GlobalFact;
+
+static GlobalFact* globals = NULL;
+static size_t globals_capacity = 0;
+
+// Blocks of the top-level function being scanned which run whenever it returns
+static IrBlockId* idoms = NULL;
+static bool* always_runs = NULL;
+static uint32_t dominators_capacity = 0;
+
+static void grow_arrays(void) {
+    if(fn->n_insts + 1 > values_capacity) {
+        values_capacity = fn->n_insts + 1;
+        lattice = realloc(lattice, sizeof(Lattice) * values_capacity);
+        constants = realloc(constants, sizeof(int64_t) * values_capacity);
+        use_starts = realloc(use_starts, sizeof(uint32_t) * values_capacity);
+        values = realloc(values, sizeof(IrValue) * values_capacity * 2);
+        forward = realloc(forward, sizeof(IrValue) * values_capacity);
+    }
+    if(fn->n_args > users_capacity) {
+        users_capacity = fn->n_args;
+        users = realloc(users, sizeof(IrValue) * users_capacity);
+    }
+
+    uint32_t n_edges = 0;
+    for(IrBlockId b = 0; b < fn->n_blocks; ++b)
+        n_edges += fn->blocks[b].n_preds;
+    if(fn->n_blocks + 1 > blocks_capacity) {
+        blocks_capacity = fn->n_blocks + 1;
+        edge_starts = realloc(edge_starts, sizeof(uint32_t) * blocks_capacity);
+        reached = realloc(reached, sizeof(bool) * blocks_capacity);
+    }
+    if(n_edges + 1 > edges_capacity) {
+        edges_capacity = n_edges + 1;
+        taken = realloc(taken, sizeof(bool) * edges_capacity);
+        blocks = realloc(blocks, sizeof(IrBlockId) * edges_capacity);
+    }
+}
+
+// Lists the users of every value, in the same way a graph is stored in
+// compressed sparse rows
+static void find_users(void) {
+    memset(use_starts, 0, sizeof(uint32_t) * (fn->n_insts + 1));
+    for(IrBlockId b = 0; b < fn->n_blocks; ++b) {
+        const IrBlock* block = &fn->blocks[b];
+        for(uint32_t i = 0; i < block->n_insts; ++i) {
+            const IrInst* inst = ir_inst(fn, block->insts[i]);
+            for(uint32_t j = 0; j < inst->n_args; ++j)
+                ++use_starts[ir_args(fn, inst)[j] + 1];
+        }
+    }
+    for(IrValue v = 0; v < fn->n_insts; ++v)
+        use_starts[v + 1] += use_starts[v];
+
+    for(IrBlockId b = 0; b < fn->n_blocks; ++b) {
+        const IrBlock* block = &fn->blocks[b];
+        for(uint32_t i = 0; i < block->n_insts; ++i) {
+            const IrInst* inst = ir_inst(fn, block->insts[i]);
+            for(uint32_t j = 0; j < inst->n_args; ++j)
+                users[use_starts[ir_args(fn, inst)[j]]++] = block->insts[i];
+        }
+    }
+
+    // Filling the rows moved each start to the start of the next row
+    for(IrValue v = fn->n_insts; v > 0; --v)
+        use_starts[v] = use_starts[v - 1];
+    use_starts[0] = 0;
+}
+
+// Arithmetic wraps around at 64 bits, as it does at run time. Division by
+// zero, and the one quotient which does not fit, trap at run time and so are
+// left to do so.
+static bool evaluate(IrOp op, int64_t lhs, int64_t rhs, int64_t* result) {
+    switch(op) {
+        case IR_NEG: *result = (int64_t)(0 - (uint64_t)lhs); return true;
+        case IR_NOT: *result = !lhs; return true;
+        case IR_ADD: *result = (int64_t)((uint64_t)lhs + (uint64_t)rhs); return true;
+        case IR_SUB: *result = (int64_t)((uint64_t)lhs - (uint64_t)rhs); return true;
+        case IR_MUL: *result = (int64_t)((uint64_t)lhs * (uint64_t)rhs); return true;
+        case IR_DIV:
+            if(rhs == 0 || (lhs == INT64_MIN && rhs == -1))
+                return false;
+            *result = lhs / rhs;
+            return true;
+        case IR_EQ: *result = lhs == rhs; return true;
+        case IR_NE: *result = lhs != rhs; return true;
+        case IR_LT: *result = lhs < rhs; return true;
+        case IR_LE: *result = lhs <= rhs; return true;
+        case IR_GT: *result = lhs > rhs; return true;
+        case IR_GE: *result = lhs >= rhs; return true;
+        default: return false;
+    }
+}
+
+static void lower(IrValue value, Lattice to, int64_t constant) {
+    if(lattice[value] == to)
+        return;
+    lattice[value] = to;
+    constants[value] = constant;
+    values[n_values++] = value;
+}
+
+static void take_edge(IrBlockId block, IrBlockId succ) {
+    const uint32_t edge = edge_starts[succ] + ir_pred_index(fn, succ, block);
+    if(!taken[edge]) {
+        taken[edge] = true;
+        blocks[n_blocks++] = succ;
+    }
+}
+
+static void visit_phi(IrValue value, const IrInst* inst) {
+    const IrValue* args = ir_args(fn, inst);
+    const uint32_t edges = edge_starts[inst->block];
+
+    Lattice result = LATTICE_UNKNOWN;
+    int64_t constant = 0;
+    for(uint32_t i = 0; i < inst->n_args && result != LATTICE_VARYING; ++i) {
+        if(!taken[edges + i] || lattice[args[i]] == LATTICE_UNKNOWN)
+            continue;
+
+        if(lattice[args[i]] == LATTICE_VARYING || (result == LATTICE_CONSTANT && constants[args[i]] != constant)) {
+            result = LATTICE_VARYING;
+        } else {
+            result = LATTICE_CONSTANT;
+            constant = constants[args[i]];
+        }
+    }
+    lower(value, result, constant);
+}
+
+static void visit(IrValue value) {
+    const IrInst* inst = ir_inst(fn, value);
+    const IrValue* args = ir_args(fn, inst);
+
+    switch(inst->op) {
+        case IR_CONST:
+            lower(value, LATTICE_CONSTANT, inst->imm);
+            break;
+
+        case IR_STRING:
+        case IR_PARAM:
+        case IR_LOAD:
+        case IR_CALL:
+            lower(value, LATTICE_VARYING, 0);
+            break;
+
+        case IR_STORE:
+        case IR_RET:
+            break;
+
+        case IR_PHI:
+            visit_phi(value, inst);
+            break;
+
+        case IR_JUMP:
+            take_edge(inst->block, inst->targets[0]);
+            break;
+
+        case IR_BRANCH:
+            if(lattice[args[0]] == LATTICE_CONSTANT) {
+                take_edge(inst->block, inst->targets[constants[args[0]] ? 0 : 1]);
+            } else if(lattice[args[0]] == LATTICE_VARYING) {
+                take_edge(inst->block, inst->targets[0]);
+                take_edge(inst->block, inst->targets[1]);
+            }
+            break;
+
+        default: {
+            Lattice result = LATTICE_CONSTANT;
+            for(uint32_t i = 0; i < inst->n_args; ++i) {
+                if(lattice[args[i]] == LATTICE_VARYING)
+                    result = LATTICE_VARYING;
+                else if(lattice[args[i]] == LATTICE_UNKNOWN && result == LATTICE_CONSTANT)
+                    result = LATTICE_UNKNOWN;
+            }
+
+            int64_t constant = 0;
+            if(result == LATTICE_CONSTANT) {
+                const int64_t rhs = inst->n_args > 1 ? constants[args[1]] : 0;
+                if(!evaluate(inst->op, constants[args[0]], rhs, &constant))
+                    result = LATTICE_VARYING;
+            }
+            if(result != LATTICE_UNKNOWN)
+                lower(value, result, constant);
+            break;
+        }
+    }
+}
+
+static void propagate(void) {
+    uint32_t n_edges = 0;
+    for(IrBlockId b = 0; b < fn->n_blocks; ++b) {
+        edge_starts[b] = n_edges;
+        n_edges += fn->blocks[b].n_preds;
+        reached[b] = false;
+    }
+    memset(taken, 0, sizeof(bool) * n_edges);
+    for(IrValue v = 0; v < fn->n_insts; ++v)
+        lattice[v] = LATTICE_UNKNOWN;
+
+    n_values = 0;
+    n_blocks = 0;
+    blocks[n_blocks++] = IR_ENTRY;
+
+    while(n_blocks || n_values) {
+        if(n_blocks) {
+            // A block is evaluated in full the first time it is reached, and
+            // only its phis need another look when another edge is taken
+            const IrBlockId b = blocks[--n_blocks];
+            const IrBlock* block = &fn->blocks[b];
+            const bool first = !reached[b];
+            reached[b] = true;
+
+            for(uint32_t i = 0; i < block->n_insts; ++i) {
+                const IrValue value = block->insts[i];
+                if(!first && ir_inst(fn, value)->op != IR_PHI)
+                    break;
+                visit(value);
+            }
+            continue;
+        }
+
+        const IrValue value = values[--n_values];
+        for(uint32_t i = use_starts[value]; i < use_starts[value + 1]; ++i) {
+            if(reached[ir_inst(fn, users[i])->block])
+                visit(users[i]);
+        }
+    }
+}
+
+// Values found to be constant become constants, and branches on them jumps.
+// Returns whether anything changed.
+static bool rewrite(void) {
+    bool changed = false;
+
+    for(IrBlockId b = 0; b < fn->n_blocks; ++b) {
+        IrBlock* block = &fn->blocks[b];
+        if(!reached[b])
+            continue;
+
+        uint32_t n_phis = 0;
+        for(uint32_t i = 0; i < block->n_insts; ++i) {
+            const IrValue value = block->insts[i];
+            IrInst* inst = ir_inst(fn, value);
+            if(inst->op == IR_CONST || lattice[value] != LATTICE_CONSTANT)
+                continue;
+
+            n_phis += inst->op == IR_PHI;
+            inst->op = IR_CONST;
+            inst->n_args = 0;
+            inst->imm = constants[value];
+            changed = true;
+        }
+
+        // Phis which became constants are moved after the remaining phis
+        if(n_phis) {
+            uint32_t n_kept = 0;
+            uint32_t n_moved = 0;
+            for(uint32_t i = 0; i < block->n_insts; ++i) {
+                const IrValue value = block->insts[i];
+                if(ir_inst(fn, value)->op == IR_PHI)
+                    block->insts[n_kept++] = value;
+                else
+                    forward[n_moved++] = value;
+            }
+            memcpy(&block->insts[n_kept], forward, sizeof(IrValue) * n_moved);
+        }
+
+        IrInst* terminator = ir_terminator(fn, b);
+        if(terminator->op != IR_BRANCH || lattice[ir_args(fn, terminator)[0]] != LATTICE_CONSTANT)
+            continue;
+
+        const bool condition = constants[ir_args(fn, terminator)[0]];
+        const IrBlockId dropped = terminator->targets[condition ? 1 : 0];
+        ir_remove_pred(fn, dropped, ir_pred_index(fn, dropped, b));
+        terminator->op = IR_JUMP;
+        terminator->n_args = 0;
+        terminator->targets[0] = terminator->targets[condition ? 0 : 1];
+        changed = true;
+    }
+
+    return changed;
+}
+
+static bool fold_function(IrFunction* function) {
+    fn = function;
+    grow_arrays();
+    find_users();
+    propagate();
+    if(!rewrite())
+        return false;
+
+    // Blocks no longer reached are removed, which can leave phis with a
+    // single operand and blocks with a single predecessor to join to it
+    ir_sort_blocks(fn);
+    ir_remove_trivial_phis(fn, forward);
+    ir_merge_blocks(fn);
+    return true;
+}
+
+// A block runs whenever `function` returns if it dominates every return
+static void find_always_run(const IrFunction* function) {
+    if(function->n_blocks > dominators_capacity) {
+        dominators_capacity = function->n_blocks;
+        idoms = realloc(idoms, sizeof(IrBlockId) * dominators_capacity);
+        always_runs = realloc(always_runs, sizeof(bool) * dominators_capacity);
+    }
+    ir_find_dominators(function, idoms);
+
+    IrBlockId returns = IR_NONE; // Closest block dominating every return
+    for(IrBlockId b = 0; b < function->n_blocks; ++b) {
+        always_runs[b] = false;
+        const IrInst* terminator = ir_terminator(function, b);
+        if(terminator && terminator->op == IR_RET)
+            returns = returns == IR_NONE ? b : ir_common_dominator(idoms, returns, b);
+    }
+    if(returns == IR_NONE)
+        return;
+
+    for(IrBlockId b = returns; b != IR_ENTRY; b = idoms[b])
+        always_runs[b] = true;
+    always_runs[IR_ENTRY] = true;
+}
+
+// Over the whole program, a global every store gives the same constant holds
+// it wherever it can be read after the first of those stores has run. Top-level
+// statements run in order before `main`, so that is anywhere after the last of
+// them to store it, if none of the statements up to there can call a function
+// which reads it early. A global only ever given zero holds it from the start.
+// A store which may not run leaves the global with either its stored value or
+// the zero it started with.
+static bool fold_globals(IrProgram* program) {
+    if(n_symbols > globals_capacity) {
+        globals_capacity = n_symbols;
+        globals = realloc(globals, sizeof(GlobalFact) * globals_capacity);
+    }
+    for(SymbolId s = 0; s < n_symbols; ++s)
+        globals[s] = (GlobalFact) { 0 };
+
+    size_t first_call = SIZE_MAX; // Index of the first top-level function with a call
+    for(size_t f = 0; f < program->n_fns; ++f) {
+        const IrFunction* function = &program->fns[f];
+        if(function->symbol == SYMBOL_NONE)
+            find_always_run(function);
+        for(IrBlockId b = 0; b < function->n_blocks; ++b) {
+            const IrBlock* block = &function->blocks[b];
+            for(uint32_t i = 0; i < block->n_insts; ++i) {
+                const IrInst* inst = ir_inst(function, block->insts[i]);
+                if(inst->op == IR_CALL && function->symbol == SYMBOL_NONE && first_call == SIZE_MAX)
+                    first_call = f;
+                if(inst->op != IR_STORE)
+                    continue;
+
+                GlobalFact* global = &globals[inst->symbol];
+                const IrInst* stored = ir_inst(function, ir_args(function, inst)[0]);
+                if(function->symbol != SYMBOL_NONE || stored->op != IR_CONST
+                    || (global->n_stores && global->value != stored->imm)
+                    || (!always_runs[b] && stored->imm != 0))
+                    global->varying = true;
+                global->value = stored->imm;
+                global->last_store = f;
+                ++global->n_stores;
+            }
+        }
+    }
+
+    bool changed = false;
+    for(size_t f = 0; f < program->n_fns; ++f) {
+        IrFunction* function = &program->fns[f];
+        bool folded = false;
+        for(IrBlockId b = 0; b < function->n_blocks; ++b) {
+            const IrBlock* block = &function->blocks[b];
+            for(uint32_t i = 0; i < block->n_insts; ++i) {
+                IrInst* inst = ir_inst(function, block->insts[i]);
+                if(inst->op != IR_LOAD)
+                    continue;
+
+                const GlobalFact* global = &globals[inst->symbol];
+                const bool holds = !global->n_stores
+                    || (!global->varying && global->value == 0)
+                    || (!global->varying && first_call > global->last_store
+                        && (function->symbol != SYMBOL_NONE || f > global->last_store));
+                if(!global->varying && holds) {
+                    inst->op = IR_CONST;
+                    inst->imm = global->n_stores ? global->value : 0;
+                    folded = true;
+                }
+            }
+        }
+
+        if(folded) {
+            fold_function(function);
+            changed = true;
+        }
+    }
+    return changed;
+}
+
+// Folds constant arithmetic, comparisons and branches in every function of
+// `program`. Globals are only folded when `program` is the whole program, as
+// otherwise a store elsewhere could give them another value.
+void ir_fold_constants(IrProgram* program, bool whole_program) {
+    for(size_t f = 0; f < program->n_fns; ++f)
+        fold_function(&program->fns[f]);
+
+    // Folding a global can make the values stored to others constant
+    while(whole_program && fold_globals(program));
+}
+
+void ir_fold_free(void) {
+    free(lattice);
+    free(constants);
+    free(use_starts);
+    free(users);
+    free(values);
+    free(forward);
+    free(edge_starts);
+    free(taken);
+    free(reached);
+    free(blocks);
+    free(globals);
+    free(idoms);
+    free(always_runs);
+    lattice = NULL;
+    constants = NULL;
+    use_starts = NULL;
+    users = values = forward = blocks = NULL;
+    edge_starts = NULL;
+    taken = reached = NULL;
+    globals = NULL;
+    idoms = NULL;
+    always_runs = NULL;
+    values_capacity = users_capacity = blocks_capacity = edges_capacity = 0;
+    globals_capacity = 0;
+    dominators_capacity = 0;
+}
@@ -0,0 +1,390 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ir.h"
+#include "symbol.h"
+#include "value.h"
+
+// Global value numbering over the dominator tree. Expressions seen in a block
+// stay available to the blocks it dominates, so an expression computed again
+// with the same operands is replaced by the earlier result. Loads are
+// numbered separately, by the value each global is known to hold in memory,
+// which stores update and calls forget, as far as the summary of the callee
+// tells what they store to.
+
+static IrValue* leaders = NULL; // Earliest value known to equal each value
+static IrValue* forward = NULL;
+static uint32_t values_capacity = 0;
+
+// Available expressions, chained in buckets by hash. Entries are removed in
+// the reverse of the order they were added, so each is the head of its chain
+// by then.
+typedef struct {
+    IrValue value;
+    uint32_t bucket;
+    uint32_t next;
+} Entry;
+
+static uint32_t* buckets = NULL;
+static uint32_t n_buckets = 0;
+static Entry* entries = NULL;
+static uint32_t n_entries = 0;
+static uint32_t entries_capacity = 0;
+
+// Value each global holds in memory, valid while its epoch is current. A call
+// starts a new epoch, forgetting every global at once.
+typedef struct {
+    SymbolId symbol;
+    IrValue value;
+    uint32_t epoch;
+} Undo;
+
+static IrValue* memory = NULL;
+static uint32_t* memory_epochs = NULL;
+static size_t symbols_capacity = 0;
+static Undo* undos = NULL; // Previous contents of `memory` to restore
+static uint32_t n_undos = 0;
+static uint32_t undos_capacity = 0;
+static uint32_t epoch = 0;
+static uint32_t n_epochs = 0;
+
+static IrBlockId* idoms = NULL;
+static uint32_t* first_child = NULL; // Children of block b are `children[first_child[b]..first_child[b + 1]]`
+static IrBlockId* children = NULL;
+static uint32_t blocks_capacity = 0;
+
+// State to restore on leaving a block of the dominator tree
+typedef struct {
+    IrBlockId block;
+    uint32_t next_child;
+    uint32_t n_entries;
+    uint32_t n_undos;
+    uint32_t epoch;
+} Frame;
+
+static Frame* frames = NULL;
+
+static void grow_arrays(const IrFunction* fn) {
+    if(fn->n_insts > values_capacity) {
+        values_capacity = fn->n_insts;
+        leaders = realloc(leaders, sizeof(IrValue) * values_capacity);
+        forward = realloc(forward, sizeof(IrValue) * values_capacity);
+    }
+    if(fn->n_blocks > blocks_capacity) {
+        blocks_capacity = fn->n_blocks;
+        idoms = realloc(idoms, sizeof(IrBlockId) * blocks_capacity);
+        first_child = realloc(first_child, sizeof(uint32_t) * (blocks_capacity + 1));
+        children = realloc(children, sizeof(IrBlockId) * blocks_capacity);
+        frames = realloc(frames, sizeof(Frame) * blocks_capacity);
+    }
+    if(n_symbols > symbols_capacity) {
+        memory = realloc(memory, sizeof(IrValue) * n_symbols);
+        memory_epochs = realloc(memory_epochs, sizeof(uint32_t) * n_symbols);
+        for(size_t i = symbols_capacity; i < n_symbols; ++i)
+            memory_epochs[i] = UINT32_MAX;
+        symbols_capacity = n_symbols;
+    }
+
+    // Twice as many buckets as there can be entries
+    uint32_t size = 16;
+    while(size < fn->n_insts * 2)
+        size *= 2;
+    if(size > n_buckets) {
+        n_buckets = size;
+        buckets = realloc(buckets, sizeof(uint32_t) * n_buckets);
+    }
+    memset(buckets, 0xff, sizeof(uint32_t) * n_buckets);
+}
+
+// Children of each block in the dominator tree are
+// `children[first_child[b]..first_child[b + 1]]`
+static void build_dominator_tree(const IrFunction* fn) {
+    ir_find_dominators(fn, idoms);
+
+    for(IrBlockId b = 0; b <= fn->n_blocks; ++b)
+        first_child[b] = 0;
+    for(IrBlockId b = 1; b < fn->n_blocks; ++b)
+        ++first_child[idoms[b] + 1];
+    for(IrBlockId b = 0; b < fn->n_blocks; ++b)
+        first_child[b + 1] += first_child[b];
+    // Frames count the children placed so far, until the tree is walked
+    for(IrBlockId b = 0; b < fn->n_blocks; ++b)
+        frames[b].next_child = 0;
+    for(IrBlockId b = 1; b < fn->n_blocks; ++b)
+        children[first_child[idoms[b]] + frames[idoms[b]].next_child++] = b;
+}
+
+static bool is_commutative(IrOp op) {
+    return op == IR_ADD || op == IR_MUL || op == IR_EQ || op == IR_NE;
+}
+
+static bool is_numbered(IrOp op) {
+    switch(op) {
+        case IR_CONST:
+        case IR_STRING:
+        case IR_NEG:
+        case IR_NOT:
+        case IR_ADD:
+        case IR_SUB:
+        case IR_MUL:
+        case IR_DIV:
+        case IR_EQ:
+        case IR_NE:
+        case IR_LT:
+        case IR_LE:
+        case IR_GT:
+        case IR_GE:
+        case IR_PHI:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// Leader of the `i`th operand, taking those of commutative operations in a
+// fixed order
+static IrValue operand(const IrFunction* fn, const IrInst* inst, uint32_t i) {
+    const IrValue* args = ir_args(fn, inst);
+    if(!is_commutative(inst->op))
+        return leaders[args[i]];
+
+    const IrValue a = leaders[args[0]];
+    const IrValue b = leaders[args[1]];
+    return (a < b) == (i == 0) ? a : b;
+}
+
+static uint32_t hash(const IrFunction* fn, const IrInst* inst) {
+    uint64_t h = (uint64_t)inst->op * 31 + inst->type;
+    if(inst->op == IR_CONST)
+        h = h * 31 + (uint64_t)inst->imm;
+    else if(inst->op == IR_STRING)
+        h = h * 31 + inst->global_id;
+    else if(inst->op == IR_PHI)
+        h = h * 31 + inst->block;
+    else if(inst->op == IR_CALL)
+        h = h * 31 + inst->symbol;
+    for(uint32_t i = 0; i < inst->n_args; ++i)
+        h = h * 31 + operand(fn, inst, i);
+    h ^= h >> 29;
+    h *= 0xbf58476d1ce4e5b9;
+    h ^= h >> 32;
+    return (uint32_t)h & (n_buckets - 1);
+}
+
+static bool same(const IrFunction* fn, const IrInst* a, const IrInst* b) {
+    if(a->op != b->op || a->type != b->type || a->n_args != b->n_args)
+        return false;
+    if(a->op == IR_CONST && a->imm != b->imm)
+        return false;
+    if(a->op == IR_STRING && a->global_id != b->global_id)
+        return false;
+    if(a->op == IR_PHI && a->block != b->block)
+        return false;
+    if(a->op == IR_CALL && a->symbol != b->symbol)
+        return false;
+    for(uint32_t i = 0; i < a->n_args; ++i) {
+        if(operand(fn, a, i) != operand(fn, b, i))
+            return false;
+    }
+    return true;
+}
+
+// Returns the available value equal to `value`, making `value` available if
+// there is none
+static IrValue find_or_add(const IrFunction* fn, IrValue value) {
+    const IrInst* inst = ir_inst(fn, value);
+    const uint32_t bucket = hash(fn, inst);
+    for(uint32_t e = buckets[bucket]; e != UINT32_MAX; e = entries[e].next) {
+        if(same(fn, ir_inst(fn, entries[e].value), inst))
+            return entries[e].value;
+    }
+
+    if(n_entries == entries_capacity) {
+        entries_capacity = entries_capacity ? entries_capacity * 2 : 256;
+        entries = realloc(entries, sizeof(Entry) * entries_capacity);
+    }
+    entries[n_entries] = (Entry) { .value = value, .bucket = bucket, .next = buckets[bucket] };
+    buckets[bucket] = n_entries++;
+    return value;
+}
+
+static void set_memory(SymbolId symbol, IrValue value) {
+    if(n_undos == undos_capacity) {
+        undos_capacity = undos_capacity ? undos_capacity * 2 : 256;
+        undos = realloc(undos, sizeof(Undo) * undos_capacity);
+    }
+    undos[n_undos++] = (Undo) { .symbol = symbol, .value = memory[symbol], .epoch = memory_epochs[symbol] };
+    memory[symbol] = value;
+    memory_epochs[symbol] = epoch;
+}
+
+static void forget_memory(void) {
+    epoch = ++n_epochs;
+}
+
+// Forgets the globals a call may store to, which are all of them if nothing
+// is known of the callee
+static void forget_written(const IrInst* call) {
+    const IrSummary* summary = ir_summary(call->symbol);
+    if(!summary || summary->writes.all) {
+        forget_memory();
+        return;
+    }
+    for(uint32_t i = 0; i < summary->writes.n_symbols; ++i)
+        set_memory(summary->writes.symbols[i], IR_NONE);
+}
+
+// A pure function returns the same result given the same arguments, so a
+// call to one repeats the value of an earlier call it is dominated by
+static bool is_pure_call(const IrInst* inst) {
+    if(inst->op != IR_CALL)
+        return false;
+    const IrSummary* summary = ir_summary(inst->symbol);
+    return summary && summary->purity == IR_PURE;
+}
+
+// Blocks are in reverse postorder, so an edge to a block no later than its
+// source is the back edge of a loop
+static bool is_header(const IrFunction* fn, IrBlockId h) {
+    for(uint32_t i = 0; i < fn->blocks[h].n_preds; ++i) {
+        if(fn->blocks[h].preds[i] >= h)
+            return true;
+    }
+    return false;
+}
+
+// Memory on entering `b` is as its immediate dominator left it, less what
+// the paths between the two may have stored to. Those paths only pass
+// through blocks placed between the two, unless they go around a loop whose
+// header is placed there, in which case everything is forgotten.
+static void enter_join(const IrFunction* fn, IrBlockId b) {
+    for(IrBlockId between = idoms[b] + 1; between <= b; ++between) {
+        if(is_header(fn, between)) {
+            forget_memory();
+            return;
+        }
+    }
+    for(IrBlockId between = idoms[b] + 1; between < b; ++between) {
+        const IrBlock* block = &fn->blocks[between];
+        for(uint32_t i = 0; i < block->n_insts; ++i) {
+            const IrInst* inst = ir_inst(fn, block->insts[i]);
+            if(inst->op == IR_STORE)
+                set_memory(inst->symbol, IR_NONE);
+            else if(inst->op == IR_CALL)
+                forget_written(inst);
+        }
+    }
+}
+
+static void number_block(const IrFunction* fn, IrBlockId b) {
+    if(b != IR_ENTRY && fn->blocks[b].n_preds > 1)
+        enter_join(fn, b);
+
+    const IrBlock* block = &fn->blocks[b];
+    for(uint32_t i = 0; i < block->n_insts; ++i) {
+        const IrValue value = block->insts[i];
+        const IrInst* inst = ir_inst(fn, value);
+
+        if(is_numbered(inst->op) || is_pure_call(inst)) {
+            const IrValue leader = find_or_add(fn, value);
+            leaders[value] = leader;
+            // Constants cost nothing to repeat, and are left where they are
+            if(inst->op != IR_CONST && inst->op != IR_STRING)
+                forward[value] = leader;
+        } else if(inst->op == IR_LOAD) {
+            const SymbolId symbol = inst->symbol;
+            if(memory_epochs[symbol] == epoch && memory[symbol] != IR_NONE) {
+                leaders[value] = leaders[memory[symbol]];
+                forward[value] = memory[symbol];
+            } else {
+                set_memory(symbol, value);
+            }
+        } else if(inst->op == IR_STORE) {
+            set_memory(inst->symbol, leaders[ir_args(fn, inst)[0]]);
+        } else if(inst->op == IR_CALL) {
+            forget_written(inst);
+        }
+    }
+}
+
+static void number_values(IrFunction* fn) {
+    grow_arrays(fn);
+    for(IrValue v = 0; v < fn->n_insts; ++v)
+        leaders[v] = forward[v] = v;
+    build_dominator_tree(fn);
+
+    n_entries = 0;
+    n_undos = 0;
+    forget_memory();
+
+    uint32_t depth = 0;
+    frames[depth++] = (Frame) { .block = IR_ENTRY, .n_entries = 0, .n_undos = 0, .epoch = epoch };
+    number_block(fn, IR_ENTRY);
+    while(depth) {
+        Frame* frame = &frames[depth - 1];
+        const IrBlockId b = frame->block;
+        if(first_child[b] + frame->next_child < first_child[b + 1]) {
+            const IrBlockId child = children[first_child[b] + frame->next_child++];
+            frames[depth++] = (Frame) { .block = child, .n_entries = n_entries, .n_undos = n_undos, .epoch = epoch };
+            number_block(fn, child);
+            continue;
+        }
+
+        // What the block made available goes out of scope with it
+        while(n_entries > frame->n_entries) {
+            const Entry* entry = &entries[--n_entries];
+            buckets[entry->bucket] = entry->next;
+        }
+        while(n_undos > frame->n_undos) {
+            const Undo* undo = &undos[--n_undos];
+            memory[undo->symbol] = undo->value;
+            memory_epochs[undo->symbol] = undo->epoch;
+        }
+        epoch = frame->epoch;
+        --depth;
+    }
+
+    bool replaced = false;
+    for(IrValue v = 0; v < fn->n_insts && !replaced; ++v)
+        replaced = forward[v] != v;
+    if(!replaced)
+        return;
+
+    ir_forward_values(fn, forward);
+    ir_remove_trivial_phis(fn, forward);
+}
+
+// Replaces computations, and loads of globals, which repeat a value already
+// available
+void ir_number_values(IrProgram* program) {
+    for(size_t f = 0; f < program->n_fns; ++f)
+        number_values(&program->fns[f]);
+}
+
+void ir_gvn_free(void) {
+    free(leaders);
+    free(forward);
+    free(buckets);
+    free(entries);
+    free(memory);
+    free(memory_epochs);
+    free(undos);
+    free(idoms);
+    free(first_child);
+    free(children);
+    free(frames);
+    leaders = forward = NULL;
+    buckets = NULL;
+    entries = NULL;
+    memory = NULL;
+    memory_epochs = NULL;
+    undos = NULL;
+    idoms = NULL;
+    first_child = NULL;
+    children = NULL;
+    frames = NULL;
+    values_capacity = n_buckets = entries_capacity = undos_capacity = blocks_capacity = 0;
+    symbols_capacity = 0;
+}
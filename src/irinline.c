@@ -0,0 +1,330 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ir.h"
+#include "symbol.h"
+#include "value.h"
+
+// Functions are visited callees first, so that what is inlined has already
+// had its own calls inlined. A call back into a function still being visited
+// is part of a recursive cycle and is left alone.
+enum {
+    UNVISITED,
+    VISITING,
+    VISITED,
+};
+
+// A caller stops taking in callees once it has grown this large
+#define CALLER_LIMIT 4096
+
+static size_t* fn_of_symbol = NULL; // Index in the program of each function symbol's body
+static size_t symbols_capacity = 0;
+static uint8_t* states = NULL;
+static size_t* stack = NULL;
+static size_t* callee_starts = NULL; // Callees of function f are `callees[callee_starts[f]..callee_starts[f + 1]]`
+static size_t* callees = NULL;
+static size_t fns_capacity = 0;
+static size_t callees_capacity = 0;
+static uint32_t* sizes = NULL;
+
+static IrValue* values = NULL; // Value in the caller of each value of the callee
+static IrBlockId* blocks = NULL; // Block in the caller of each block of the callee
+static uint32_t values_capacity = 0;
+static uint32_t blocks_capacity = 0;
+
+typedef struct {
+    IrValue call;
+    IrValue result;
+} Replacement;
+
+static Replacement* replacements = NULL;
+static uint32_t n_replacements = 0;
+static uint32_t replacements_capacity = 0;
+static IrValue* returns = NULL;
+static uint32_t returns_capacity = 0;
+static IrValue* forward = NULL;
+static uint32_t forward_capacity = 0;
+
+// Instructions which become code of their own. Constants are folded into
+// their uses, parameters and phis into moves the call makes anyway, and jumps
+// mostly into fallthrough.
+static uint32_t code_size(const IrFunction* fn) {
+    uint32_t size = 0;
+    for(IrBlockId b = 0; b < fn->n_blocks; ++b) {
+        const IrBlock* block = &fn->blocks[b];
+        for(uint32_t i = 0; i < block->n_insts; ++i) {
+            switch(ir_inst(fn, block->insts[i])->op) {
+                case IR_CONST:
+                case IR_STRING:
+                case IR_PARAM:
+                case IR_PHI:
+                case IR_JUMP:
+                case IR_RET:
+                    break;
+                default:
+                    ++size;
+                    break;
+            }
+        }
+    }
+    return size;
+}
+
+// Inlining saves moving the arguments, the call and the callee's prologue
+// and epilogue. Constant arguments are likely to fold away more of the body
+// once it is inlined.
+static bool worth_inlining(const IrFunction* caller, const IrInst* call, uint32_t callee_size, long threshold) {
+    long benefit = 2 + call->n_args;
+    for(uint32_t i = 0; i < call->n_args; ++i) {
+        if(ir_inst(caller, ir_args(caller, call)[i])->op == IR_CONST)
+            benefit += 2;
+    }
+    return (long)callee_size - benefit <= threshold;
+}
+
+// Replaces the `index`th instruction of `block`, a call, by the body of
+// `callee`. The code after the call is moved to a block of its own, which
+// the callee's returns jump to.
+static void inline_call(IrFunction* fn, IrBlockId block, uint32_t index, const IrFunction* callee) {
+    const IrValue call = fn->blocks[block].insts[index];
+    const IrBlockId after = ir_split_block(fn, block, index + 1);
+    fn->blocks[block].n_insts = index;
+    ir_inst(fn, call)->block = IR_NONE;
+
+    if(callee->n_insts > values_capacity) {
+        values_capacity = callee->n_insts;
+        values = realloc(values, sizeof(IrValue) * values_capacity);
+    }
+    if(callee->n_blocks > blocks_capacity) {
+        blocks_capacity = callee->n_blocks;
+        blocks = realloc(blocks, sizeof(IrBlockId) * blocks_capacity);
+    }
+
+    for(IrBlockId b = 0; b < callee->n_blocks; ++b)
+        blocks[b] = ir_add_block(fn);
+
+    // Values are created first and given their operands once every value
+    // exists, as phis can refer to values defined after them
+    uint32_t n_returns = 0;
+    for(IrBlockId b = 0; b < callee->n_blocks; ++b) {
+        const IrBlock* from = &callee->blocks[b];
+        for(uint32_t i = 0; i < from->n_preds; ++i)
+            ir_add_pred(fn, blocks[b], blocks[from->preds[i]]);
+
+        for(uint32_t i = 0; i < from->n_insts; ++i) {
+            const IrValue value = from->insts[i];
+            const IrInst* inst = ir_inst(callee, value);
+
+            if(inst->op == IR_PARAM) {
+                values[value] = ir_args(fn, ir_inst(fn, call))[inst->param];
+                continue;
+            }
+
+            if(inst->op == IR_RET) {
+                if(n_returns == returns_capacity) {
+                    returns_capacity = returns_capacity ? returns_capacity * 2 : 16;
+                    returns = realloc(returns, sizeof(IrValue) * returns_capacity);
+                }
+                returns[n_returns++] = inst->n_args ? ir_args(callee, inst)[0] : IR_NONE;
+
+                const IrValue jump = ir_new_inst(fn, IR_JUMP, VAL_NONE, 0);
+                ir_inst(fn, jump)->targets[0] = after;
+                ir_append(fn, blocks[b], jump);
+                ir_add_pred(fn, after, blocks[b]);
+                values[value] = jump;
+                continue;
+            }
+
+            const IrValue copy = ir_new_inst(fn, inst->op, inst->type, inst->n_args);
+            IrInst* copied = ir_inst(fn, copy);
+            copied->imm = inst->imm;
+            if(inst->op == IR_JUMP || inst->op == IR_BRANCH) {
+                for(uint32_t k = 0; k < ir_n_succs(inst); ++k)
+                    copied->targets[k] = blocks[inst->targets[k]];
+            }
+            ir_append(fn, blocks[b], copy);
+            values[value] = copy;
+        }
+    }
+
+    for(IrBlockId b = 0; b < callee->n_blocks; ++b) {
+        const IrBlock* from = &callee->blocks[b];
+        for(uint32_t i = 0; i < from->n_insts; ++i) {
+            const IrInst* inst = ir_inst(callee, from->insts[i]);
+            if(inst->op == IR_PARAM || inst->op == IR_RET)
+                continue;
+
+            const IrInst* copy = ir_inst(fn, values[from->insts[i]]);
+            for(uint32_t j = 0; j < inst->n_args; ++j)
+                ir_args(fn, copy)[j] = values[ir_args(callee, inst)[j]];
+        }
+    }
+
+    const IrValue jump = ir_new_inst(fn, IR_JUMP, VAL_NONE, 0);
+    ir_inst(fn, jump)->targets[0] = blocks[IR_ENTRY];
+    ir_append(fn, block, jump);
+    ir_add_pred(fn, blocks[IR_ENTRY], block);
+
+    // Uses of the call take the value returned, merged where there are
+    // several returns
+    if(ir_inst(fn, call)->type == VAL_NONE || !n_returns)
+        return;
+
+    IrValue result = values[returns[0]];
+    if(n_returns > 1) {
+        result = ir_new_inst(fn, IR_PHI, ir_inst(fn, call)->type, n_returns);
+        for(uint32_t i = 0; i < n_returns; ++i)
+            ir_args(fn, ir_inst(fn, result))[i] = values[returns[i]];
+        ir_insert(fn, after, 0, result);
+    }
+
+    if(n_replacements == replacements_capacity) {
+        replacements_capacity = replacements_capacity ? replacements_capacity * 2 : 16;
+        replacements = realloc(replacements, sizeof(Replacement) * replacements_capacity);
+    }
+    replacements[n_replacements++] = (Replacement) { .call = call, .result = result };
+}
+
+static void inline_calls(IrProgram* program, size_t f, long threshold) {
+    IrFunction* fn = &program->fns[f];
+    n_replacements = 0;
+
+    // Blocks split off by inlining are appended, and so are visited in turn
+    bool inlined = false;
+    for(IrBlockId b = 0; b < fn->n_blocks && fn->n_insts < CALLER_LIMIT; ++b) {
+        for(uint32_t i = 0; i < fn->blocks[b].n_insts; ++i) {
+            const IrInst* inst = ir_inst(fn, fn->blocks[b].insts[i]);
+            if(inst->op != IR_CALL)
+                continue;
+
+            const size_t c = fn_of_symbol[inst->symbol];
+            if(c == SIZE_MAX || states[c] != VISITED || !worth_inlining(fn, inst, sizes[c], threshold))
+                continue;
+
+            inline_call(fn, b, i, &program->fns[c]);
+            inlined = true;
+            break;
+        }
+    }
+    if(!inlined)
+        return;
+
+    if(fn->n_insts > forward_capacity) {
+        forward_capacity = fn->n_insts;
+        forward = realloc(forward, sizeof(IrValue) * forward_capacity);
+    }
+    ir_sort_blocks(fn);
+    for(IrValue v = 0; v < fn->n_insts; ++v)
+        forward[v] = v;
+    for(uint32_t i = 0; i < n_replacements; ++i)
+        forward[replacements[i].call] = replacements[i].result;
+    ir_forward_values(fn, forward);
+    ir_remove_trivial_phis(fn, forward);
+    ir_merge_blocks(fn);
+}
+
+static void find_callees(const IrProgram* program) {
+    size_t n_callees = 0;
+    for(size_t f = 0; f < program->n_fns; ++f) {
+        const IrFunction* fn = &program->fns[f];
+        callee_starts[f] = n_callees;
+        for(IrBlockId b = 0; b < fn->n_blocks; ++b) {
+            const IrBlock* block = &fn->blocks[b];
+            for(uint32_t i = 0; i < block->n_insts; ++i) {
+                const IrInst* inst = ir_inst(fn, block->insts[i]);
+                if(inst->op != IR_CALL || fn_of_symbol[inst->symbol] == SIZE_MAX)
+                    continue;
+
+                if(n_callees == callees_capacity) {
+                    callees_capacity = callees_capacity ? callees_capacity * 2 : 64;
+                    callees = realloc(callees, sizeof(size_t) * callees_capacity);
+                }
+                callees[n_callees++] = fn_of_symbol[inst->symbol];
+            }
+        }
+    }
+    callee_starts[program->n_fns] = n_callees;
+}
+
+// Inlines calls whose callee is small enough for the cost model, given by
+// `threshold`. Only functions whose body is part of `program` can be inlined.
+void ir_inline_calls(IrProgram* program, long threshold) {
+    if(n_symbols > symbols_capacity) {
+        symbols_capacity = n_symbols;
+        fn_of_symbol = realloc(fn_of_symbol, sizeof(size_t) * symbols_capacity);
+    }
+    if(program->n_fns + 1 > fns_capacity) {
+        fns_capacity = program->n_fns + 1;
+        states = realloc(states, sizeof(uint8_t) * fns_capacity);
+        stack = realloc(stack, sizeof(size_t) * fns_capacity * 2);
+        callee_starts = realloc(callee_starts, sizeof(size_t) * fns_capacity);
+        sizes = realloc(sizes, sizeof(uint32_t) * fns_capacity);
+    }
+
+    for(SymbolId s = 0; s < n_symbols; ++s)
+        fn_of_symbol[s] = SIZE_MAX;
+    for(size_t f = 0; f < program->n_fns; ++f) {
+        if(program->fns[f].symbol != SYMBOL_NONE)
+            fn_of_symbol[program->fns[f].symbol] = f;
+        states[f] = UNVISITED;
+    }
+    find_callees(program);
+
+    // Depth-first over the call graph, inlining into each function once all
+    // it calls have been finished
+    for(size_t root = 0; root < program->n_fns; ++root) {
+        if(states[root] != UNVISITED)
+            continue;
+
+        size_t depth = 0;
+        states[root] = VISITING;
+        stack[depth++] = root;
+        stack[depth++] = callee_starts[root];
+        while(depth) {
+            const size_t f = stack[depth - 2];
+            const size_t next = stack[depth - 1]++;
+
+            if(next == callee_starts[f + 1]) {
+                inline_calls(program, f, threshold);
+                sizes[f] = code_size(&program->fns[f]);
+                states[f] = VISITED;
+                depth -= 2;
+                continue;
+            }
+
+            const size_t callee = callees[next];
+            if(states[callee] == UNVISITED) {
+                states[callee] = VISITING;
+                stack[depth++] = callee;
+                stack[depth++] = callee_starts[callee];
+            }
+        }
+    }
+}
+
+void ir_inline_free(void) {
+    free(fn_of_symbol);
+    free(states);
+    free(stack);
+    free(callee_starts);
+    free(callees);
+    free(sizes);
+    free(values);
+    free(blocks);
+    free(replacements);
+    free(returns);
+    free(forward);
+    fn_of_symbol = NULL;
+    states = NULL;
+    stack = callee_starts = callees = NULL;
+    sizes = NULL;
+    values = forward = returns = NULL;
+    blocks = NULL;
+    replacements = NULL;
+    symbols_capacity = fns_capacity = callees_capacity = 0;
+    values_capacity = blocks_capacity = 0;
+    replacements_capacity = returns_capacity = forward_capacity = 0;
+    n_replacements = 0;
+}
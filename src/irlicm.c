@@ -0,0 +1,285 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ir.h"
+#include "symbol.h"
+#include "value.h"
+
+// Loops are numbered across the whole pass, so that marks left by earlier
+// loops need never be cleared
+static uint32_t n_loops = 0;
+static uint32_t* in_loop = NULL; // Number of the last loop each block was found in
+static IrBlockId* worklist = NULL;
+static uint32_t blocks_capacity = 0;
+static uint32_t* written = NULL; // Number of the last loop found to store to each global
+static size_t symbols_capacity = 0;
+
+static void grow_arrays(const IrFunction* fn) {
+    // Each block adds its predecessors to the worklist at most once, and has
+    // at most two successors
+    if(fn->n_blocks > blocks_capacity) {
+        blocks_capacity = fn->n_blocks;
+        in_loop = realloc(in_loop, sizeof(uint32_t) * blocks_capacity);
+        worklist = realloc(worklist, sizeof(IrBlockId) * blocks_capacity * 2);
+    }
+    for(IrBlockId b = 0; b < fn->n_blocks; ++b)
+        in_loop[b] = 0;
+
+    if(n_symbols > symbols_capacity) {
+        written = realloc(written, sizeof(uint32_t) * n_symbols);
+        for(size_t i = symbols_capacity; i < n_symbols; ++i)
+            written[i] = 0;
+        symbols_capacity = n_symbols;
+    }
+}
+
+// Blocks are in reverse postorder, so an edge to a block no later than its
+// source is the back edge of a loop
+static bool is_header(const IrFunction* fn, IrBlockId h) {
+    for(uint32_t i = 0; i < fn->blocks[h].n_preds; ++i) {
+        if(fn->blocks[h].preds[i] >= h)
+            return true;
+    }
+    return false;
+}
+
+// Gives the loop headed by `h` a block of its own to enter through, unless
+// it is only entered from a block which jumps straight to it. The header's
+// phis take whatever they took on entry from the new block, merged by phis
+// there if the loop was entered from more than one place.
+static void add_preheader(IrFunction* fn, IrBlockId h) {
+    uint32_t n_entries = 0;
+    IrBlockId entry = IR_NONE;
+    for(uint32_t i = 0; i < fn->blocks[h].n_preds; ++i) {
+        if(fn->blocks[h].preds[i] < h) {
+            entry = fn->blocks[h].preds[i];
+            ++n_entries;
+        }
+    }
+    if(!n_entries || (n_entries == 1 && ir_terminator(fn, entry)->op == IR_JUMP))
+        return;
+
+    const IrBlockId preheader = ir_add_block(fn);
+    for(uint32_t i = 0; i < fn->blocks[h].n_preds; ++i) {
+        const IrBlockId pred = fn->blocks[h].preds[i];
+        if(pred >= h)
+            continue;
+
+        IrInst* terminator = ir_terminator(fn, pred);
+        for(uint32_t j = 0; j < ir_n_succs(terminator); ++j) {
+            if(terminator->targets[j] == h)
+                terminator->targets[j] = preheader;
+        }
+        ir_add_pred(fn, preheader, pred);
+    }
+
+    for(uint32_t i = 0; i < fn->blocks[h].n_insts; ++i) {
+        const IrValue phi = fn->blocks[h].insts[i];
+        if(ir_inst(fn, phi)->op != IR_PHI)
+            break;
+
+        IrValue value = IR_NONE;
+        if(n_entries > 1) {
+            value = ir_new_inst(fn, IR_PHI, ir_inst(fn, phi)->type, n_entries);
+            ir_append(fn, preheader, value);
+        }
+
+        // Operands from outside the loop are taken out, and the preheader's
+        // put in front of those left
+        IrValue* args = ir_args(fn, ir_inst(fn, phi));
+        uint32_t n_args = 0;
+        uint32_t n_merged = 0;
+        for(uint32_t j = 0; j < fn->blocks[h].n_preds; ++j) {
+            if(fn->blocks[h].preds[j] >= h)
+                args[n_args++] = args[j];
+            else if(n_entries > 1)
+                ir_args(fn, ir_inst(fn, value))[n_merged++] = args[j];
+            else
+                value = args[j];
+        }
+        memmove(&args[1], &args[0], sizeof(IrValue) * n_args);
+        args[0] = value;
+        ir_inst(fn, phi)->n_args = n_args + 1;
+    }
+
+    IrBlock* header = &fn->blocks[h];
+    uint32_t n_preds = 0;
+    for(uint32_t i = 0; i < header->n_preds; ++i) {
+        if(header->preds[i] >= h)
+            header->preds[n_preds++] = header->preds[i];
+    }
+    memmove(&header->preds[1], &header->preds[0], sizeof(IrBlockId) * n_preds);
+    header->preds[0] = preheader;
+    header->n_preds = n_preds + 1;
+
+    const IrValue jump = ir_new_inst(fn, IR_JUMP, VAL_NONE, 0);
+    ir_inst(fn, jump)->targets[0] = h;
+    ir_append(fn, preheader, jump);
+}
+
+// Whether `inst` computes the same value wherever in the loop it is, given
+// operands which do, and can be computed ahead of the loop even if the loop
+// would never have reached it. Division may trap, so only divisions by
+// constants which cannot are moved. A global may be loaded early if nothing
+// in the loop stores to it. A call may be made early if its callee stores to
+// no global, loads none the loop stores to, and always returns without
+// trapping.
+static bool can_hoist(const IrFunction* fn, const IrInst* inst, uint32_t loop, bool writes_any, bool writes_all) {
+    switch(inst->op) {
+        case IR_CONST:
+        case IR_STRING:
+        case IR_NEG:
+        case IR_NOT:
+        case IR_ADD:
+        case IR_SUB:
+        case IR_MUL:
+        case IR_EQ:
+        case IR_NE:
+        case IR_LT:
+        case IR_LE:
+        case IR_GT:
+        case IR_GE:
+            return true;
+        case IR_DIV: {
+            const IrInst* divisor = ir_inst(fn, ir_args(fn, inst)[1]);
+            return divisor->op == IR_CONST && divisor->imm != 0 && divisor->imm != -1;
+        }
+        case IR_LOAD:
+            return !writes_all && written[inst->symbol] != loop;
+        case IR_CALL: {
+            const IrSummary* summary = ir_summary(inst->symbol);
+            if(!summary || summary->purity == IR_WRITING || summary->may_not_return || summary->may_trap)
+                return false;
+            if(summary->reads.all)
+                return !writes_any;
+            for(uint32_t i = 0; i < summary->reads.n_symbols; ++i) {
+                if(writes_all || written[summary->reads.symbols[i]] == loop)
+                    return false;
+            }
+            return true;
+        }
+        default:
+            return false;
+    }
+}
+
+// Moves what is invariant in the loop headed by `h` into its preheader.
+// Blocks are visited in reverse postorder, so the operands of an instruction
+// have been decided on before it is.
+static void hoist_loop(IrFunction* fn, IrBlockId h) {
+    const uint32_t loop = ++n_loops;
+    in_loop[h] = loop;
+    uint32_t n_work = 0;
+    for(uint32_t i = 0; i < fn->blocks[h].n_preds; ++i) {
+        if(fn->blocks[h].preds[i] >= h)
+            worklist[n_work++] = fn->blocks[h].preds[i];
+    }
+    while(n_work) {
+        const IrBlockId b = worklist[--n_work];
+        if(in_loop[b] == loop)
+            continue;
+        in_loop[b] = loop;
+        for(uint32_t i = 0; i < fn->blocks[b].n_preds; ++i)
+            worklist[n_work++] = fn->blocks[b].preds[i];
+    }
+
+    // What the loop writes to, including through the calls it makes
+    bool writes_any = false;
+    bool writes_all = false;
+    for(IrBlockId b = h; b < fn->n_blocks; ++b) {
+        if(in_loop[b] != loop)
+            continue;
+        for(uint32_t i = 0; i < fn->blocks[b].n_insts; ++i) {
+            const IrInst* inst = ir_inst(fn, fn->blocks[b].insts[i]);
+            if(inst->op == IR_STORE) {
+                written[inst->symbol] = loop;
+                writes_any = true;
+            } else if(inst->op == IR_CALL) {
+                const IrSummary* summary = ir_summary(inst->symbol);
+                if(!summary || summary->writes.all) {
+                    writes_all = true;
+                    continue;
+                }
+                for(uint32_t j = 0; j < summary->writes.n_symbols; ++j)
+                    written[summary->writes.symbols[j]] = loop;
+                writes_any = writes_any || summary->writes.n_symbols;
+            }
+        }
+    }
+    writes_any = writes_any || writes_all;
+
+    IrBlockId preheader = IR_NONE;
+    for(uint32_t i = 0; i < fn->blocks[h].n_preds; ++i) {
+        if(fn->blocks[h].preds[i] < h)
+            preheader = fn->blocks[h].preds[i];
+    }
+    if(preheader == IR_NONE)
+        return;
+
+    for(IrBlockId b = h; b < fn->n_blocks; ++b) {
+        if(in_loop[b] != loop)
+            continue;
+
+        IrBlock* block = &fn->blocks[b];
+        uint32_t n_insts = 0;
+        for(uint32_t i = 0; i < block->n_insts; ++i) {
+            const IrValue value = block->insts[i];
+            IrInst* inst = ir_inst(fn, value);
+            bool invariant = can_hoist(fn, inst, loop, writes_any, writes_all);
+            for(uint32_t j = 0; j < inst->n_args && invariant; ++j)
+                invariant = in_loop[ir_inst(fn, ir_args(fn, inst)[j])->block] != loop;
+
+            if(!invariant) {
+                block->insts[n_insts++] = value;
+                continue;
+            }
+            ir_insert(fn, preheader, fn->blocks[preheader].n_insts - 1, value);
+            block = &fn->blocks[b];
+        }
+        block->n_insts = n_insts;
+    }
+}
+
+static void hoist_invariants(IrFunction* fn) {
+    bool has_loop = false;
+    const IrBlockId n_blocks = fn->n_blocks;
+    for(IrBlockId h = 0; h < n_blocks; ++h) {
+        if(is_header(fn, h)) {
+            add_preheader(fn, h);
+            has_loop = true;
+        }
+    }
+    if(!has_loop)
+        return;
+    if(fn->n_blocks != n_blocks)
+        ir_sort_blocks(fn);
+
+    grow_arrays(fn);
+
+    // Inner loops have later headers, and what leaves them may then leave the
+    // loops around them too
+    for(IrBlockId h = fn->n_blocks; h-- > 0;) {
+        if(is_header(fn, h))
+            hoist_loop(fn, h);
+    }
+}
+
+// Loop-invariant code motion: values which stay the same on every iteration
+// of a loop are computed once before it is entered
+void ir_hoist_invariants(IrProgram* program) {
+    for(size_t f = 0; f < program->n_fns; ++f)
+        hoist_invariants(&program->fns[f]);
+}
+
+void ir_licm_free(void) {
+    free(in_loop);
+    free(worklist);
+    free(written);
+    in_loop = NULL;
+    worklist = NULL;
+    written = NULL;
+    blocks_capacity = 0;
+    symbols_capacity = 0;
+}
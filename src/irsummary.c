@@ -0,0 +1,387 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "intern.h"
+#include "ir.h"
+#include "symbol.h"
+#include "value.h"
+
+// A function touching more globals than this is taken to touch them all
+#define GLOBALS_LIMIT 64
+
+// Summaries are kept by symbol, so those of functions from earlier trees are
+// still known when streaming
+static IrSummary* summaries = NULL;
+static bool* summarized = NULL;
+static size_t summaries_capacity = 0;
+
+// Functions are visited callees first, a strongly connected component of the
+// call graph at a time, by Tarjan's algorithm
+static size_t* fn_of_symbol = NULL; // Index in the program of each function symbol's body
+static size_t symbols_capacity = 0;
+static uint32_t* indices = NULL; // Order in which each function was reached, or UINT32_MAX
+static uint32_t* lowlinks = NULL;
+static uint32_t* components = NULL; // Number of the component each function was placed in
+static size_t* stack = NULL;
+static size_t* members = NULL; // Functions reached but not yet placed in a component
+static size_t* callee_starts = NULL; // Callees of function f are `callees[callee_starts[f]..callee_starts[f + 1]]`
+static size_t* callees = NULL;
+static size_t fns_capacity = 0;
+static size_t callees_capacity = 0;
+
+// Globals touched by the component being summarized. Components are numbered
+// across every call, so that marks left by earlier ones need never be cleared.
+static uint32_t n_components = 0;
+static uint32_t* read_marks = NULL;
+static uint32_t* write_marks = NULL;
+static SymbolId reads[GLOBALS_LIMIT];
+static SymbolId writes[GLOBALS_LIMIT];
+static uint32_t n_reads = 0;
+static uint32_t n_writes = 0;
+static bool reads_all = false;
+static bool writes_all = false;
+static size_t marks_capacity = 0;
+
+static uint32_t* uses = NULL;
+static uint32_t uses_capacity = 0;
+
+static void grow_arrays(const IrProgram* program) {
+    if(n_symbols > summaries_capacity) {
+        summaries = realloc(summaries, sizeof(IrSummary) * n_symbols);
+        summarized = realloc(summarized, sizeof(bool) * n_symbols);
+        for(size_t i = summaries_capacity; i < n_symbols; ++i) {
+            summaries[i] = (IrSummary) { 0 };
+            summarized[i] = false;
+        }
+        summaries_capacity = n_symbols;
+    }
+    if(n_symbols > symbols_capacity) {
+        symbols_capacity = n_symbols;
+        fn_of_symbol = realloc(fn_of_symbol, sizeof(size_t) * symbols_capacity);
+    }
+    if(n_symbols > marks_capacity) {
+        read_marks = realloc(read_marks, sizeof(uint32_t) * n_symbols);
+        write_marks = realloc(write_marks, sizeof(uint32_t) * n_symbols);
+        for(size_t i = marks_capacity; i < n_symbols; ++i)
+            read_marks[i] = write_marks[i] = 0;
+        marks_capacity = n_symbols;
+    }
+    if(program->n_fns + 1 > fns_capacity) {
+        fns_capacity = program->n_fns + 1;
+        indices = realloc(indices, sizeof(uint32_t) * fns_capacity);
+        lowlinks = realloc(lowlinks, sizeof(uint32_t) * fns_capacity);
+        components = realloc(components, sizeof(uint32_t) * fns_capacity);
+        stack = realloc(stack, sizeof(size_t) * fns_capacity * 2);
+        members = realloc(members, sizeof(size_t) * fns_capacity);
+        callee_starts = realloc(callee_starts, sizeof(size_t) * fns_capacity);
+    }
+}
+
+static void find_callees(const IrProgram* program) {
+    size_t n_callees = 0;
+    for(size_t f = 0; f < program->n_fns; ++f) {
+        const IrFunction* fn = &program->fns[f];
+        callee_starts[f] = n_callees;
+        for(IrBlockId b = 0; b < fn->n_blocks; ++b) {
+            const IrBlock* block = &fn->blocks[b];
+            for(uint32_t i = 0; i < block->n_insts; ++i) {
+                const IrInst* inst = ir_inst(fn, block->insts[i]);
+                if(inst->op != IR_CALL || fn_of_symbol[inst->symbol] == SIZE_MAX)
+                    continue;
+
+                if(n_callees == callees_capacity) {
+                    callees_capacity = callees_capacity ? callees_capacity * 2 : 64;
+                    callees = realloc(callees, sizeof(size_t) * callees_capacity);
+                }
+                callees[n_callees++] = fn_of_symbol[inst->symbol];
+            }
+        }
+    }
+    callee_starts[program->n_fns] = n_callees;
+}
+
+static void add_global(SymbolId symbol, uint32_t* marks, SymbolId* list, uint32_t* n_list, bool* all) {
+    if(*all || marks[symbol] == n_components)
+        return;
+    marks[symbol] = n_components;
+    if(*n_list == GLOBALS_LIMIT)
+        *all = true;
+    else
+        list[(*n_list)++] = symbol;
+}
+
+static void add_globals(const IrGlobals* globals, uint32_t* marks, SymbolId* list, uint32_t* n_list, bool* all) {
+    if(globals->all)
+        *all = true;
+    for(uint32_t i = 0; i < globals->n_symbols; ++i)
+        add_global(globals->symbols[i], marks, list, n_list, all);
+}
+
+static void set_globals(IrGlobals* globals, const SymbolId* list, uint32_t n_list, bool all) {
+    free(globals->symbols);
+    globals->all = all;
+    globals->n_symbols = all ? 0 : n_list;
+    globals->symbols = NULL;
+    if(globals->n_symbols) {
+        globals->symbols = malloc(sizeof(SymbolId) * globals->n_symbols);
+        memcpy(globals->symbols, list, sizeof(SymbolId) * globals->n_symbols);
+    }
+}
+
+// Functions of a component may call each other, so they share a summary:
+// what any of them does directly, and what the functions they call outside
+// the component do. A call to a function which has not been summarized may
+// do anything.
+static void summarize_component(const IrProgram* program, const size_t* component, size_t n_members) {
+    n_reads = n_writes = 0;
+    reads_all = writes_all = false;
+    bool may_not_return = n_members > 1;
+    bool may_trap = false;
+
+    for(size_t m = 0; m < n_members; ++m) {
+        const IrFunction* fn = &program->fns[component[m]];
+        for(IrBlockId b = 0; b < fn->n_blocks; ++b) {
+            const IrBlock* block = &fn->blocks[b];
+            // Blocks are in reverse postorder, so an edge back to a block no
+            // later than its source closes a loop
+            for(uint32_t i = 0; i < block->n_preds; ++i)
+                may_not_return = may_not_return || block->preds[i] >= b;
+
+            for(uint32_t i = 0; i < block->n_insts; ++i) {
+                const IrInst* inst = ir_inst(fn, block->insts[i]);
+                if(inst->op == IR_LOAD) {
+                    add_global(inst->symbol, read_marks, reads, &n_reads, &reads_all);
+                } else if(inst->op == IR_STORE) {
+                    add_global(inst->symbol, write_marks, writes, &n_writes, &writes_all);
+                } else if(inst->op == IR_DIV) {
+                    const IrInst* divisor = ir_inst(fn, ir_args(fn, inst)[1]);
+                    may_trap = may_trap || divisor->op != IR_CONST || divisor->imm == 0 || divisor->imm == -1;
+                } else if(inst->op == IR_CALL) {
+                    const size_t callee = fn_of_symbol[inst->symbol];
+                    const IrSummary* summary = ir_summary(inst->symbol);
+                    if(callee != SIZE_MAX && components[callee] == n_components) {
+                        may_not_return = true;
+                    } else if(!summary) {
+                        reads_all = writes_all = true;
+                        may_not_return = may_trap = true;
+                    } else {
+                        add_globals(&summary->reads, read_marks, reads, &n_reads, &reads_all);
+                        add_globals(&summary->writes, write_marks, writes, &n_writes, &writes_all);
+                        may_not_return = may_not_return || summary->may_not_return;
+                        may_trap = may_trap || summary->may_trap;
+                    }
+                }
+            }
+        }
+    }
+
+    IrPurity purity = IR_PURE;
+    if(writes_all || n_writes)
+        purity = IR_WRITING;
+    else if(reads_all || n_reads)
+        purity = IR_READ_ONLY;
+
+    for(size_t m = 0; m < n_members; ++m) {
+        const SymbolId symbol = program->fns[component[m]].symbol;
+        if(symbol == SYMBOL_NONE)
+            continue;
+
+        IrSummary* summary = &summaries[symbol];
+        summary->purity = purity;
+        set_globals(&summary->reads, reads, n_reads, reads_all);
+        set_globals(&summary->writes, writes, n_writes, writes_all);
+        summary->may_not_return = may_not_return;
+        summary->may_trap = may_trap;
+        summarized[symbol] = true;
+    }
+}
+
+// Works out which globals each function of `program` may load and store to,
+// including through the functions it calls, and whether it may fail to
+// return a result
+void ir_summarize_functions(const IrProgram* program) {
+    grow_arrays(program);
+    for(SymbolId s = 0; s < n_symbols; ++s)
+        fn_of_symbol[s] = SIZE_MAX;
+    for(size_t f = 0; f < program->n_fns; ++f) {
+        if(program->fns[f].symbol != SYMBOL_NONE)
+            fn_of_symbol[program->fns[f].symbol] = f;
+        indices[f] = UINT32_MAX;
+        components[f] = 0;
+    }
+    find_callees(program);
+
+    uint32_t n_indices = 0;
+    size_t n_members = 0;
+    for(size_t root = 0; root < program->n_fns; ++root) {
+        if(indices[root] != UINT32_MAX)
+            continue;
+
+        size_t depth = 0;
+        indices[root] = lowlinks[root] = n_indices++;
+        members[n_members++] = root;
+        stack[depth++] = root;
+        stack[depth++] = callee_starts[root];
+        while(depth) {
+            const size_t f = stack[depth - 2];
+            const size_t next = stack[depth - 1]++;
+
+            if(next < callee_starts[f + 1]) {
+                const size_t callee = callees[next];
+                if(indices[callee] == UINT32_MAX) {
+                    indices[callee] = lowlinks[callee] = n_indices++;
+                    members[n_members++] = callee;
+                    stack[depth++] = callee;
+                    stack[depth++] = callee_starts[callee];
+                } else if(!components[callee] && indices[callee] < lowlinks[f]) {
+                    lowlinks[f] = indices[callee];
+                }
+                continue;
+            }
+
+            depth -= 2;
+            if(depth && lowlinks[f] < lowlinks[stack[depth - 2]])
+                lowlinks[stack[depth - 2]] = lowlinks[f];
+            if(lowlinks[f] != indices[f])
+                continue;
+
+            // `f` and what was reached from it since are a component
+            size_t first = n_members;
+            ++n_components;
+            do {
+                components[members[--first]] = n_components;
+            } while(members[first] != f);
+            summarize_component(program, &members[first], n_members - first);
+            n_members = first;
+        }
+    }
+}
+
+// Summary of the function `symbol`, or NULL if its body has not been seen
+const IrSummary* ir_summary(SymbolId symbol) {
+    return symbol < summaries_capacity && summarized[symbol] ? &summaries[symbol] : NULL;
+}
+
+// A call is dead if nothing uses its result and the callee stores to no
+// global and always returns without trapping
+static bool is_dead_call(const IrFunction* fn, IrValue value) {
+    const IrInst* inst = ir_inst(fn, value);
+    if(inst->op != IR_CALL || uses[value])
+        return false;
+
+    const IrSummary* summary = ir_summary(inst->symbol);
+    return summary && summary->purity != IR_WRITING && !summary->may_not_return && !summary->may_trap;
+}
+
+static void remove_dead_calls(IrFunction* fn) {
+    if(fn->n_insts > uses_capacity) {
+        uses_capacity = fn->n_insts;
+        uses = realloc(uses, sizeof(uint32_t) * uses_capacity);
+    }
+    for(IrValue v = 0; v < fn->n_insts; ++v)
+        uses[v] = 0;
+    for(IrBlockId b = 0; b < fn->n_blocks; ++b) {
+        const IrBlock* block = &fn->blocks[b];
+        for(uint32_t i = 0; i < block->n_insts; ++i) {
+            const IrInst* inst = ir_inst(fn, block->insts[i]);
+            for(uint32_t j = 0; j < inst->n_args; ++j)
+                ++uses[ir_args(fn, inst)[j]];
+        }
+    }
+
+    // Uses are met before what they use, other than through phis, so calls
+    // only used by dead calls are found to be dead in the same pass
+    for(IrBlockId b = fn->n_blocks; b-- > 0;) {
+        IrBlock* block = &fn->blocks[b];
+        bool removed = false;
+        for(uint32_t i = block->n_insts; i-- > 0;) {
+            if(!is_dead_call(fn, block->insts[i]))
+                continue;
+
+            IrInst* inst = ir_inst(fn, block->insts[i]);
+            for(uint32_t j = 0; j < inst->n_args; ++j)
+                --uses[ir_args(fn, inst)[j]];
+            inst->block = IR_NONE;
+            removed = true;
+        }
+        if(!removed)
+            continue;
+
+        uint32_t n_insts = 0;
+        for(uint32_t i = 0; i < block->n_insts; ++i) {
+            if(ir_inst(fn, block->insts[i])->block != IR_NONE)
+                block->insts[n_insts++] = block->insts[i];
+        }
+        block->n_insts = n_insts;
+    }
+}
+
+// Removes calls which have no effect, given the summaries of their callees
+void ir_remove_dead_calls(IrProgram* program) {
+    for(size_t f = 0; f < program->n_fns; ++f)
+        remove_dead_calls(&program->fns[f]);
+}
+
+static void print_globals(const char* verb, const IrGlobals* globals, FILE* out) {
+    if(globals->all) {
+        fprintf(out, ", %s every global", verb);
+    } else if(globals->n_symbols) {
+        fprintf(out, ", %s {", verb);
+        for(uint32_t i = 0; i < globals->n_symbols; ++i)
+            fprintf(out, "%s%s", i ? ", " : "", intern_str(symbol_at(globals->symbols[i])->identifier));
+        fprintf(out, "}");
+    }
+}
+
+void ir_print_summaries(const IrProgram* program, FILE* out) {
+    static const char* purity_strs[] = {
+        [IR_PURE] = "pure",
+        [IR_READ_ONLY] = "read-only",
+        [IR_WRITING] = "writing",
+    };
+
+    for(size_t f = 0; f < program->n_fns; ++f) {
+        const SymbolId symbol = program->fns[f].symbol;
+        const IrSummary* summary = ir_summary(symbol);
+        if(!summary)
+            continue;
+
+        fprintf(out, "fn %s: %s", intern_str(symbol_at(symbol)->identifier), purity_strs[summary->purity]);
+        print_globals("reads", &summary->reads, out);
+        print_globals("writes", &summary->writes, out);
+        if(summary->may_not_return)
+            fprintf(out, ", may not return");
+        if(summary->may_trap)
+            fprintf(out, ", may trap");
+        fprintf(out, "\n");
+    }
+}
+
+void ir_summary_free(void) {
+    for(size_t i = 0; i < summaries_capacity; ++i) {
+        free(summaries[i].reads.symbols);
+        free(summaries[i].writes.symbols);
+    }
+    free(summaries);
+    free(summarized);
+    free(fn_of_symbol);
+    free(indices);
+    free(lowlinks);
+    free(components);
+    free(stack);
+    free(members);
+    free(callee_starts);
+    free(callees);
+    free(read_marks);
+    free(write_marks);
+    free(uses);
+    summaries = NULL;
+    summarized = NULL;
+    fn_of_symbol = stack = members = callee_starts = callees = NULL;
+    indices = lowlinks = components = read_marks = write_marks = uses = NULL;
+    summaries_capacity = symbols_capacity = fns_capacity = callees_capacity = marks_capacity = 0;
+    uses_capacity = 0;
+}
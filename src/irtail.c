@@ -0,0 +1,123 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "ir.h"
+#include "symbol.h"
+#include "value.h"
+
+static IrValue* phis = NULL; // Phi standing for each parameter, or IR_NONE if it is unused
+static size_t phis_capacity = 0;
+
+// A call is in tail position when the block returns straight after it,
+// giving back whatever the call returned
+static bool is_tail_call(const IrFunction* fn, IrBlockId b, IrValue* call) {
+    const IrBlock* block = &fn->blocks[b];
+    if(block->n_insts < 2)
+        return false;
+
+    const IrInst* ret = ir_inst(fn, block->insts[block->n_insts - 1]);
+    *call = block->insts[block->n_insts - 2];
+    const IrInst* inst = ir_inst(fn, *call);
+    return ret->op == IR_RET && inst->op == IR_CALL && inst->symbol == fn->symbol
+        && (!ret->n_args || ir_args(fn, ret)[0] == *call);
+}
+
+// Turns calls a function makes to itself in tail position into jumps back to
+// its start. The entry block is split after the parameters, and the rest of
+// the function reads each parameter through a phi of its value on entry and
+// the arguments of each such call.
+static void eliminate_self_calls(IrFunction* fn) {
+    bool found = false;
+    for(IrBlockId b = 0; b < fn->n_blocks && !found; ++b) {
+        IrValue call;
+        found = is_tail_call(fn, b, &call);
+    }
+    if(!found)
+        return;
+
+    const Symbol* symbol = symbol_at(fn->symbol);
+    if(symbol->n_params > phis_capacity) {
+        phis_capacity = symbol->n_params;
+        phis = realloc(phis, sizeof(IrValue) * phis_capacity);
+    }
+
+    // Parameters are defined first
+    uint32_t n_params = 0;
+    while(n_params < fn->blocks[IR_ENTRY].n_insts && ir_inst(fn, fn->blocks[IR_ENTRY].insts[n_params])->op == IR_PARAM)
+        ++n_params;
+
+    const IrBlockId header = ir_split_block(fn, IR_ENTRY, n_params);
+    const IrValue jump = ir_new_inst(fn, IR_JUMP, VAL_NONE, 0);
+    ir_inst(fn, jump)->targets[0] = header;
+    ir_append(fn, IR_ENTRY, jump);
+    ir_add_pred(fn, header, IR_ENTRY);
+
+    // Reads of the parameters now go through phis, which parameters nothing
+    // reads are not given
+    for(size_t i = 0; i < symbol->n_params; ++i)
+        phis[i] = IR_NONE;
+    for(IrBlockId b = 0; b < fn->n_blocks; ++b) {
+        for(uint32_t i = 0; i < fn->blocks[b].n_insts; ++i) {
+            const IrValue value = fn->blocks[b].insts[i];
+            for(uint32_t j = 0; j < ir_inst(fn, value)->n_args; ++j) {
+                const IrValue arg = ir_args(fn, ir_inst(fn, value))[j];
+                const IrInst* param = ir_inst(fn, arg);
+                if(param->op != IR_PARAM)
+                    continue;
+
+                const uint32_t index = param->param;
+                if(phis[index] == IR_NONE) {
+                    phis[index] = ir_new_inst(fn, IR_PHI, param->type, 1);
+                    ir_args(fn, ir_inst(fn, phis[index]))[0] = arg;
+                }
+                ir_args(fn, ir_inst(fn, value))[j] = phis[index];
+            }
+        }
+    }
+    for(size_t i = symbol->n_params; i-- > 0;) {
+        if(phis[i] != IR_NONE)
+            ir_insert(fn, header, 0, phis[i]);
+    }
+
+    for(IrBlockId b = 0; b < fn->n_blocks; ++b) {
+        IrValue call;
+        if(!is_tail_call(fn, b, &call))
+            continue;
+
+        IrBlock* block = &fn->blocks[b];
+        ir_inst(fn, block->insts[block->n_insts - 1])->block = IR_NONE;
+        ir_inst(fn, call)->block = IR_NONE;
+        block->n_insts -= 2;
+
+        ir_add_pred(fn, header, b);
+        for(size_t i = 0; i < symbol->n_params; ++i) {
+            if(phis[i] == IR_NONE)
+                continue;
+            const IrValue arg = ir_args(fn, ir_inst(fn, call))[i];
+            ir_set_n_args(fn, phis[i], fn->blocks[header].n_preds);
+            ir_args(fn, ir_inst(fn, phis[i]))[fn->blocks[header].n_preds - 1] = arg;
+        }
+
+        const IrValue loop = ir_new_inst(fn, IR_JUMP, VAL_NONE, 0);
+        ir_inst(fn, loop)->targets[0] = header;
+        ir_append(fn, b, loop);
+    }
+
+    ir_sort_blocks(fn);
+}
+
+// Self-recursive calls in tail position become loops, which run in constant
+// stack space. Codegen turns other calls in tail position into jumps.
+void ir_eliminate_tail_calls(IrProgram* program) {
+    for(size_t f = 0; f < program->n_fns; ++f) {
+        if(program->fns[f].symbol != SYMBOL_NONE)
+            eliminate_self_calls(&program->fns[f]);
+    }
+}
+
+void ir_tail_free(void) {
+    free(phis);
+    phis = NULL;
+    phis_capacity = 0;
+}
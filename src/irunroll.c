@@ -0,0 +1,492 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "ir.h"
+#include "value.h"
+
+// Loops known to run at most this many times are unrolled completely
+#define FULL_UNROLL_TRIPS 8
+// Neither kind of unrolling makes more code than this out of a loop's body
+#define UNROLLED_LIMIT 128
+
+// A counted loop: a header holding nothing but phis and a comparison of one
+// of them, stepped by one each iteration, against a bound fixed before the
+// loop. The loop is only left from its header.
+typedef struct {
+    IrBlockId header;
+    IrBlockId preheader;
+    IrBlockId latch;
+    IrBlockId body; // Entered from the header while the comparison holds
+    IrBlockId exit;
+    uint32_t entry_index; // Indices of the preheader and latch among the header's preds
+    uint32_t latch_index;
+    IrValue counter;
+    IrValue bound;
+    IrOp op; // Comparison of `counter` against `bound`
+    uint32_t n_phis;
+    uint32_t size;
+} Loop;
+
+// Loops are numbered across the whole pass, so that marks left by earlier
+// loops need never be cleared
+static uint32_t n_loops = 0;
+static uint32_t* in_loop = NULL; // Number of the last loop each block was found in
+static IrBlockId* worklist = NULL;
+static IrBlockId* members = NULL; // Blocks of the loop other than its header, in order
+static uint32_t n_members = 0;
+static IrBlockId* block_clones = NULL; // Block in the current copy of each block of the loop
+static uint32_t blocks_capacity = 0;
+static IrValue* clones = NULL; // Value in the current copy of each value of the loop
+static uint32_t values_capacity = 0;
+static IrValue* carried = NULL; // Value each header phi takes into the next iteration
+static uint32_t carried_capacity = 0;
+static IrValue* forward = NULL;
+static uint32_t forward_capacity = 0;
+
+static void grow_arrays(const IrFunction* fn) {
+    // Each block adds its predecessors to the worklist at most once, and has
+    // at most two successors
+    if(fn->n_blocks > blocks_capacity) {
+        in_loop = realloc(in_loop, sizeof(uint32_t) * fn->n_blocks);
+        for(IrBlockId b = blocks_capacity; b < fn->n_blocks; ++b)
+            in_loop[b] = 0;
+        worklist = realloc(worklist, sizeof(IrBlockId) * fn->n_blocks * 2);
+        members = realloc(members, sizeof(IrBlockId) * fn->n_blocks);
+        block_clones = realloc(block_clones, sizeof(IrBlockId) * fn->n_blocks);
+        blocks_capacity = fn->n_blocks;
+    }
+    if(fn->n_insts > values_capacity) {
+        values_capacity = fn->n_insts;
+        clones = realloc(clones, sizeof(IrValue) * values_capacity);
+    }
+}
+
+// Blocks are in reverse postorder, so an edge to a block no later than its
+// source is the back edge of a loop
+static bool is_header(const IrFunction* fn, IrBlockId h) {
+    for(uint32_t i = 0; i < fn->blocks[h].n_preds; ++i) {
+        if(fn->blocks[h].preds[i] >= h)
+            return true;
+    }
+    return false;
+}
+
+static bool is_constant(const IrFunction* fn, IrValue value) {
+    return ir_inst(fn, value)->op == IR_CONST;
+}
+
+// Comparison which holds of `b` and `a` when `op` holds of `a` and `b`
+static IrOp swap_compare(IrOp op) {
+    switch(op) {
+        case IR_LT: return IR_GT;
+        case IR_LE: return IR_GE;
+        case IR_GT: return IR_LT;
+        case IR_GE: return IR_LE;
+        default: return op;
+    }
+}
+
+// Fills in `loop` if the loop headed by `h` is an innermost counted loop.
+// Constants in the header are moved to the preheader on the way.
+static bool find_counted_loop(IrFunction* fn, IrBlockId h, Loop* loop) {
+    *loop = (Loop) { .header = h, .preheader = IR_NONE, .latch = IR_NONE };
+    const IrBlock* header = &fn->blocks[h];
+    for(uint32_t i = 0; i < header->n_preds; ++i) {
+        if(header->preds[i] >= h) {
+            if(loop->latch != IR_NONE)
+                return false;
+            loop->latch = header->preds[i];
+            loop->latch_index = i;
+        } else {
+            if(loop->preheader != IR_NONE)
+                return false;
+            loop->preheader = header->preds[i];
+            loop->entry_index = i;
+        }
+    }
+    if(loop->preheader == IR_NONE || loop->latch == IR_NONE || ir_terminator(fn, loop->preheader)->op != IR_JUMP)
+        return false;
+
+    const IrInst* branch = ir_terminator(fn, h);
+    if(!branch || branch->op != IR_BRANCH)
+        return false;
+
+    grow_arrays(fn);
+    const uint32_t number = ++n_loops;
+    in_loop[h] = number;
+    uint32_t n_work = 0;
+    worklist[n_work++] = loop->latch;
+    while(n_work) {
+        const IrBlockId b = worklist[--n_work];
+        if(in_loop[b] == number)
+            continue;
+        in_loop[b] = number;
+        for(uint32_t i = 0; i < fn->blocks[b].n_preds; ++i)
+            worklist[n_work++] = fn->blocks[b].preds[i];
+    }
+
+    loop->body = branch->targets[0];
+    loop->exit = branch->targets[1];
+    if(in_loop[loop->body] != number || in_loop[loop->exit] == number || fn->blocks[loop->body].n_preds != 1)
+        return false;
+
+    // The body is only left back to the header, has no loops of its own and
+    // only reads the header's phis
+    n_members = 0;
+    for(IrBlockId b = h + 1; b < fn->n_blocks; ++b) {
+        if(in_loop[b] != number)
+            continue;
+        if(is_header(fn, b))
+            return false;
+
+        const IrBlock* block = &fn->blocks[b];
+        for(uint32_t i = 0; i < block->n_insts; ++i) {
+            const IrInst* inst = ir_inst(fn, block->insts[i]);
+            for(uint32_t j = 0; j < inst->n_args; ++j) {
+                const IrInst* arg = ir_inst(fn, ir_args(fn, inst)[j]);
+                if(arg->block == h && arg->op != IR_PHI && arg->op != IR_CONST && arg->op != IR_STRING)
+                    return false;
+            }
+            if(ir_is_terminator(inst->op)) {
+                for(uint32_t j = 0; j < ir_n_succs(inst); ++j) {
+                    if(in_loop[inst->targets[j]] != number)
+                        return false;
+                }
+            }
+            switch(inst->op) {
+                case IR_CONST:
+                case IR_STRING:
+                case IR_PHI:
+                case IR_JUMP:
+                    break;
+                default:
+                    ++loop->size;
+                    break;
+            }
+        }
+        members[n_members++] = b;
+    }
+
+    // Constants are moved out of the header so that every copy can use them
+    IrBlock* block = &fn->blocks[h];
+    uint32_t n_insts = 0;
+    for(uint32_t i = 0; i < block->n_insts; ++i) {
+        const IrValue value = block->insts[i];
+        const IrOp op = ir_inst(fn, value)->op;
+        if(op == IR_CONST || op == IR_STRING) {
+            ir_insert(fn, loop->preheader, fn->blocks[loop->preheader].n_insts - 1, value);
+            block = &fn->blocks[h];
+        } else {
+            block->insts[n_insts++] = value;
+        }
+    }
+    block->n_insts = n_insts;
+
+    while(loop->n_phis < block->n_insts && ir_inst(fn, block->insts[loop->n_phis])->op == IR_PHI)
+        ++loop->n_phis;
+    if(block->n_insts != loop->n_phis + 2)
+        return false;
+
+    const IrValue compare = block->insts[loop->n_phis];
+    const IrInst* inst = ir_inst(fn, compare);
+    if(ir_args(fn, ir_terminator(fn, h))[0] != compare || inst->op < IR_LT || inst->op > IR_GE)
+        return false;
+
+    const IrValue* args = ir_args(fn, inst);
+    if(ir_inst(fn, args[0])->op == IR_PHI && ir_inst(fn, args[0])->block == h && in_loop[ir_inst(fn, args[1])->block] != number) {
+        loop->counter = args[0];
+        loop->bound = args[1];
+        loop->op = inst->op;
+    } else if(ir_inst(fn, args[1])->op == IR_PHI && ir_inst(fn, args[1])->block == h && in_loop[ir_inst(fn, args[0])->block] != number) {
+        loop->counter = args[1];
+        loop->bound = args[0];
+        loop->op = swap_compare(inst->op);
+    } else {
+        return false;
+    }
+
+    // Counting up towards an upper bound, or down towards a lower one
+    const IrInst* next = ir_inst(fn, ir_args(fn, ir_inst(fn, loop->counter))[loop->latch_index]);
+    if((next->op != IR_ADD && next->op != IR_SUB) || ir_args(fn, next)[0] != loop->counter)
+        return false;
+    const IrInst* step = ir_inst(fn, ir_args(fn, next)[1]);
+    if(step->op != IR_CONST)
+        return false;
+    const bool up = next->op == IR_ADD ? step->imm == 1 : step->imm == -1;
+    const bool down = next->op == IR_ADD ? step->imm == -1 : step->imm == 1;
+    return (up && (loop->op == IR_LT || loop->op == IR_LE)) || (down && (loop->op == IR_GT || loop->op == IR_GE));
+}
+
+// How many times the loop runs, if it starts and ends at constants. Zero
+// stands for not knowing.
+static uint64_t trip_count(const IrFunction* fn, const Loop* loop) {
+    const IrValue start = ir_args(fn, ir_inst(fn, loop->counter))[loop->entry_index];
+    if(!is_constant(fn, start) || !is_constant(fn, loop->bound))
+        return 0;
+
+    const int64_t from = ir_inst(fn, start)->imm;
+    const int64_t to = ir_inst(fn, loop->bound)->imm;
+    // The comparison always holds, the loop only ends once the counter wraps
+    if((loop->op == IR_LE && to == INT64_MAX) || (loop->op == IR_GE && to == INT64_MIN))
+        return 0;
+
+    switch(loop->op) {
+        case IR_LT: return from < to ? (uint64_t)to - (uint64_t)from : 0;
+        case IR_LE: return from <= to ? (uint64_t)to - (uint64_t)from + 1 : 0;
+        case IR_GT: return from > to ? (uint64_t)from - (uint64_t)to : 0;
+        default: return from >= to ? (uint64_t)from - (uint64_t)to + 1 : 0;
+    }
+}
+
+static IrValue resolve(const IrFunction* fn, IrValue value, uint32_t number) {
+    return in_loop[ir_inst(fn, value)->block] == number ? clones[value] : value;
+}
+
+// Copies the body of the loop once, with the header's phis standing for the
+// values given to them in `clones`. The copy is entered from nowhere yet and
+// still jumps back to the header, and `carried` is left holding what it
+// passes on to the next iteration.
+static void clone_iteration(IrFunction* fn, const Loop* loop, uint32_t number) {
+    for(uint32_t m = 0; m < n_members; ++m)
+        block_clones[members[m]] = ir_add_block(fn);
+
+    // Edges within the body all lead forwards, so operands are copied before
+    // they are used
+    for(uint32_t m = 0; m < n_members; ++m) {
+        const IrBlockId from = members[m];
+        const IrBlockId to = block_clones[from];
+        for(uint32_t i = 0; i < fn->blocks[from].n_preds; ++i) {
+            if(fn->blocks[from].preds[i] != loop->header)
+                ir_add_pred(fn, to, block_clones[fn->blocks[from].preds[i]]);
+        }
+
+        for(uint32_t i = 0; i < fn->blocks[from].n_insts; ++i) {
+            const IrValue value = fn->blocks[from].insts[i];
+            const IrInst inst = *ir_inst(fn, value); // Creating the copy may move it
+            const IrValue copy = ir_new_inst(fn, inst.op, inst.type, inst.n_args);
+            IrInst* copied = ir_inst(fn, copy);
+            copied->imm = inst.imm;
+            if(inst.op == IR_JUMP || inst.op == IR_BRANCH) {
+                for(uint32_t k = 0; k < ir_n_succs(&inst); ++k) {
+                    if(inst.targets[k] != loop->header)
+                        copied->targets[k] = block_clones[inst.targets[k]];
+                }
+            }
+            for(uint32_t j = 0; j < inst.n_args; ++j)
+                fn->args[copied->first_arg + j] = resolve(fn, fn->args[inst.first_arg + j], number);
+            ir_append(fn, to, copy);
+            clones[value] = copy;
+        }
+    }
+
+    for(uint32_t i = 0; i < loop->n_phis; ++i) {
+        const IrInst* phi = ir_inst(fn, fn->blocks[loop->header].insts[i]);
+        carried[i] = resolve(fn, ir_args(fn, phi)[loop->latch_index], number);
+    }
+}
+
+// Sends the edges from `from` to `target` to `to` instead
+static void redirect(IrFunction* fn, IrBlockId from, IrBlockId target, IrBlockId to) {
+    IrInst* terminator = ir_terminator(fn, from);
+    for(uint32_t k = 0; k < ir_n_succs(terminator); ++k) {
+        if(terminator->targets[k] == target)
+            terminator->targets[k] = to;
+    }
+    ir_add_pred(fn, to, from);
+}
+
+// Chains `n` copies of the body after `from`, in place of its edge to
+// `target`. The last copy is left jumping to the header, and is returned.
+static IrBlockId chain_iterations(IrFunction* fn, const Loop* loop, uint32_t number, IrBlockId from, IrBlockId target, uint64_t n) {
+    for(uint64_t k = 0; k < n; ++k) {
+        clone_iteration(fn, loop, number);
+        redirect(fn, from, target, block_clones[loop->body]);
+        from = block_clones[loop->latch];
+        target = loop->header;
+        for(uint32_t i = 0; i < loop->n_phis; ++i)
+            clones[fn->blocks[loop->header].insts[i]] = carried[i];
+    }
+    return from;
+}
+
+// Replaces the loop by `trips` copies of its body. The header is then only
+// reached once the comparison no longer holds, and so goes straight on.
+static void unroll_fully(IrFunction* fn, const Loop* loop, uint32_t number, uint64_t trips) {
+    const IrBlockId h = loop->header;
+    for(uint32_t i = 0; i < loop->n_phis; ++i) {
+        const IrValue phi = fn->blocks[h].insts[i];
+        clones[phi] = ir_args(fn, ir_inst(fn, phi))[loop->entry_index];
+    }
+
+    const IrBlockId last = chain_iterations(fn, loop, number, loop->preheader, h, trips);
+    fn->blocks[h].preds[loop->entry_index] = last;
+    for(uint32_t i = 0; i < loop->n_phis; ++i)
+        ir_args(fn, ir_inst(fn, fn->blocks[h].insts[i]))[loop->entry_index] = carried[i];
+
+    IrInst* branch = ir_terminator(fn, h);
+    branch->op = IR_JUMP;
+    branch->n_args = 0;
+    branch->targets[0] = loop->exit;
+    ir_remove_pred(fn, loop->body, 0);
+}
+
+// Runs the body `factor` times for each check of the bound, in a loop of its
+// own placed before the original. The original is left to run the remaining
+// iterations. Unless the bound is a constant, the preheader first checks
+// moving it by `factor - 1` does not wrap around, and otherwise skips
+// straight to the original loop.
+static void unroll_partially(IrFunction* fn, const Loop* loop, uint32_t number, uint32_t factor) {
+    const IrBlockId h = loop->header;
+    const IrBlockId p = loop->preheader;
+    const bool up = loop->op == IR_LT || loop->op == IR_LE;
+
+    const IrValue jump = fn->blocks[p].insts[fn->blocks[p].n_insts - 1];
+    IrValue limit;
+    if(is_constant(fn, loop->bound)) {
+        limit = ir_new_inst(fn, IR_CONST, VAL_INT, 0);
+        const int64_t bound = ir_inst(fn, loop->bound)->imm;
+        ir_inst(fn, limit)->imm = up ? bound - (factor - 1) : bound + (factor - 1);
+        ir_insert(fn, p, fn->blocks[p].n_insts - 1, limit);
+    } else {
+        const IrValue distance = ir_new_inst(fn, IR_CONST, VAL_INT, 0);
+        ir_inst(fn, distance)->imm = factor - 1;
+        limit = ir_new_inst(fn, up ? IR_SUB : IR_ADD, VAL_INT, 2);
+        ir_args(fn, ir_inst(fn, limit))[0] = loop->bound;
+        ir_args(fn, ir_inst(fn, limit))[1] = distance;
+        const IrValue fits = ir_new_inst(fn, up ? IR_LT : IR_GT, VAL_BOOL, 2);
+        ir_args(fn, ir_inst(fn, fits))[0] = limit;
+        ir_args(fn, ir_inst(fn, fits))[1] = loop->bound;
+        const IrValue branch = ir_new_inst(fn, IR_BRANCH, VAL_NONE, 1);
+        ir_args(fn, ir_inst(fn, branch))[0] = fits;
+        ir_inst(fn, branch)->targets[0] = h;
+        ir_inst(fn, branch)->targets[1] = h;
+
+        fn->blocks[p].n_insts -= 1;
+        ir_inst(fn, jump)->block = IR_NONE;
+        ir_append(fn, p, distance);
+        ir_append(fn, p, limit);
+        ir_append(fn, p, fits);
+        ir_append(fn, p, branch);
+    }
+
+    // The unrolled loop's phis start out as the original's would, and the
+    // original's start out where the unrolled loop left off
+    const IrBlockId unrolled = ir_add_block(fn);
+    IrValue counter = IR_NONE;
+    for(uint32_t i = 0; i < loop->n_phis; ++i) {
+        const IrValue phi = fn->blocks[h].insts[i];
+        const IrValue copy = ir_new_inst(fn, IR_PHI, ir_inst(fn, phi)->type, 2);
+        ir_args(fn, ir_inst(fn, copy))[0] = ir_args(fn, ir_inst(fn, phi))[loop->entry_index];
+        ir_append(fn, unrolled, copy);
+        clones[phi] = copy;
+        if(phi == loop->counter)
+            counter = copy;
+    }
+    ir_add_pred(fn, unrolled, p);
+
+    const IrValue compare = ir_new_inst(fn, loop->op, VAL_BOOL, 2);
+    ir_args(fn, ir_inst(fn, compare))[0] = counter;
+    ir_args(fn, ir_inst(fn, compare))[1] = limit;
+    const IrValue branch = ir_new_inst(fn, IR_BRANCH, VAL_NONE, 1);
+    ir_args(fn, ir_inst(fn, branch))[0] = compare;
+    ir_inst(fn, branch)->targets[0] = IR_NONE; // Set once the body is copied
+    ir_inst(fn, branch)->targets[1] = h;
+    ir_append(fn, unrolled, compare);
+    ir_append(fn, unrolled, branch);
+
+    // Entering the original loop from the unrolled one
+    const IrValue* phis = fn->blocks[h].insts;
+    if(is_constant(fn, loop->bound)) {
+        ir_inst(fn, jump)->targets[0] = unrolled;
+        fn->blocks[h].preds[loop->entry_index] = unrolled;
+        for(uint32_t i = 0; i < loop->n_phis; ++i)
+            ir_args(fn, ir_inst(fn, phis[i]))[loop->entry_index] = clones[phis[i]];
+    } else {
+        ir_terminator(fn, p)->targets[0] = unrolled;
+        ir_add_pred(fn, h, unrolled);
+        for(uint32_t i = 0; i < loop->n_phis; ++i) {
+            ir_set_n_args(fn, phis[i], fn->blocks[h].n_preds);
+            ir_args(fn, ir_inst(fn, phis[i]))[fn->blocks[h].n_preds - 1] = clones[phis[i]];
+        }
+    }
+
+    const IrBlockId last = chain_iterations(fn, loop, number, unrolled, IR_NONE, factor);
+    redirect(fn, last, h, unrolled);
+    const IrValue* copies = fn->blocks[unrolled].insts;
+    for(uint32_t i = 0; i < loop->n_phis; ++i)
+        ir_args(fn, ir_inst(fn, copies[i]))[1] = carried[i];
+}
+
+static bool unroll_loops(IrFunction* fn, long factor) {
+    bool unrolled = false;
+    const IrBlockId n_blocks = fn->n_blocks;
+    for(IrBlockId h = n_blocks; h-- > 0;) {
+        Loop loop;
+        if(!is_header(fn, h) || !find_counted_loop(fn, h, &loop))
+            continue;
+
+        if(loop.n_phis > carried_capacity) {
+            carried_capacity = loop.n_phis;
+            carried = realloc(carried, sizeof(IrValue) * carried_capacity);
+        }
+
+        const uint32_t number = n_loops;
+        const uint32_t size = loop.size ? loop.size : 1;
+        const uint64_t trips = trip_count(fn, &loop);
+        if(trips && trips <= FULL_UNROLL_TRIPS && trips * size <= UNROLLED_LIMIT) {
+            unroll_fully(fn, &loop, number, trips);
+            unrolled = true;
+            continue;
+        }
+
+        // A constant bound must stay clear of wrapping around when moved
+        const long copies = factor < UNROLLED_LIMIT / size ? factor : UNROLLED_LIMIT / size;
+        if(copies < 2 || (trips && trips < (uint64_t)copies))
+            continue;
+        if(is_constant(fn, loop.bound)) {
+            const int64_t bound = ir_inst(fn, loop.bound)->imm;
+            const bool up = loop.op == IR_LT || loop.op == IR_LE;
+            if(up ? bound < INT64_MIN + (copies - 1) : bound > INT64_MAX - (copies - 1))
+                continue;
+        }
+        unroll_partially(fn, &loop, number, (uint32_t)copies);
+        unrolled = true;
+    }
+    if(!unrolled)
+        return false;
+
+    if(fn->n_insts > forward_capacity) {
+        forward_capacity = fn->n_insts;
+        forward = realloc(forward, sizeof(IrValue) * forward_capacity);
+    }
+    ir_sort_blocks(fn);
+    ir_remove_trivial_phis(fn, forward);
+    ir_merge_blocks(fn);
+    return true;
+}
+
+// Unrolls innermost counted loops. Those known to run only a few times are
+// replaced by copies of their body, and others run `factor` copies of it for
+// each check of the bound. Returns whether any loop was unrolled.
+bool ir_unroll_loops(IrProgram* program, long factor) {
+    bool unrolled = false;
+    for(size_t f = 0; f < program->n_fns; ++f)
+        unrolled = unroll_loops(&program->fns[f], factor) || unrolled;
+    return unrolled;
+}
+
+void ir_unroll_free(void) {
+    free(in_loop);
+    free(worklist);
+    free(members);
+    free(block_clones);
+    free(clones);
+    free(carried);
+    free(forward);
+    in_loop = NULL;
+    worklist = members = block_clones = NULL;
+    clones = carried = forward = NULL;
+    blocks_capacity = values_capacity = carried_capacity = forward_capacity = 0;
+    n_members = 0;
+}
@@ -0,0 +1,395 @@
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "intern.h"
+#include "ir.h"
+#include "symbol.h"
+#include "value.h"
+
+// Checks that a function is well formed: blocks end in exactly one
+// terminator, predecessor lists match the edges, phis agree with them,
+// operands have the types their instructions expect, and every value is
+// defined before it is used on all paths.
+
+static const IrFunction* fn = NULL;
+static bool valid = true;
+
+// Dominator tree of the function, numbered in reverse postorder, and the
+// preorder interval of each block within it
+static uint32_t* rpo = NULL;
+static IrBlockId* idom = NULL;
+static uint32_t* pre = NULL;
+static uint32_t* post = NULL;
+static uint32_t* position = NULL; // Index of each instruction within its block
+static uint32_t blocks_capacity = 0;
+static uint32_t insts_capacity = 0;
+
+static void invalid(const char* fmt, ...) {
+    if(valid) {
+        fprintf(stderr, "error: invalid IR in function `%s`: ",
+            fn->symbol == SYMBOL_NONE ? "<top-level>" : intern_str(symbol_at(fn->symbol)->identifier)
+        );
+        va_list args;
+        va_start(args, fmt);
+        vfprintf(stderr, fmt, args);
+        va_end(args);
+        fprintf(stderr, "\n");
+    }
+    valid = false;
+}
+
+static bool has_edge(IrBlockId from, IrBlockId to) {
+    const IrInst* terminator = ir_terminator(fn, from);
+    if(!terminator)
+        return false;
+    for(uint32_t i = 0; i < ir_n_succs(terminator); ++i) {
+        if(terminator->targets[i] == to)
+            return true;
+    }
+    return false;
+}
+
+static bool check_blocks(void) {
+    for(IrBlockId b = 0; b < fn->n_blocks; ++b) {
+        const IrBlock* block = &fn->blocks[b];
+        if(!ir_terminator(fn, b)) {
+            invalid("block b%u does not end in a terminator", b);
+            return false;
+        }
+
+        bool phis = true;
+        for(uint32_t i = 0; i < block->n_insts; ++i) {
+            const IrValue value = block->insts[i];
+            const IrInst* inst = ir_inst(fn, value);
+            if(value >= fn->n_insts || inst->block != b) {
+                invalid("%%%u is listed in block b%u but does not belong to it", value, b);
+                return false;
+            }
+            position[value] = i;
+
+            if(inst->op == IR_PHI && !phis)
+                invalid("phi %%%u follows other instructions in b%u", value, b);
+            phis = phis && inst->op == IR_PHI;
+            if(ir_is_terminator(inst->op) && i + 1 != block->n_insts)
+                invalid("terminator %%%u is not last in b%u", value, b);
+        }
+
+        const IrInst* terminator = ir_terminator(fn, b);
+        for(uint32_t i = 0; i < ir_n_succs(terminator); ++i) {
+            const IrBlockId succ = terminator->targets[i];
+            if(succ >= fn->n_blocks) {
+                invalid("b%u branches to a block which does not exist", b);
+                return false;
+            }
+            if(ir_pred_index(fn, succ, b) == IR_NONE)
+                invalid("b%u is not listed as a predecessor of its successor b%u", b, succ);
+        }
+        if(terminator->op == IR_BRANCH && terminator->targets[0] == terminator->targets[1])
+            invalid("both edges of the branch ending b%u lead to b%u", b, terminator->targets[0]);
+
+        for(uint32_t i = 0; i < block->n_preds; ++i) {
+            if(block->preds[i] >= fn->n_blocks || !has_edge(block->preds[i], b)) {
+                invalid("b%u lists a predecessor which does not branch to it", b);
+                return false;
+            }
+            for(uint32_t j = 0; j < i; ++j) {
+                if(block->preds[i] == block->preds[j])
+                    invalid("b%u lists predecessor b%u twice", b, block->preds[i]);
+            }
+        }
+    }
+
+    if(fn->blocks[IR_ENTRY].n_preds)
+        invalid("the entry block has predecessors");
+    return valid;
+}
+
+static IrBlockId intersect(IrBlockId a, IrBlockId b) {
+    while(a != b) {
+        while(rpo[a] > rpo[b])
+            a = idom[a];
+        while(rpo[b] > rpo[a])
+            b = idom[b];
+    }
+    return a;
+}
+
+// Dominators by the iterative algorithm of Cooper, Harvey and Kennedy
+static bool build_dominators(void) {
+    IrBlockId* order = malloc(sizeof(IrBlockId) * fn->n_blocks);
+    uint32_t* stack = malloc(sizeof(uint32_t) * fn->n_blocks * 2);
+    for(IrBlockId b = 0; b < fn->n_blocks; ++b) {
+        rpo[b] = IR_NONE;
+        idom[b] = IR_NONE;
+    }
+
+    uint32_t n_order = 0;
+    uint32_t depth = 0;
+    rpo[IR_ENTRY] = 0;
+    stack[depth++] = IR_ENTRY;
+    stack[depth++] = 0;
+    while(depth) {
+        const IrBlockId block = stack[depth - 2];
+        const IrInst* terminator = ir_terminator(fn, block);
+        const uint32_t i = stack[depth - 1]++;
+        if(i == ir_n_succs(terminator)) {
+            order[n_order++] = block;
+            depth -= 2;
+        } else if(rpo[terminator->targets[i]] == IR_NONE) {
+            rpo[terminator->targets[i]] = 0;
+            stack[depth++] = terminator->targets[i];
+            stack[depth++] = 0;
+        }
+    }
+    free(stack);
+
+    if(n_order != fn->n_blocks) {
+        invalid("%u blocks are unreachable", fn->n_blocks - n_order);
+        free(order);
+        return false;
+    }
+
+    // `order` is a postorder, so reversing it gives the reverse postorder
+    for(uint32_t i = 0; i < n_order; ++i)
+        rpo[order[i]] = n_order - 1 - i;
+
+    idom[IR_ENTRY] = IR_ENTRY;
+    bool changed = true;
+    while(changed) {
+        changed = false;
+        for(uint32_t i = n_order - 1; i-- > 0;) {
+            const IrBlockId b = order[i];
+            const IrBlock* block = &fn->blocks[b];
+            IrBlockId new_idom = IR_NONE;
+            for(uint32_t j = 0; j < block->n_preds; ++j) {
+                const IrBlockId pred = block->preds[j];
+                if(idom[pred] == IR_NONE)
+                    continue;
+                new_idom = new_idom == IR_NONE ? pred : intersect(pred, new_idom);
+            }
+            if(idom[b] != new_idom) {
+                idom[b] = new_idom;
+                changed = true;
+            }
+        }
+    }
+
+    // Number the dominator tree depth-first, children being found by
+    // grouping blocks by their immediate dominator
+    uint32_t* first_child = calloc(fn->n_blocks + 1, sizeof(uint32_t));
+    IrBlockId* children = malloc(sizeof(IrBlockId) * fn->n_blocks);
+    for(IrBlockId b = 1; b < fn->n_blocks; ++b)
+        ++first_child[idom[b] + 1];
+    for(IrBlockId b = 0; b < fn->n_blocks; ++b)
+        first_child[b + 1] += first_child[b];
+    uint32_t* n_children = calloc(fn->n_blocks, sizeof(uint32_t));
+    for(IrBlockId b = 1; b < fn->n_blocks; ++b)
+        children[first_child[idom[b]] + n_children[idom[b]]++] = b;
+
+    uint32_t counter = 0;
+    depth = 0;
+    order[depth++] = IR_ENTRY;
+    for(IrBlockId b = 0; b < fn->n_blocks; ++b)
+        n_children[b] = 0;
+    pre[IR_ENTRY] = counter++;
+    while(depth) {
+        const IrBlockId b = order[depth - 1];
+        if(first_child[b] + n_children[b] == first_child[b + 1]) {
+            post[b] = counter++;
+            --depth;
+            continue;
+        }
+        const IrBlockId child = children[first_child[b] + n_children[b]++];
+        pre[child] = counter++;
+        order[depth++] = child;
+    }
+
+    free(first_child);
+    free(children);
+    free(n_children);
+    free(order);
+    return true;
+}
+
+static bool dominates(IrBlockId a, IrBlockId b) {
+    return pre[a] <= pre[b] && post[b] <= post[a];
+}
+
+static void check_operand(IrValue user, uint32_t i, IrValue arg, ValueTag type) {
+    const IrInst* inst = ir_inst(fn, user);
+    if(arg >= fn->n_insts || fn->insts[arg].block == IR_NONE || fn->insts[arg].type == VAL_NONE) {
+        invalid("operand %u of %%%u is not a value", i, user);
+        return;
+    }
+
+    const IrInst* def = ir_inst(fn, arg);
+    if(type != VAL_NONE && def->type != type)
+        invalid("operand %u of %%%u is %s rather than %s", i, user, type_strs[def->type], type_strs[type]);
+
+    // A phi uses its operands at the end of the corresponding predecessor
+    if(inst->op == IR_PHI) {
+        if(!dominates(def->block, fn->blocks[inst->block].preds[i]))
+            invalid("%%%u does not dominate its use in phi %%%u", arg, user);
+    } else if(def->block == inst->block ? position[arg] >= position[user] : !dominates(def->block, inst->block)) {
+        invalid("%%%u does not dominate its use in %%%u", arg, user);
+    }
+}
+
+static void check_inst(IrValue value) {
+    const IrInst* inst = ir_inst(fn, value);
+    const IrValue* args = ir_args(fn, inst);
+    uint32_t n_args = 0;
+    ValueTag operand_type = VAL_NONE;
+    ValueTag result_type = VAL_NONE;
+
+    switch(inst->op) {
+        case IR_CONST:
+            result_type = inst->type == VAL_BOOL ? VAL_BOOL : VAL_INT;
+            break;
+        case IR_STRING:
+            result_type = VAL_STRING;
+            break;
+        case IR_PARAM: {
+            const Symbol* symbol = fn->symbol == SYMBOL_NONE ? NULL : symbol_at(fn->symbol);
+            if(!symbol || inst->block != IR_ENTRY || inst->param >= symbol->n_params) {
+                invalid("%%%u is not a parameter of the function", value);
+                return;
+            }
+            result_type = symbol->param_types[inst->param];
+            break;
+        }
+        case IR_LOAD:
+        case IR_STORE: {
+            const Symbol* symbol = inst->symbol < n_symbols ? symbol_at(inst->symbol) : NULL;
+            if(!symbol || symbol->stype != SYM_VAR) {
+                invalid("%%%u does not refer to a global", value);
+                return;
+            }
+            if(inst->op == IR_LOAD) {
+                result_type = symbol->type;
+            } else {
+                n_args = 1;
+                operand_type = symbol->type;
+            }
+            break;
+        }
+        case IR_NEG:
+            n_args = 1;
+            operand_type = result_type = VAL_INT;
+            break;
+        case IR_NOT:
+            n_args = 1;
+            operand_type = result_type = VAL_BOOL;
+            break;
+        case IR_ADD:
+        case IR_SUB:
+        case IR_MUL:
+        case IR_DIV:
+            n_args = 2;
+            operand_type = result_type = VAL_INT;
+            break;
+        // Operands may be of any type, but must match
+        case IR_EQ:
+        case IR_NE:
+        case IR_LT:
+        case IR_LE:
+        case IR_GT:
+        case IR_GE:
+            n_args = 2;
+            operand_type = inst->n_args == 2 && args[0] < fn->n_insts ? ir_inst(fn, args[0])->type : VAL_NONE;
+            result_type = VAL_BOOL;
+            break;
+        case IR_CALL: {
+            const Symbol* symbol = inst->symbol < n_symbols ? symbol_at(inst->symbol) : NULL;
+            if(!symbol || symbol->stype != SYM_FN || inst->n_args != symbol->n_params) {
+                invalid("%%%u does not call a function with %u parameters", value, inst->n_args);
+                return;
+            }
+            for(uint32_t i = 0; i < inst->n_args; ++i)
+                check_operand(value, i, args[i], symbol->param_types[i]);
+            if(inst->type != symbol->return_type)
+                invalid("%%%u is %s but its callee returns %s", value, type_strs[inst->type], type_strs[symbol->return_type]);
+            return;
+        }
+        case IR_PHI:
+            if(inst->n_args != fn->blocks[inst->block].n_preds) {
+                invalid("phi %%%u has %u operands for %u predecessors", value, inst->n_args, fn->blocks[inst->block].n_preds);
+                return;
+            }
+            for(uint32_t i = 0; i < inst->n_args; ++i)
+                check_operand(value, i, args[i], inst->type);
+            return;
+        case IR_JUMP:
+            break;
+        case IR_BRANCH:
+            n_args = 1;
+            operand_type = VAL_BOOL;
+            break;
+        case IR_RET:
+            n_args = ir_return_type(fn) != VAL_NONE;
+            operand_type = ir_return_type(fn);
+            break;
+    }
+
+    if(inst->n_args != n_args) {
+        invalid("%%%u (%s) has %u operands rather than %u", value, ir_op_strs[inst->op], inst->n_args, n_args);
+        return;
+    }
+    if(inst->type != result_type) {
+        invalid("%%%u (%s) is %s rather than %s", value, ir_op_strs[inst->op], type_strs[inst->type], type_strs[result_type]);
+        return;
+    }
+    for(uint32_t i = 0; i < n_args; ++i)
+        check_operand(value, i, args[i], operand_type);
+}
+
+bool ir_verify(const IrFunction* function) {
+    fn = function;
+    valid = true;
+
+    if(!fn->n_blocks) {
+        invalid("the function has no blocks");
+        return false;
+    }
+
+    if(fn->n_blocks > blocks_capacity) {
+        blocks_capacity = fn->n_blocks;
+        rpo = realloc(rpo, sizeof(uint32_t) * blocks_capacity);
+        idom = realloc(idom, sizeof(IrBlockId) * blocks_capacity);
+        pre = realloc(pre, sizeof(uint32_t) * blocks_capacity);
+        post = realloc(post, sizeof(uint32_t) * blocks_capacity);
+    }
+    if(fn->n_insts > insts_capacity) {
+        insts_capacity = fn->n_insts;
+        position = realloc(position, sizeof(uint32_t) * insts_capacity);
+    }
+
+    if(!check_blocks() || !build_dominators())
+        return false;
+
+    for(IrBlockId b = 0; b < fn->n_blocks; ++b) {
+        const IrBlock* block = &fn->blocks[b];
+        for(uint32_t i = 0; i < block->n_insts; ++i)
+            check_inst(block->insts[i]);
+    }
+    return valid;
+}
+
+bool ir_verify_program(const IrProgram* program) {
+    bool result = true;
+    for(size_t i = 0; i < program->n_fns; ++i)
+        result = ir_verify(&program->fns[i]) && result;
+    return result;
+}
+
+void ir_verify_free(void) {
+    free(rpo);
+    free(idom);
+    free(pre);
+    free(post);
+    free(position);
+    rpo = idom = pre = post = position = NULL;
+    blocks_capacity = insts_capacity = 0;
+}
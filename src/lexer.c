@@ -1,181 +1,283 @@
-#include <ctype.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 #include "global.h"
+#include "intern.h"
 #include "lexer.h"
+#include "source.h"
 #include "token.h"
 
+// Character classes of the C locale. Unlike the <ctype.h> functions these do
+// not depend on the current locale and cost a single load.
+enum {
+    CC_SPACE = 1 << 0,
+    CC_DIGIT = 1 << 1,
+    CC_ALPHA = 1 << 2,
+    CC_IDENT = 1 << 3, // Any character which may continue an identifier
+};
+
+static const uint8_t char_class[256] = {
+    [' '] = CC_SPACE,
+    ['\t' ... '\r'] = CC_SPACE,
+    ['0' ... '9'] = CC_DIGIT | CC_IDENT,
+    ['a' ... 'z'] = CC_ALPHA | CC_IDENT,
+    ['A' ... 'Z'] = CC_ALPHA | CC_IDENT,
+    ['_'] = CC_IDENT,
+};
+
+#define is_class(c, class) (char_class[(unsigned char)(c)] & (class))
+
+// Vector kernels scan whole blocks of the source at once and fall back to the
+// scalar loops for the final partial block, which keeps every load within the
+// mapping. Bit `i` of a mask corresponds to byte `i` of the block.
+#if defined(__AVX2__)
+#define BLOCK_SIZE 32
+#define BLOCK_MASK 0xffffffffu
+typedef __m256i Block;
+
+static inline Block block_load(const char* p) {
+    return _mm256_loadu_si256((const __m256i*)p);
+}
+
+static inline uint32_t block_eq(Block b, char c) {
+    return (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(b, _mm256_set1_epi8(c)));
+}
+
+static inline uint32_t block_space(Block b) {
+    // '\t' through '\r' are contiguous, (c - '\t') <= 4 as an unsigned compare
+    const __m256i rel = _mm256_sub_epi8(b, _mm256_set1_epi8('\t'));
+    const __m256i ctrl = _mm256_cmpeq_epi8(_mm256_min_epu8(rel, _mm256_set1_epi8(4)), rel);
+    return block_eq(b, ' ') | (uint32_t)_mm256_movemask_epi8(ctrl);
+}
+#elif defined(__SSE2__)
+#define BLOCK_SIZE 16
+#define BLOCK_MASK 0xffffu
+typedef __m128i Block;
+
+static inline Block block_load(const char* p) {
+    return _mm_loadu_si128((const __m128i*)p);
+}
+
+static inline uint32_t block_eq(Block b, char c) {
+    return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(b, _mm_set1_epi8(c)));
+}
+
+static inline uint32_t block_space(Block b) {
+    // '\t' through '\r' are contiguous, (c - '\t') <= 4 as an unsigned compare
+    const __m128i rel = _mm_sub_epi8(b, _mm_set1_epi8('\t'));
+    const __m128i ctrl = _mm_cmpeq_epi8(_mm_min_epu8(rel, _mm_set1_epi8(4)), rel);
+    return block_eq(b, ' ') | (uint32_t)_mm_movemask_epi8(ctrl);
+}
+#endif
+
+// The source is a read-only mapping without a trailing NUL, so reads past the
+// end yield '\0' rather than touching memory outside of the mapping.
 static char peek(const Lexer* lex) {
+    if(lex->sp >= lex->source_len)
+        return '\0';
     return lex->source[lex->sp];
 }
 
+// Lines and columns are not tracked while lexing, tokens only record their
+// offset and positions are resolved when a diagnostic needs them
 static char advance(Lexer* lex) {
-    ++lex->column;
-    if(peek(lex) == '\n') {
-        lex->column = 0;
-        ++lex->line;
-    }
-    return lex->source[lex->sp++];
+    const char c = peek(lex);
+    if(lex->sp < lex->source_len)
+        ++lex->sp;
+    return c;
 }
 
 static bool reached_end(const Lexer* lex) {
-    return peek(lex) == '\0';
+    return lex->sp >= lex->source_len;
 }
 
 static void skip_whitespace(Lexer* lex) {
-    while(!reached_end(lex) && isspace(peek(lex)))
+#ifdef BLOCK_SIZE
+    while(lex->sp + BLOCK_SIZE <= lex->source_len) {
+        const uint32_t space = block_space(block_load(lex->source + lex->sp));
+        if(space != BLOCK_MASK) {
+            lex->sp += __builtin_ctz(~space);
+            return;
+        }
+        lex->sp += BLOCK_SIZE;
+    }
+#endif
+
+    while(!reached_end(lex) && is_class(peek(lex), CC_SPACE))
         advance(lex);
 }
 
-static void skip_line(Lexer* lex) {
-    while(!reached_end(lex) && peek(lex) != '\n')
+// Advances up to (but not past) the next occurrence of `terminator`, or to
+// the end of the source
+static void skip_until(Lexer* lex, char terminator) {
+#ifdef BLOCK_SIZE
+    while(lex->sp + BLOCK_SIZE <= lex->source_len) {
+        const uint32_t found = block_eq(block_load(lex->source + lex->sp), terminator);
+        if(found) {
+            lex->sp += __builtin_ctz(found);
+            return;
+        }
+        lex->sp += BLOCK_SIZE;
+    }
+#endif
+
+    while(!reached_end(lex) && peek(lex) != terminator)
         advance(lex);
 }
 
-const char* collect_lexemme(Lexer* lex) {
+static void skip_line(Lexer* lex) {
+    skip_until(lex, '\n');
+}
+
+// Advances past the current word and returns its length. The lexemme itself
+// is left in place and referenced by offset, nothing is copied.
+static size_t collect_lexemme(Lexer* lex) {
     const size_t start = lex->sp;
 
-    while(!reached_end(lex) && (isalnum(peek(lex)) || peek(lex) == '_'))
+    while(!reached_end(lex) && is_class(peek(lex), CC_IDENT))
         advance(lex);
 
-    const size_t end = lex->sp;
-
-    const size_t len = end - start;
-    char* lexemme = malloc(len + 1);
-    memcpy(lexemme, lex->source + start, len);
-    lexemme[len] = '\0';
-    return (const char*)lexemme;
+    return lex->sp - start;
 }
 
 bool collect_string(Lexer* lex, Token* result) {
-    size_t line = lex->line;
-    size_t column = lex->column;
+    const size_t offset = lex->sp;
 
     advance(lex); // Skip leading double-quote
     const size_t start = lex->sp;
 
     // TODO: Handle escape sequences ('\n', '\t', etc.)
-    while(!reached_end(lex) && peek(lex) != '"')
-        advance(lex);
+    skip_until(lex, '"');
 
     if(reached_end(lex)) {
-        fprintf(stderr, "%s:%lu:%lu: error: expected trailing double-quote, found eof instead\n",
-            lex->source_path, line + 1, column + 1
-        );
+        source_error(offset, "expected trailing double-quote, found eof instead\n");
         return false;
     }
 
     const size_t end = lex->sp;
     advance(lex); // Skip trailing double-quote
 
-    const size_t len = end - start;
-    char* string = malloc(len + 1);
-    memcpy(string, lex->source + start, len);
-    string[len] = '\0';
-
+    // The string body is referenced in place, the mapping outlives codegen
     Value value = (Value) {
         .tag = VAL_STRING,
-        .val_string = string,
+        .val_string = lex->source + start,
+        .val_string_len = end - start,
     };
     value.global_id = global_add(value);
 
     *result = (Token) {
         .type = TOK_STRING,
-        .value = value,
-        .source_path = lex->source_path,
-        .line = line,
-        .column = column,
+        .offset = offset,
+        .payload = value.global_id,
     };
     return true;
 }
 
 bool collect_number(Lexer* lex, Token* result) {
-    size_t line = lex->line;
-    size_t column = lex->column;
-
     // TODO: Validate lexemme before converting to integer
-    const char* lexemme = collect_lexemme(lex);
-    Value value = (Value) {
-        .tag = VAL_INT,
-        .val_int = atoi(lexemme),
-    };
-    free((void*)lexemme);
+    const size_t start = lex->sp;
+    const size_t len = collect_lexemme(lex);
+
+    // Same semantics as `atoi`: convert the leading run of digits
+    unsigned int val = 0;
+    for(size_t i = 0; i < len && is_class(lex->source[start + i], CC_DIGIT); ++i)
+        val = val * 10 + (lex->source[start + i] - '0');
+
     *result = (Token) {
         .type = TOK_INT,
-        .value = value,
-        .source_path = lex->source_path,
-        .line = line,
-        .column = column,
+        .offset = start,
+        .payload = val,
     };
     return true;
 }
 
+// Keywords are dispatched on length and first character, so an identifier is
+// rejected after at most one comparison against a candidate keyword
+static TokenType match_keyword(const char* lexemme, size_t len) {
+#define KEYWORD(keyword, type) \
+    do { \
+        if(memcmp(lexemme, keyword, len) == 0) \
+            return type; \
+    } while(0)
+
+    switch(len) {
+        case 2:
+            switch(lexemme[0]) {
+                case 'd': KEYWORD("do", TOK_DO); break;
+                case 'f': KEYWORD("fn", TOK_FN); break;
+                case 'i': KEYWORD("if", TOK_IF); break;
+            }
+            break;
+        case 3:
+            switch(lexemme[0]) {
+                case 'e': KEYWORD("end", TOK_END); break;
+                case 'i': KEYWORD("int", TOK_TYPE_INT); break;
+                case 'n': KEYWORD("not", TOK_NOT); break;
+                case 'v': KEYWORD("var", TOK_VAR); break;
+            }
+            break;
+        case 4:
+            switch(lexemme[0]) {
+                case 'b': KEYWORD("bool", TOK_TYPE_BOOL); break;
+                case 'e': KEYWORD("else", TOK_ELSE); break;
+                case 't':
+                    if(lexemme[1] == 'h')
+                        KEYWORD("then", TOK_THEN);
+                    else
+                        KEYWORD("true", TOK_BOOL);
+                    break;
+            }
+            break;
+        case 5:
+            switch(lexemme[0]) {
+                case 'f': KEYWORD("false", TOK_BOOL); break;
+                case 'w': KEYWORD("while", TOK_WHILE); break;
+            }
+            break;
+        case 6:
+            if(lexemme[0] == 'r')
+                KEYWORD("return", TOK_RETURN);
+            break;
+    }
+
+#undef KEYWORD
+    return TOK_IDENTIFIER;
+}
+
 bool collect_keyword(Lexer* lex, Token* result) {
-    size_t line = lex->line;
-    size_t column = lex->column;
+    *result = (Token) { .offset = lex->sp };
 
-    *result = (Token) {
-        .source_path = lex->source_path,
-        .line = lex->line,
-        .column = lex->column,
-    };
+    const size_t len = collect_lexemme(lex);
+    const char* lexemme = lex->source + result->offset;
 
-    const char* lexemme = collect_lexemme(lex);
-
-    if(strcmp(lexemme, "true") == 0) {
-        result->type = TOK_BOOL;
-        result->value = (Value) {
-            .tag = VAL_BOOL,
-            .val_bool = true,
-        };
-    } else if(strcmp(lexemme, "false") == 0) {
-        result->type = TOK_BOOL;
-        result->value = (Value) {
-            .tag = VAL_BOOL,
-            .val_bool = false,
-        };
-    } else if(strcmp(lexemme, "if") == 0) {
-        result->type = TOK_IF;
-    } else if(strcmp(lexemme, "else") == 0) {
-        result->type = TOK_ELSE;
-    } else if(strcmp(lexemme, "then") == 0) {
-        result->type = TOK_THEN;
-    } else if(strcmp(lexemme, "end") == 0) {
-        result->type = TOK_END;
-    } else if(strcmp(lexemme, "not") == 0) {
-        result->type = TOK_NOT;
-    } else if(strcmp(lexemme, "var") == 0) {
-        result->type = TOK_VAR;
-    } else if(strcmp(lexemme, "while") == 0) {
-        result->type = TOK_WHILE;
-    } else if(strcmp(lexemme, "do") == 0) {
-        result->type = TOK_DO;
-    } else if(strcmp(lexemme, "fn") == 0) {
-        result->type = TOK_FN;
-    } else if(strcmp(lexemme, "return") == 0) {
-        result->type = TOK_RETURN;
-    } else if(strcmp(lexemme, "int") == 0) {
-        result->type = TOK_TYPE_INT;
-    } else if(strcmp(lexemme, "bool") == 0) {
-        result->type = TOK_TYPE_BOOL;
-    } else {
-        result->type = TOK_IDENTIFIER;
-        result->value.tag = VAL_IDENTIFIER;
-        result->value.identifier = lexemme;
+    result->type = match_keyword(lexemme, len);
+
+    switch(result->type) {
+        case TOK_BOOL:
+            result->payload = lexemme[0] == 't';
+            break;
+        case TOK_IDENTIFIER:
+            result->payload = intern(lexemme, len);
+            break;
+
+        default:
+            break;
     }
 
     return true;
 }
 
 bool collect_symbol(Lexer* lex, Token* result) {
-    *result = (Token) {
-        .source_path = lex->source_path,
-        .line = lex->line,
-        .column = lex->column,
-    };
+    *result = (Token) { .offset = lex->sp };
 
     const char c = advance(lex);
 
@@ -196,7 +298,7 @@ bool collect_symbol(Lexer* lex, Token* result) {
             break;
         case '!':
             if(peek(lex) != '=') {
-                fprintf(stderr, "%s:%lu:%lu: error: expected '=', found '%c' instead\n", lex->source_path, lex->line + 1, lex->column + 1, c);
+                source_error(lex->sp, "expected '=', found '%c' instead\n", c);
                 return false;
             }
             advance(lex);
@@ -260,7 +362,7 @@ bool collect_symbol(Lexer* lex, Token* result) {
             result->type = TOK_EOF;
             break;
         default:
-            fprintf(stderr, "%s:%lu:%lu: error: unknown symbol '%c'\n", lex->source_path, lex->line + 1, lex->column + 1, c);
+            source_error(lex->sp, "unknown symbol '%c'\n", c);
             return false;
     }
 
@@ -271,18 +373,18 @@ bool lexer_collect_token(Lexer* lex, Token* result) {
     skip_whitespace(lex);
 
     // Comments
-    if(peek(lex) == '#') {
+    while(peek(lex) == '#') {
         advance(lex); // Skip leading '#'
         skip_line(lex);
-        return lexer_collect_token(lex, result);
+        skip_whitespace(lex);
     }
 
     const char c = peek(lex);
     if(c == '"') {
         return collect_string(lex, result);
-    } else if(isdigit(c)) {
+    } else if(is_class(c, CC_DIGIT)) {
         return collect_number(lex, result);
-    } else if(isalnum(c)) {
+    } else if(is_class(c, CC_ALPHA)) {
         return collect_keyword(lex, result);
     } else {
         return collect_symbol(lex, result);
@@ -8,10 +8,8 @@
 
 typedef struct {
     const char* source;
+    size_t source_len;
     size_t sp;
-
-    const char* source_path;
-    size_t line, column;
 } Lexer;
 
 bool lexer_collect_token(Lexer* lex, Token* result);
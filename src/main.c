@@ -4,11 +4,16 @@
 #include <string.h>
 
 #include "codegen.h"
+#include "dce.h"
 #include "expr.h"
 #include "global.h"
+#include "intern.h"
+#include "ir.h"
 #include "lexer.h"
 #include "parser.h"
+#include "resolve.h"
 #include "sema.h"
+#include "source.h"
 #include "symbol.h"
 #include "token.h"
 #include "typecheck.h"
@@ -38,104 +43,281 @@ const char* stem(const char* filepath) {
     return result;
 }
 
-int main(int argc, char* argv[]) {
-    if(argc < 2) {
-        fprintf(stderr, "error: no input file provided\n");
-        return EXIT_FAILURE;
+// Ensure `main` function exists and has the correct signature
+static bool check_main(void) {
+    const InternId main_identifier = intern("main", 4);
+    const Symbol* main_item = symbol_get(main_identifier);
+    if(!main_item) {
+        fprintf(stderr, "error: function `main` not defined\n");
+        return false;
     }
 
-    // Read source from disk
-    const char* source_path = argv[1];
-    FILE* source_file = fopen(source_path, "r");
-    if(!source_file) {
-        fprintf(stderr, "error: failed to open file '%s' for reading\n", source_path);
-        return EXIT_FAILURE;
+    if(main_item->stype != SYM_FN || main_item->n_params != 0 || main_item->return_type != VAL_INT) {
+        fprintf(stderr, "error: symbol `main` must be a function with no parameters and a return type of int\n");
+        return false;
     }
 
-    fseek(source_file, 0, SEEK_END);
-    const size_t source_len = ftell(source_file);
-    rewind(source_file);
+    return true;
+}
 
-    char* source = malloc(source_len + 1);
-    assert(fread(source, source_len, 1, source_file) == 1);
-    source[source_len] = '\0';
-    fclose(source_file);
+static bool emit_ir = false;
+static bool emit_summaries = false;
+static bool inline_calls = true;
+static long inline_threshold = IR_INLINE_THRESHOLD;
+static bool unroll_loops = true;
+static long unroll_factor = IR_UNROLL_FACTOR;
 
-    // Lex source
-    Lexer lexer = (Lexer) {
-        .source = source,
-        .source_path = source_path,
-    };
+// Builds the IR of `trees` into `program` and optimizes it, checking it is
+// well formed before and after. `whole_program` tells whether `trees` are
+// all there is.
+static bool build_ir(IrProgram* program, const ExprTree* trees, size_t n_trees, bool whole_program) {
+    for(size_t i = 0; i < n_trees; ++i)
+        ir_build_tree(program, &trees[i]);
+    if(!ir_verify_program(program))
+        return false;
+
+    ir_eliminate_tail_calls(program);
+    if(inline_calls)
+        ir_inline_calls(program, inline_threshold);
+    ir_fold_constants(program, whole_program);
+    ir_summarize_functions(program);
+    ir_remove_dead_calls(program);
+    ir_number_values(program);
+    ir_hoist_invariants(program);
+    if(unroll_loops && ir_unroll_loops(program, unroll_factor))
+        ir_fold_constants(program, whole_program);
+    if(!ir_verify_program(program))
+        return false;
+
+    if(emit_ir)
+        ir_print_program(program, stdout);
+    if(emit_summaries)
+        ir_print_summaries(program, stdout);
+    return true;
+}
+
+// Lexes the whole source, parses every top-level expression and only then
+// checks and generates code for the program as a whole
+static bool compile(Lexer* lexer, const char* output_path) {
+    Parser parser = (Parser) { 0 };
 
-    Token* tokens = NULL;
-    size_t n_tokens = 0;
     Token current_token;
     bool has_error = false;
 
     do {
-        if(!lexer_collect_token(&lexer, &current_token)) {
+        if(!lexer_collect_token(lexer, &current_token)) {
             has_error = true;
             continue;
         }
 
-        tokens = realloc(tokens, sizeof(Token) * (n_tokens + 1));
-        tokens[n_tokens++] = current_token;
+        token_stream_push(&parser.tokens, current_token);
     } while(current_token.type != TOK_EOF);
-    
-    free(source);
 
     if(has_error) {
-        free(tokens);
-        return EXIT_FAILURE;
+        parser_free(&parser);
+        return false;
     }
 
-    Parser parser = (Parser) { .tokens = tokens };
-
-    Expr** exprs = NULL;
-    size_t n_exprs = 0;
-    Expr* current_expr;
+    ExprTree* trees = NULL;
+    size_t n_trees = 0;
+    size_t trees_capacity = 0;
+    ExprTree current_tree;
 
     while(!parser_reached_end(&parser)) {
-        current_expr = parser_collect_expr(&parser);
-        if(!current_expr) {
+        if(!parser_collect_tree(&parser, &current_tree)) {
             has_error = true;
             continue;
         }
 
-        exprs = realloc(exprs, sizeof(Expr*) * (n_exprs + 1));
-        exprs[n_exprs++] = current_expr;
+        if(n_trees == trees_capacity) {
+            trees_capacity = trees_capacity ? trees_capacity * 2 : 16;
+            trees = realloc(trees, sizeof(ExprTree) * trees_capacity);
+        }
+        trees[n_trees++] = current_tree;
     }
+    parser_free(&parser);
 
-    // Ensure `main` function exists and has the correct signature
-    if(!symbol_exists("main")) {
-        fprintf(stderr, "error: function `main` not defined\n");
-        return 1;
+    IrProgram program = { 0 };
+    if(!has_error && resolve_names(trees, n_trees) && check_main() && typecheck_exprs(trees, n_trees) && sema_analyze(trees, n_trees)) {
+        eliminate_dead_code(trees, n_trees);
+        has_error = !build_ir(&program, trees, n_trees, true) || !generate_assembly(&program, output_path);
     } else {
-        const Symbol main_item = symbol_get("main");
-        if(main_item.stype != SYM_FN || main_item.n_params != 0 || main_item.return_type != VAL_INT) {
-            fprintf(stderr, "error: symbol `main` must be a function with no parameters and a return type of int\n");
-            return 1;
+        has_error = true;
+    }
+
+    resolve_free();
+    sema_free();
+    dce_free();
+    ir_program_free(&program);
+    ir_build_free();
+    ir_verify_free();
+    ir_fold_free();
+    ir_inline_free();
+    ir_tail_free();
+    ir_summary_free();
+    ir_gvn_free();
+    ir_licm_free();
+    ir_unroll_free();
+    expr_free_all();
+    free(trees);
+
+    return !has_error;
+}
+
+// Tokens are lexed as the parser needs them and each top-level expression is
+// checked, written out and released as soon as it has been parsed. Peak memory
+// is bounded by the largest top-level expression rather than by the size of
+// the source.
+static bool compile_streaming(Lexer* lexer, const char* output_path) {
+    Parser parser = (Parser) { .lexer = lexer };
+
+    FILE* out = codegen_begin(output_path);
+    if(!out)
+        return false;
+
+    bool has_error = false;
+    IrProgram program = { 0 };
+
+    while(!parser_reached_end(&parser)) {
+        ExprTree tree;
+        const bool parsed = parser_collect_tree(&parser, &tree);
+        parser_discard_consumed(&parser);
+
+        if(!parsed || parser.has_lex_error) {
+            has_error = true;
+        } else if(!has_error && resolve_names(&tree, 1) && typecheck_exprs(&tree, 1) && sema_analyze(&tree, 1)) {
+            eliminate_dead_code(&tree, 1);
+            if(build_ir(&program, &tree, 1, false))
+                codegen_write_program(&program, out);
+            else
+                has_error = true;
+            ir_program_reset(&program);
+        } else {
+            has_error = true;
         }
+
+        expr_reset();
     }
+    parser_free(&parser);
+    resolve_free();
+    sema_free();
+    dce_free();
+    ir_program_free(&program);
+    ir_build_free();
+    ir_verify_free();
+    ir_fold_free();
+    ir_inline_free();
+    ir_tail_free();
+    ir_summary_free();
+    ir_gvn_free();
+    ir_licm_free();
+    ir_unroll_free();
+    expr_free_all();
+
+    has_error = has_error || parser.has_lex_error || !check_main();
+    codegen_end(out);
+
+    if(has_error)
+        remove(output_path);
+    return !has_error;
+}
+
+static void usage(const char* program) {
+    fprintf(stderr, "usage: %s [--stream] [--jobs <n>] [--report-dce] [--emit-ir] [--emit-summaries] [--inline-threshold <n>] [--no-inline] [--unroll-factor <n>] [--no-unroll] <file>\n", program);
+}
 
-    if(!typecheck_exprs(exprs, n_exprs)) {
-        for(size_t i = 0; i < n_exprs; ++i)
-            expr_free(exprs[i]);
+int main(int argc, char* argv[]) {
+    const char* source_path = NULL;
+    bool streaming = false;
+    bool report_dce = false;
 
-        free(exprs);
-        global_free_all();
-        return 1;
+    for(int i = 1; i < argc; ++i) {
+        if(strcmp(argv[i], "--stream") == 0) {
+            streaming = true;
+        } else if(strcmp(argv[i], "--emit-ir") == 0) {
+            emit_ir = true;
+        } else if(strcmp(argv[i], "--emit-summaries") == 0) {
+            emit_summaries = true;
+        } else if(strcmp(argv[i], "--no-inline") == 0) {
+            inline_calls = false;
+        } else if(strcmp(argv[i], "--inline-threshold") == 0) {
+            char* end = NULL;
+            inline_threshold = i + 1 < argc ? strtol(argv[i + 1], &end, 10) : 0;
+            if(!end || *end != '\0') {
+                fprintf(stderr, "error: --inline-threshold expects a number\n");
+                usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+            ++i;
+        } else if(strcmp(argv[i], "--no-unroll") == 0) {
+            unroll_loops = false;
+        } else if(strcmp(argv[i], "--unroll-factor") == 0) {
+            char* end = NULL;
+            unroll_factor = i + 1 < argc ? strtol(argv[i + 1], &end, 10) : 0;
+            if(!end || *end != '\0' || unroll_factor < 1) {
+                fprintf(stderr, "error: --unroll-factor expects a positive number\n");
+                usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+            ++i;
+        } else if(strcmp(argv[i], "--report-dce") == 0) {
+            report_dce = true;
+        } else if(strcmp(argv[i], "--jobs") == 0) {
+            char* end = NULL;
+            const long jobs = i + 1 < argc ? strtol(argv[i + 1], &end, 10) : 0;
+            if(!end || *end != '\0' || jobs < 1) {
+                fprintf(stderr, "error: --jobs expects a positive number\n");
+                usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+            typecheck_set_jobs(jobs);
+            ++i;
+        } else if(argv[i][0] == '-') {
+            fprintf(stderr, "error: unknown option '%s'\n", argv[i]);
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        } else {
+            source_path = argv[i];
+        }
     }
-    
-    if(!sema_analyze(exprs, n_exprs))
-        return 1;
+
+    if(!source_path) {
+        fprintf(stderr, "error: no input file provided\n");
+        return EXIT_FAILURE;
+    }
+
+    // Map source into memory. Tokens and string literals refer to slices of
+    // the mapping, so it must stay alive until code generation has finished.
+    Source source;
+    if(!source_open(&source, source_path))
+        return EXIT_FAILURE;
+    current_source = &source;
+
+    Lexer lexer = (Lexer) {
+        .source = source.data,
+        .source_len = source.len,
+    };
 
     char path_buffer[128];
     const char* source_path_stem = stem(source_path);
     snprintf(path_buffer, 127, "%s.asm", source_path_stem);
 
-    generate_assembly(exprs, n_exprs, path_buffer);
-    free(tokens);
+    const bool success = streaming
+        ? compile_streaming(&lexer, path_buffer)
+        : compile(&lexer, path_buffer);
+
+    source_close(&source);
+    symbol_free_all();
+    global_free_all();
+    intern_free_all();
+
+    if(!success) {
+        free((void*)source_path_stem);
+        return EXIT_FAILURE;
+    }
+
+    if(report_dce)
+        dce_report();
 
     // Use buffer for commands
     char command_buffer[256];
@@ -152,12 +334,5 @@ int main(int argc, char* argv[]) {
 
     free((void*)source_path_stem);
 
-    for(size_t i = 0; i < n_exprs; ++i) {
-        expr_free(exprs[i]);
-    }
-    free(exprs);
-
-    global_free_all();
-
     return EXIT_SUCCESS;
 }
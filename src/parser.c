@@ -4,24 +4,138 @@
 #include <string.h>
 
 #include "expr.h"
+#include "intern.h"
+#include "lexer.h"
 #include "parser.h"
+#include "source.h"
 #include "symbol.h"
 #include "token.h"
 
 // TODO: Error recovery
 
-Symbol parent_fn = (Symbol) { .exists = false };
+SymbolId parent_fn = SYMBOL_NONE;
 
-static Token peek(const Parser* par) {
-    return par->tokens[par->tp];
+// Drops every consumed token except the most recent one, which `previous`
+// may still refer to. When streaming this is called between top-level
+// expressions, so the buffer only ever holds the tokens of one of them.
+void parser_discard_consumed(Parser* par) {
+    if(par->tp < 2)
+        return;
+
+    const size_t n_discarded = par->tp - 1;
+    token_stream_discard(&par->tokens, n_discarded);
+    par->tp -= n_discarded;
+}
+
+// Statement lists are gathered on a shared scratch stack while they are being
+// parsed and linked together once they are complete. Nested bodies simply
+// push on top of their parent's.
+static ExprId* scratch = NULL;
+static size_t scratch_len = 0;
+static size_t scratch_capacity = 0;
+
+static void scratch_push(ExprId expr) {
+    if(scratch_len == scratch_capacity) {
+        scratch_capacity = scratch_capacity ? scratch_capacity * 2 : 64;
+        scratch = realloc(scratch, sizeof(ExprId) * scratch_capacity);
+    }
+    scratch[scratch_len++] = expr;
+}
+
+// Links everything pushed since `mark` into a list and pops it. Returns the
+// first expression of the list, or EXPR_NONE if it is empty.
+static ExprId scratch_pop(size_t mark) {
+    const ExprId first = expr_link(scratch + mark, scratch_len - mark);
+    scratch_len = mark;
+    return first;
+}
+
+// Blocks are parsed without recursion, so that their nesting depth is only
+// limited by memory. The statement opening a block pushes a frame describing
+// it, the statements of its body are gathered on the scratch stack and the
+// block's expression is only created once its `end` has been reached.
+// Parentheses push a frame in the same way, for a grouping or for the
+// arguments of a call, which is popped at the matching `)`.
+typedef struct {
+    TokenType kind; // TOK_IF, TOK_WHILE, TOK_FN, TOK_LEFT_PAREN for a grouping or TOK_IDENTIFIER for a call
+    bool in_else;
+    ExprId condition;
+    ExprId if_body; // Once an if block has reached its else
+    SymbolId fn; // Function being defined or called
+    SymbolId outer_fn; // Value of `parent_fn` to restore once the block ends
+    size_t mark; // Start of the body or arguments being collected on the scratch stack
+    size_t ops_mark; // Start of the operators pending within a grouping or argument
+    Token start; // Keyword opening the block, or identifier of the function called
+} Block;
+
+static Block* blocks = NULL;
+static size_t blocks_len = 0;
+static size_t blocks_capacity = 0;
+
+// Operators of the expression being collected which are still waiting for
+// their right operand
+typedef enum {
+    OP_PREFIX,
+    OP_BINARY,
+    OP_ASSIGN,
+} OpKind;
+
+typedef struct {
+    OpKind kind;
+    Token op;
+    InternId target; // Variable assigned to by OP_ASSIGN
+} PendingOp;
+
+static PendingOp* ops = NULL;
+static size_t ops_len = 0;
+static size_t ops_capacity = 0;
+
+void parser_free(Parser* par) {
+    token_stream_free(&par->tokens);
+    par->tp = 0;
+    free(scratch);
+    scratch = NULL;
+    scratch_len = scratch_capacity = 0;
+    free(blocks);
+    blocks = NULL;
+    blocks_len = blocks_capacity = 0;
+    free(ops);
+    ops = NULL;
+    ops_len = ops_capacity = 0;
+}
+
+// Ensures the token at the current position has been collected. Tokens which
+// fail to lex have already been reported and are skipped.
+static void fill(Parser* par) {
+    while(par->lexer && par->tp >= par->tokens.len) {
+        Token tok;
+        if(!lexer_collect_token(par->lexer, &tok)) {
+            par->has_lex_error = true;
+            continue;
+        }
+        token_stream_push(&par->tokens, tok);
+    }
+}
+
+// Only the type of the current token is needed to make parsing decisions,
+// whole tokens are assembled from the stream for values and diagnostics
+static TokenType peek(Parser* par) {
+    fill(par);
+    return par->tokens.types[par->tp];
+}
+
+static Token current(Parser* par) {
+    fill(par);
+    return token_stream_get(&par->tokens, par->tp);
 }
 
 static Token previous(const Parser* par) {
-    return par->tokens[par->tp - 1];
+    return token_stream_get(&par->tokens, par->tp - 1);
 }
 
 static Token advance(Parser* par) {
-    return par->tokens[par->tp++];
+    fill(par);
+    return token_stream_get(&par->tokens, par->tp++);
 }
 
 static void undo_advance(Parser* par) {
@@ -29,12 +143,12 @@ static void undo_advance(Parser* par) {
 }
 
 static bool check(Parser* par, TokenType type) {
-    return peek(par).type == type;
+    return peek(par) == type;
 }
 
 static bool match(Parser* par, TokenType type) {
     if(check(par, type)) {
-        advance(par);
+        ++par->tp;
         return true;
     }
 
@@ -43,10 +157,10 @@ static bool match(Parser* par, TokenType type) {
 
 static bool expect(Parser* par, TokenType type) {
     if(!match(par, type)) {
-        const Token tok = peek(par);
-        fprintf(stderr, "%s:%lu:%lu: error: expected %s, found %s instead\n",
-            tok.source_path, tok.line + 1, tok.column + 1,
-            token_strs[type], token_strs[tok.type]
+        const Token tok = current(par);
+        source_error(tok.offset, "expected %s, found %s instead\n",
+            token_strs[type],
+            token_strs[tok.type]
         );
         return false;
     }
@@ -59,12 +173,11 @@ static bool expect(Parser* par, TokenType type) {
 // in the process of checking its contents. The token could then be retrieved
 // by the callee using the `previous` function.
 static bool check_type(Parser* par) {
-    const Token t = peek(par);
+    const TokenType type = peek(par);
 
-    if(t.type != TOK_TYPE_INT && t.type != TOK_TYPE_BOOL) {
-        const Token tok = peek(par);
-        fprintf(stderr, "%s:%lu:%lu: error: expected type, found %s instead\n",
-            tok.source_path, tok.line + 1, tok.column + 1,
+    if(type != TOK_TYPE_INT && type != TOK_TYPE_BOOL) {
+        const Token tok = current(par);
+        source_error(tok.offset, "expected type, found %s instead\n",
             token_strs[tok.type]
         );
         return false;
@@ -73,260 +186,332 @@ static bool check_type(Parser* par) {
     return true;
 }
 
-Expr* collect_fn_call(Parser* par);
-
-Expr* collect_primary(Parser* par) {
-    if(match(par, TOK_INT) || match(par, TOK_BOOL) || match(par, TOK_STRING)) {
-        return expr_create_literal(previous(par).value);
+// Binding power of each binary operator, higher binding tighter. Tokens which
+// are not binary operators have a binding power of 0. All binary operators
+// are left associative.
+enum {
+    PREC_NONE,
+    PREC_EQUALITY,
+    PREC_COMPARISON,
+    PREC_TERM,
+    PREC_FACTOR,
+};
+
+static const uint8_t binary_precedence[TOK_EOF + 1] = {
+    [TOK_EQUAL_EQUAL] = PREC_EQUALITY,
+    [TOK_BANG_EQUAL] = PREC_EQUALITY,
+    [TOK_LESS] = PREC_COMPARISON,
+    [TOK_LESS_EQUAL] = PREC_COMPARISON,
+    [TOK_GREATER] = PREC_COMPARISON,
+    [TOK_GREATER_EQUAL] = PREC_COMPARISON,
+    [TOK_PLUS] = PREC_TERM,
+    [TOK_MINUS] = PREC_TERM,
+    [TOK_STAR] = PREC_FACTOR,
+    [TOK_SLASH] = PREC_FACTOR,
+};
+
+static Block* open_block(TokenType kind) {
+    if(blocks_len == blocks_capacity) {
+        blocks_capacity = blocks_capacity ? blocks_capacity * 2 : 16;
+        blocks = realloc(blocks, sizeof(Block) * blocks_capacity);
     }
 
-    if(match(par, TOK_IDENTIFIER)) {
-        // Function call
-        if(check(par, TOK_LEFT_PAREN)) {
-            return collect_fn_call(par);
-        } else {
-            // Variable
-            const Token iden = previous(par);
-            
-            bool is_parameter = false;
-            if(parent_fn.exists) {
-                for(size_t i = 0; i < parent_fn.n_params; ++i) {
-                    if(strcmp(parent_fn.param_identifiers[i], iden.value.identifier) == 0) {
-                        is_parameter = true;
-                    }
-                }
-            }
-
-            if(!symbol_exists(iden.value.identifier) && !is_parameter) {
-                fprintf(stderr, "%s:%lu:%lu: error: use of undefined variable %s\n",
-                    iden.source_path, iden.line + 1, iden.column + 1,
-                    iden.value.identifier
-                );
-                return NULL;
-            }
-
-            return expr_create_literal(iden.value);
-        }
-    }
+    Block* block = &blocks[blocks_len++];
+    *block = (Block) {
+        .kind = kind,
+        .condition = EXPR_NONE,
+        .if_body = EXPR_NONE,
+        .fn = SYMBOL_NONE,
+        .outer_fn = parent_fn,
+        .mark = scratch_len,
+        .ops_mark = ops_len,
+    };
+    return block;
+}
 
-    if(match(par, TOK_LEFT_PAREN)) {
-        Expr* expr = parser_collect_expr(par);
-        if(!expect(par, TOK_RIGHT_PAREN))
-            return NULL;
-        return expr_create_grouping(expr);
+static ExprId close_block(void) {
+    const Block block = blocks[--blocks_len];
+    const ExprId body = scratch_pop(block.mark);
+
+    switch(block.kind) {
+        case TOK_IF:
+            if(block.in_else)
+                return expr_create_if(block.start, block.condition, block.if_body, body);
+            return expr_create_if(block.start, block.condition, body, EXPR_NONE);
+        case TOK_WHILE:
+            return expr_create_while(block.start, block.condition, body);
+        default:
+            parent_fn = block.outer_fn;
+            return expr_create_fn_def(block.fn, body);
     }
-
-    const Token tok = peek(par);
-    fprintf(stderr, "%s:%lu:%lu: error: failed to parse primary expr from %s\n",
-        tok.source_path, tok.line + 1, tok.column + 1,
-        token_strs[tok.type]
-    );
-    exit(1);
-    return NULL;
 }
 
-Expr* collect_unary(Parser* par) {
-    if(match(par, TOK_MINUS) || match(par, TOK_NOT)) {
-        Token op = previous(par);
-        Expr* rhs = collect_unary(par);
-        return expr_create_unary(op, rhs);
-    }
+// Drops every block opened since `base` along with the bodies collected for
+// them
+static void abandon_blocks(size_t base) {
+    if(blocks_len <= base)
+        return;
 
-    return collect_primary(par);
+    scratch_len = blocks[base].mark;
+    parent_fn = blocks[base].outer_fn;
+    blocks_len = base;
 }
 
-Expr* collect_factor(Parser* par) {
-    Expr* expr = collect_unary(par);
-
-    while(match(par, TOK_STAR) || match(par, TOK_SLASH)) {
-        Token op = previous(par);
-        Expr* rhs = collect_unary(par);
-        expr = expr_create_binary(expr, op, rhs);
+static void push_op(OpKind kind, Token op, InternId target) {
+    if(ops_len == ops_capacity) {
+        ops_capacity = ops_capacity ? ops_capacity * 2 : 64;
+        ops = realloc(ops, sizeof(PendingOp) * ops_capacity);
     }
-
-    return expr;
+    ops[ops_len++] = (PendingOp) { .kind = kind, .op = op, .target = target };
 }
 
-Expr* collect_term(Parser* par) {
-    Expr* expr = collect_factor(par);
+static bool is_assignment_op(TokenType type) {
+    return type == TOK_EQUAL || type == TOK_PLUS_EQUAL || type == TOK_MINUS_EQUAL || type == TOK_STAR_EQUAL || type == TOK_SLASH_EQUAL;
+}
 
-    while(match(par, TOK_PLUS) || match(par, TOK_MINUS)) {
-        Token op = previous(par);
-        Expr* rhs = collect_factor(par);
-        expr = expr_create_binary(expr, op, rhs);
+// Applies the operators pending since `mark` which bind at least as tightly
+// as `min_precedence` to the operands on top of the scratch stack.
+// Assignments bind more loosely than any binary operator and are only
+// applied once `min_precedence` is PREC_NONE.
+static void reduce(size_t mark, uint8_t min_precedence) {
+    while(ops_len > mark) {
+        const PendingOp pending = ops[ops_len - 1];
+        if(pending.kind == OP_BINARY) {
+            if(binary_precedence[pending.op.type] < min_precedence)
+                break;
+            const ExprId rhs = scratch[--scratch_len];
+            scratch[scratch_len - 1] = expr_create_binary(scratch[scratch_len - 1], pending.op, rhs);
+        } else {
+            if(min_precedence != PREC_NONE)
+                break;
+            scratch[scratch_len - 1] = expr_create_assign(pending.target, pending.op, scratch[scratch_len - 1]);
+        }
+        --ops_len;
     }
+}
 
+// Prefix operators bind tighter than any binary operator, so they are
+// applied innermost first as soon as their operand is complete
+static ExprId apply_prefixes(size_t mark, ExprId expr) {
+    while(ops_len > mark && ops[ops_len - 1].kind == OP_PREFIX)
+        expr = expr_create_unary(ops[--ops_len].op, expr);
     return expr;
 }
 
-Expr* collect_comparison(Parser* par) {
-    Expr* expr = collect_term(par);
-
-    while(match(par, TOK_LESS)
-          || match(par, TOK_LESS_EQUAL)
-          || match(par, TOK_GREATER)
-          || match(par, TOK_GREATER_EQUAL)
-    ) {
-        Token op = previous(par);
-        Expr* rhs = collect_unary(par);
-        expr = expr_create_binary(expr, op, rhs);
+static bool open_call(Token identifier) {
+    const SymbolId fn = symbol_lookup(identifier.payload);
+    if(fn == SYMBOL_NONE || symbol_at(fn)->stype != SYM_FN) {
+        source_error(identifier.offset, "attempted to call non function '%s'\n",
+            intern_str(identifier.payload)
+        );
+        return false;
     }
 
-    return expr;
+    Block* call = open_block(TOK_IDENTIFIER);
+    call->fn = fn;
+    call->start = identifier;
+    return true;
 }
 
-Expr* collect_equality(Parser* par) {
-    Expr* expr = collect_comparison(par);
+static ExprId close_call(void) {
+    const Block call = blocks[--blocks_len];
+    const size_t n_params = scratch_len - call.mark;
+    const ExprId params = scratch_pop(call.mark);
 
-    while(match(par, TOK_EQUAL_EQUAL) || match(par, TOK_BANG_EQUAL)) {
-        Token op = previous(par);
-        Expr* rhs = collect_unary(par);
-        expr = expr_create_binary(expr, op, rhs);
+    const Symbol* fn_symbol = symbol_at(call.fn);
+    if(n_params != fn_symbol->n_params) {
+        source_error(call.start.offset, "function '%s' expects %lu parameters, but only %lu were provided\n",
+            intern_str(fn_symbol->identifier),
+            fn_symbol->n_params, n_params
+        );
+        return EXPR_NONE;
     }
 
-    return expr;
+    return expr_create_fn_call(call.start, call.fn, params);
 }
 
-Expr* collect_assignment(Parser* par) {
-    Expr* expr = collect_equality(par);
-
-    if(match(par, TOK_EQUAL) || match(par, TOK_PLUS_EQUAL) || match(par, TOK_MINUS_EQUAL) || match(par, TOK_STAR_EQUAL) || match(par, TOK_SLASH_EQUAL)) {
-        Token op = previous(par);
-        Expr* rhs = parser_collect_expr(par);
-
-        if(expr->tag != EXPR_LITERAL || expr->literal.value.tag != VAL_IDENTIFIER) {
-            fprintf(stderr, "%s:%lu:%lu: error: invalid assignment target\n", op.source_path, op.line + 1, op.column + 1);
-            return NULL;
-        }
-
-        const char* identifier = expr->literal.value.identifier;
+// Drops what was collected of an expression which failed to parse
+static ExprId abandon_expr(size_t base, size_t mark, size_t ops_mark) {
+    blocks_len = base;
+    scratch_len = mark;
+    ops_len = ops_mark;
+    return EXPR_NONE;
+}
 
-        if(!symbol_exists(identifier)) {
-            fprintf(stderr, "%s:%lu:%lu: error: cannot assign non-existant variable %s\n",
-                op.source_path, op.line + 1, op.column + 1, identifier
+// Collects an expression without recursion, however deeply its groupings and
+// calls are nested. Operands wait on the scratch stack and operators on the
+// operator stack until an operator binding no tighter, or the end of the
+// innermost grouping or argument, is reached.
+static ExprId collect_assignment(Parser* par) {
+    const size_t base = blocks_len;
+    const size_t mark = scratch_len;
+    const size_t ops_mark = ops_len;
+
+    for(;;) {
+        while(match(par, TOK_MINUS) || match(par, TOK_NOT))
+            push_op(OP_PREFIX, previous(par), 0);
+
+        ExprId expr;
+        if(match(par, TOK_INT) || match(par, TOK_BOOL) || match(par, TOK_STRING)) {
+            expr = expr_create_literal(previous(par));
+        } else if(match(par, TOK_IDENTIFIER)) {
+            const Token identifier = previous(par);
+            if(!match(par, TOK_LEFT_PAREN)) {
+                // Variable, bound to its definition once names are resolved
+                expr = expr_create_literal(identifier);
+            } else if(!open_call(identifier)) {
+                return abandon_expr(base, mark, ops_mark);
+            } else if(!match(par, TOK_RIGHT_PAREN)) {
+                continue;
+            } else if((expr = close_call()) == EXPR_NONE) {
+                return abandon_expr(base, mark, ops_mark);
+            }
+        } else if(match(par, TOK_LEFT_PAREN)) {
+            open_block(TOK_LEFT_PAREN);
+            continue;
+        } else {
+            const Token tok = current(par);
+            source_error(tok.offset, "failed to parse primary expr from %s\n",
+                token_strs[tok.type]
             );
-            return NULL;
+            exit(1);
         }
 
-        return expr_create_assign(identifier, op, rhs);
-    }
+        // Operands which end a grouping or call complete an operand of the
+        // enclosing expression in turn
+        for(;;) {
+            const size_t level = blocks_len > base ? blocks[blocks_len - 1].ops_mark : ops_mark;
+            scratch_push(apply_prefixes(level, expr));
+
+            const TokenType type = peek(par);
+            if(binary_precedence[type] != PREC_NONE) {
+                reduce(level, binary_precedence[type]);
+                push_op(OP_BINARY, advance(par), 0);
+                break;
+            }
 
-    return expr;
-}
+            if(is_assignment_op(type)) {
+                reduce(level, PREC_EQUALITY);
+                const Token op = advance(par);
+                const Expr* target = expr_get(scratch[scratch_len - 1]);
+                if(target->tag != EXPR_LITERAL || target->literal.tag != VAL_IDENTIFIER) {
+                    source_error(op.offset, "invalid assignment target\n");
+                    return abandon_expr(base, mark, ops_mark);
+                }
 
-Expr* collect_if(Parser* par) {
-    Expr* condition = parser_collect_expr(par);
-    if(!expect(par, TOK_THEN))
-        return NULL;
-    
-    Expr** if_body = NULL;
-    size_t if_body_len = 0;
-    while(!(match(par, TOK_END) || match(par, TOK_ELSE))) {
-        Expr* expr = parser_collect_expr(par);
-        if(!expr)
-            return NULL;
-        if_body = realloc(if_body, sizeof(Expr*) * (if_body_len + 1));
-        if_body[if_body_len++] = expr;
-    }
+                // The target is stored as an identifier rather than as a child
+                const InternId identifier = target->literal.identifier;
+                expr_discard(scratch[--scratch_len]);
+                push_op(OP_ASSIGN, op, identifier);
+                break;
+            }
 
-    if(previous(par).type == TOK_END) {
-        return expr_create_if(condition, if_body, if_body_len, NULL, 0);
-    }
+            reduce(level, PREC_NONE);
+            if(blocks_len == base)
+                return scratch[--scratch_len];
 
-    if(previous(par).type != TOK_ELSE) {
-        Token prev = previous(par);
-        fprintf(stderr, "%s:%lu:%lu: error: expected end or else, found %s instead\n",
-            prev.source_path, prev.line + 1, prev.column + 1,
-            token_strs[prev.type]
-        );
-        return NULL;
-    }
+            if(blocks[blocks_len - 1].kind == TOK_LEFT_PAREN) {
+                if(!expect(par, TOK_RIGHT_PAREN))
+                    return abandon_expr(base, mark, ops_mark);
+                --blocks_len;
+                expr = expr_create_grouping(scratch[--scratch_len]);
+                continue;
+            }
 
-    Expr** else_body = NULL;
-    size_t else_body_len = 0;
-    while(!match(par, TOK_END)) {
-        Expr* expr = parser_collect_expr(par);
-        if(!expr)
-            return NULL;
-        else_body = realloc(else_body, sizeof(Expr*) * (else_body_len + 1));
-        else_body[else_body_len++] = expr;
+            // Each argument is left on the scratch stack for the call
+            if(match(par, TOK_COMMA) && !check(par, TOK_RIGHT_PAREN))
+                break;
+            if(!match(par, TOK_RIGHT_PAREN)) {
+                const Token tok = current(par);
+                source_error(tok.offset, "expected comma or right paren, found %s instead\n",
+                    token_strs[tok.type]
+                );
+                return abandon_expr(base, mark, ops_mark);
+            }
+            if((expr = close_call()) == EXPR_NONE)
+                return abandon_expr(base, mark, ops_mark);
+        }
     }
+}
 
-    return expr_create_if(condition, if_body, if_body_len, else_body, else_body_len);
+static bool open_if(Parser* par) {
+    const Token keyword = previous(par);
+    const ExprId condition = parser_collect_expr(par);
+    if(condition == EXPR_NONE || !expect(par, TOK_THEN))
+        return false;
+
+    Block* block = open_block(TOK_IF);
+    block->start = keyword;
+    block->condition = condition;
+    return true;
 }
 
-static Expr* collect_var_definition(Parser* par) {
+static ExprId collect_var_definition(Parser* par) {
     Token start = previous(par);
 
     // Get identifier
     if(!expect(par, TOK_IDENTIFIER))
-        return NULL;
+        return EXPR_NONE;
     Token identifier = previous(par);
 
     if(!expect(par, TOK_COLON))
-        return NULL;
+        return EXPR_NONE;
     
     if(!check_type(par))
-        return NULL;
+        return EXPR_NONE;
     
     Token type = advance(par);
     ValueTag value_tag = token_type_to_value_tag(type.type);
 
     // Get optional variable initializer
-    Expr* initializer = NULL;
+    ExprId initializer = EXPR_NONE;
 
     if(match(par, TOK_EQUAL)) {
         initializer = parser_collect_expr(par);
+        if(initializer == EXPR_NONE)
+            return EXPR_NONE;
     }
 
-    if(symbol_exists(identifier.value.identifier)) {
-        fprintf(stderr, "%s:%lu:%lu: error: redefinition of variable %s\n",
-            start.source_path, start.line + 1, start.column + 1,
-            identifier.value.identifier
+    if(symbol_exists(identifier.payload)) {
+        source_error(start.offset, "redefinition of variable %s\n",
+            intern_str(identifier.payload)
         );
-        return NULL;
+        return EXPR_NONE;
     }
-    symbol_add_var(identifier.value.identifier, value_tag);
-    return expr_create_var_def(identifier.value.identifier, value_tag, initializer);
+    const SymbolId symbol = symbol_add_var(identifier.payload, value_tag);
+    return expr_create_var_def(symbol, value_tag, initializer);
 }
 
-static Expr* collect_while_loop(Parser* par) {
-    Expr* condition = parser_collect_expr(par);
-    if(!expect(par, TOK_DO))
-        return NULL;
-    
-    Expr** body = NULL;
-    size_t body_len = 0;
-    while(!match(par, TOK_END)) {
-        Expr* expr = parser_collect_expr(par);
-        if(!expr)
-            return NULL;
-        body = realloc(body, sizeof(Expr*) * (body_len + 1));
-        body[body_len++] = expr;
-    }
+static bool open_while_loop(Parser* par) {
+    const Token keyword = previous(par);
+    const ExprId condition = parser_collect_expr(par);
+    if(condition == EXPR_NONE || !expect(par, TOK_DO))
+        return false;
 
-    return expr_create_while(condition, body, body_len);
+    Block* block = open_block(TOK_WHILE);
+    block->start = keyword;
+    block->condition = condition;
+    return true;
 }
 
-static Expr* collect_fn_def(Parser* par) {
+static bool open_fn_def(Parser* par) {
     expect(par, TOK_IDENTIFIER);
     const Token identifier = previous(par);
 
-    if(symbol_exists(identifier.value.identifier)) {
-        fprintf(stderr, "%s:%lu:%lu: error: redefinition of symbol %s\n",
-            identifier.source_path, identifier.line + 1, identifier.column + 1,
-            identifier.value.identifier
+    if(symbol_exists(identifier.payload)) {
+        source_error(identifier.offset, "redefinition of symbol %s\n",
+            intern_str(identifier.payload)
         );
-        return NULL;
+        return false;
     }
     
     expect(par, TOK_LEFT_PAREN);
 
     size_t n_params = 0;
-    char** param_identifiers = NULL;
+    InternId* param_identifiers = NULL;
     ValueTag* param_types = NULL;
 
-    while(peek(par).type != TOK_RIGHT_PAREN) {
+    while(peek(par) != TOK_RIGHT_PAREN) {
         expect(par, TOK_IDENTIFIER);
         const Token param_identifier = previous(par);
 
@@ -336,23 +521,23 @@ static Expr* collect_fn_def(Parser* par) {
         const ValueTag param_type = token_type_to_value_tag(advance(par).type);
 
         ++n_params;
-        param_identifiers = (char**)realloc(param_identifiers, sizeof(char*) * n_params);
-        param_identifiers[n_params - 1] = (char*)param_identifier.value.identifier;
+        param_identifiers = (InternId*)realloc(param_identifiers, sizeof(InternId) * n_params);
+        param_identifiers[n_params - 1] = param_identifier.payload;
         param_types = (ValueTag*)realloc(param_types, sizeof(ValueTag) * n_params);
         param_types[n_params - 1] = param_type;
 
-        const Token tok = peek(par);
+        const Token tok = current(par);
 
         if(tok.type == TOK_RIGHT_PAREN)
             break;
 
         if(tok.type != TOK_COMMA) {
-            fprintf(stderr, "%s:%lu:%lu: error: expected comma or right paren, found %s instead\n",
-                tok.source_path, tok.line + 1, tok.column + 1, token_strs[tok.type]
+            source_error(tok.offset, "expected comma or right paren, found %s instead\n",
+                token_strs[tok.type]
             );
             free(param_identifiers);
             free(param_types);
-            return NULL;
+            return false;
         }
 
         advance(par);
@@ -363,103 +548,81 @@ static Expr* collect_fn_def(Parser* par) {
     check_type(par);
     const ValueTag return_type = token_type_to_value_tag(advance(par).type);
     
-    parent_fn = symbol_add_fn(identifier.value.identifier, param_types, (const char**)param_identifiers, n_params, return_type);
-
-    Expr** body = NULL;
-    size_t body_len = 0;
-    while(!match(par, TOK_END)) {
-        Expr* expr = parser_collect_expr(par);
-        if(!expr)
-            return NULL;
-        body = realloc(body, sizeof(Expr*) * (body_len + 1));
-        body[body_len++] = expr;
-    }
-
-    Expr* result = expr_create_fn_def(identifier.value.identifier, (const char**)param_identifiers, param_types, n_params, return_type, body, body_len);
-    parent_fn = (Symbol) { .exists = false };
-    return result;
+    const SymbolId fn = symbol_add_fn(identifier.payload, param_types, param_identifiers, n_params, return_type);
+    open_block(TOK_FN)->fn = fn;
+    parent_fn = fn;
+    return true;
 }
 
-Expr* collect_return(Parser* par) {
+ExprId collect_return(Parser* par) {
     const Token op = previous(par);
-    const Expr* value_expr = parser_collect_expr(par);
-    return expr_create_return(op, (Expr*)value_expr);
+    const ExprId value_expr = parser_collect_expr(par);
+    return expr_create_return(op, value_expr);
 }
 
-Expr* collect_fn_call(Parser* par) {
-    const Token identifier = previous(par);
-
-    const Symbol fn_symbol = symbol_get(identifier.value.identifier);
-
-    if(fn_symbol.stype != SYM_FN) {
-        fprintf(stderr, "%s:%lu:%lu: error: attempted to call non function '%s'\n",
-            identifier.source_path, identifier.line + 1, identifier.column + 1,
-            identifier.value.identifier
-        );
-        return NULL;
-    }
-    
-    expect(par, TOK_LEFT_PAREN);
-
-    size_t n_params = 0;
-    Expr** param_exprs = NULL;
-
-    while(peek(par).type != TOK_RIGHT_PAREN) {
-        Expr* expr = collect_assignment(par);
-
-        ++n_params;
-        param_exprs = (Expr**)realloc(param_exprs, sizeof(Expr*) * n_params);
-        param_exprs[n_params - 1] = expr;
-
-        const Token tok = peek(par);
-
-        if(tok.type == TOK_RIGHT_PAREN)
-            break;
-
-        if(tok.type != TOK_COMMA) {
-            fprintf(stderr, "%s:%lu:%lu: error: expected comma or right paren, found %s instead\n",
-                tok.source_path, tok.line + 1, tok.column + 1, token_strs[tok.type]
-            );
-            free(param_exprs);
-            return NULL;
+// Collects one statement, including the whole body of a block statement
+ExprId collect_statement(Parser* par) {
+    // Blocks below `base` belong to an enclosing call, such as one collecting
+    // the block whose condition is being parsed
+    const size_t base = blocks_len;
+
+    for(;;) {
+        Block* block = blocks_len > base ? &blocks[blocks_len - 1] : NULL;
+        ExprId stmt;
+
+        if(block && match(par, TOK_END)) {
+            stmt = close_block();
+        } else if(block && block->kind == TOK_IF && !block->in_else && match(par, TOK_ELSE)) {
+            block->if_body = scratch_pop(block->mark);
+            block->in_else = true;
+            continue;
+        } else if(match(par, TOK_IF)) {
+            if(open_if(par))
+                continue;
+            stmt = EXPR_NONE;
+        } else if(match(par, TOK_WHILE)) {
+            if(open_while_loop(par))
+                continue;
+            stmt = EXPR_NONE;
+        } else if(match(par, TOK_FN)) {
+            if(open_fn_def(par))
+                continue;
+            stmt = EXPR_NONE;
+        } else if(match(par, TOK_VAR)) {
+            stmt = collect_var_definition(par);
+        } else if(match(par, TOK_RETURN)) {
+            stmt = collect_return(par);
+        } else {
+            stmt = collect_assignment(par);
         }
 
-        advance(par);
-    }
-
-    advance(par);
-
-    if(n_params != fn_symbol.n_params) {
-        fprintf(stderr, "%s:%lu:%lu: error: function '%s' expects %lu parameters, but only %lu were provided\n",
-            identifier.source_path, identifier.line + 1, identifier.column + 1,
-            identifier.value.identifier,
-            fn_symbol.n_params, n_params
-        );
-    }
+        if(stmt == EXPR_NONE) {
+            abandon_blocks(base);
+            return EXPR_NONE;
+        }
 
-    return expr_create_fn_call(fn_symbol, param_exprs);
-}
-
-Expr* collect_statement(Parser* par) {
-    if(match(par, TOK_IF)) {
-        return collect_if(par);
-    } else if(match(par, TOK_VAR)) {
-        return collect_var_definition(par);
-    } else if(match(par, TOK_WHILE)) {
-        return collect_while_loop(par);
-    } else if(match(par, TOK_FN)) {
-        return collect_fn_def(par);
-    } else if(match(par, TOK_RETURN)) {
-        return collect_return(par);
-    } else {
-        return collect_assignment(par);
+        if(blocks_len == base)
+            return stmt;
+        scratch_push(stmt);
     }
 }
 
-bool parser_reached_end(const Parser* par) {
-    return peek(par).type == TOK_EOF;
+bool parser_reached_end(Parser* par) {
+    return peek(par) == TOK_EOF;
 }
 
-Expr* parser_collect_expr(Parser* par) {
+ExprId parser_collect_expr(Parser* par) {
     return collect_statement(par);
 }
+
+// Collects one top-level expression as a tree of its own
+bool parser_collect_tree(Parser* par, ExprTree* tree) {
+    if(parser_collect_expr(par) == EXPR_NONE) {
+        expr_discard(0);
+        scratch_len = 0;
+        return false;
+    }
+
+    *tree = expr_finish_tree();
+    return true;
+}
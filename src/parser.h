@@ -5,16 +5,26 @@
 #include <stddef.h>
 
 #include "expr.h"
+#include "lexer.h"
 #include "token.h"
 
-extern Symbol parent_fn;
+extern SymbolId parent_fn;
 
 typedef struct {
-    const Token* tokens;
+    TokenStream tokens;
     size_t tp;
+
+    // When set, tokens are collected from the lexer only once the parser
+    // reaches them instead of being pushed up front
+    Lexer* lexer;
+    bool has_lex_error;
 } Parser;
 
-bool parser_reached_end(const Parser* par);
-Expr* parser_collect_expr(Parser* par);
+void parser_discard_consumed(Parser* par);
+void parser_free(Parser* par);
+
+bool parser_reached_end(Parser* par);
+ExprId parser_collect_expr(Parser* par);
+bool parser_collect_tree(Parser* par, ExprTree* tree);
 
 #endif // PARSER_H
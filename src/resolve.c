@@ -0,0 +1,128 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "expr.h"
+#include "intern.h"
+#include "resolve.h"
+#include "source.h"
+#include "symbol.h"
+#include "value.h"
+
+// Identifiers are looked up once, here, and rewritten in place into direct
+// references to the global or parameter they name. No later pass needs to
+// look a name up again.
+//
+// Globals may only be used after they have been defined. Nodes are visited in
+// post-order and trees in source order, which is the order the parser
+// defined their symbols in, so `defined` tracks which globals are in scope.
+static bool* defined = NULL;
+static size_t defined_capacity = 0;
+
+static void grow_defined(void) {
+    if(n_symbols <= defined_capacity)
+        return;
+
+    size_t capacity = defined_capacity ? defined_capacity : 1024;
+    while(capacity < n_symbols)
+        capacity *= 2;
+
+    defined = realloc(defined, sizeof(bool) * capacity);
+    memset(defined + defined_capacity, 0, sizeof(bool) * (capacity - defined_capacity));
+    defined_capacity = capacity;
+}
+
+// Globals shadow the parameters of the function being defined
+static bool resolve_variable(Expr* expr) {
+    const InternId identifier = expr->literal.identifier;
+    const SymbolId parent = expr->literal.parent_fn;
+
+    const SymbolId global = symbol_lookup(identifier);
+    if(global != SYMBOL_NONE && symbol_at(global)->stype != SYM_VAR) {
+        source_error(expr->offset, "symbol '%s' is not a variable\n", intern_str(identifier));
+        return false;
+    }
+
+    if(global != SYMBOL_NONE && defined[global]) {
+        expr->tag = EXPR_VARIABLE;
+        expr->variable.symbol = global;
+        expr->variable.param = PARAM_NONE;
+        expr->variable.frame_offset = 0;
+        return true;
+    }
+
+    if(parent != SYMBOL_NONE) {
+        const Symbol* fn = symbol_at(parent);
+        uint32_t frame_offset = 0;
+        for(size_t i = 0; i < fn->n_params; ++i) {
+            if(fn->param_identifiers[i] == identifier) {
+                expr->tag = EXPR_VARIABLE;
+                expr->variable.symbol = parent;
+                expr->variable.param = i;
+                expr->variable.frame_offset = frame_offset;
+                return true;
+            }
+            frame_offset += get_type_size(fn->param_types[i]);
+        }
+    }
+
+    source_error(expr->offset, "use of undefined variable %s\n", intern_str(identifier));
+    return false;
+}
+
+static bool resolve_assign(Expr* expr) {
+    const InternId identifier = expr->assign.identifier;
+    const SymbolId symbol = symbol_lookup(identifier);
+
+    if(symbol == SYMBOL_NONE || !defined[symbol] || symbol_at(symbol)->stype != SYM_VAR) {
+        source_error(expr->offset, "cannot assign non-existant variable %s\n", intern_str(identifier));
+        return false;
+    }
+
+    expr->assign.symbol = symbol;
+    return true;
+}
+
+static bool resolve_tree(const ExprTree* tree) {
+    bool has_error = false;
+
+    for(size_t i = 0; i < tree->len; ++i) {
+        Expr* expr = &tree->nodes[i];
+        switch(expr->tag) {
+            case EXPR_LITERAL:
+                if(expr->literal.tag == VAL_IDENTIFIER && !resolve_variable(expr))
+                    has_error = true;
+                break;
+            case EXPR_ASSIGN:
+                if(!resolve_assign(expr))
+                    has_error = true;
+                break;
+            case EXPR_VAR_DEF:
+                defined[expr->var_def.symbol] = true;
+                break;
+            default:
+                break;
+        }
+    }
+
+    return !has_error;
+}
+
+bool resolve_names(ExprTree* trees, size_t n_trees) {
+    grow_defined();
+
+    bool has_error = false;
+    for(size_t i = 0; i < n_trees; ++i) {
+        if(!resolve_tree(&trees[i]))
+            has_error = true;
+    }
+
+    return !has_error;
+}
+
+void resolve_free(void) {
+    free(defined);
+    defined = NULL;
+    defined_capacity = 0;
+}
@@ -0,0 +1,12 @@
+#ifndef RESOLVE_H
+#define RESOLVE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "expr.h"
+
+bool resolve_names(ExprTree* trees, size_t n_trees);
+void resolve_free(void);
+
+#endif // RESOLVE_H
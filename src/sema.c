@@ -1,26 +1,43 @@
 #include <stdbool.h>
 #include <stdio.h>
 
+#include "cfg.h"
+#include "dataflow.h"
 #include "expr.h"
+#include "intern.h"
 #include "sema.h"
+#include "symbol.h"
 
+// Reused between functions so that its storage only grows
+static Cfg cfg = { 0 };
+
+// Every path through a function, including those through nested if
+// statements and loops, must end in a return
 bool sema_fn(Expr* expr) {
-    if(expr->fn_def.body[expr->fn_def.body_len - 1]->tag != EXPR_RETURN) {
-        fprintf(stderr, "error: function `%s` must return value\n", expr->fn_def.identifier);
+    cfg_build(&cfg, expr);
+    if(!definitely_returns(&cfg)) {
+        fprintf(stderr, "error: function `%s` must return value\n", intern_str(symbol_at(expr->fn_def.symbol)->identifier));
         return false;
     }
     return true;
 }
 
-bool sema_analyze(Expr **exprs, size_t n_exprs) {
-    for(size_t i = 0; i < n_exprs; ++i) {
-        switch(exprs[i]->tag) {
-            case EXPR_FN_DEF:
-                if(!sema_fn(exprs[i]))
-                    return false;
-            default:
-                break;
+bool sema_analyze(ExprTree* trees, size_t n_trees) {
+    for(size_t i = 0; i < n_trees; ++i) {
+        for(uint32_t j = 0; j < trees[i].len; ++j) {
+            Expr* expr = &trees[i].nodes[j];
+            switch(expr->tag) {
+                case EXPR_FN_DEF:
+                    if(!sema_fn(expr))
+                        return false;
+                default:
+                    break;
+            }
         }
     }
     return true;
 }
+
+void sema_free(void) {
+    cfg_free(&cfg);
+}
@@ -5,6 +5,7 @@
 
 #include "expr.h"
 
-bool sema_analyze(Expr** exprs, size_t n_exprs);
+bool sema_analyze(ExprTree* trees, size_t n_trees);
+void sema_free(void);
 
 #endif // SEMA_H
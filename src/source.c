@@ -0,0 +1,171 @@
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "source.h"
+
+Source* current_source = NULL;
+
+// Buffer this thread's diagnostics are redirected into, NULL for stderr
+static _Thread_local DiagnosticBuffer* redirected = NULL;
+
+// Guards the lazily built line table, which threads reporting errors at the
+// same time would otherwise race to build
+static pthread_mutex_t line_starts_lock = PTHREAD_MUTEX_INITIALIZER;
+
+bool source_open(Source* src, const char* path) {
+    *src = (Source) { .path = path, .data = "" };
+
+    const int fd = open(path, O_RDONLY);
+    if(fd == -1) {
+        fprintf(stderr, "error: failed to open file '%s' for reading\n", path);
+        return false;
+    }
+
+    struct stat st;
+    if(fstat(fd, &st) == -1 || !S_ISREG(st.st_mode)) {
+        fprintf(stderr, "error: '%s' is not a regular file\n", path);
+        close(fd);
+        return false;
+    }
+
+    // Tokens store 32-bit offsets into the source
+    if((uint64_t)st.st_size > UINT32_MAX) {
+        fprintf(stderr, "error: '%s' is too large, sources are limited to 4 GiB\n", path);
+        close(fd);
+        return false;
+    }
+
+    // `mmap` rejects zero-length mappings, an empty file simply lexes to eof
+    if(st.st_size == 0) {
+        close(fd);
+        return true;
+    }
+
+    void* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(data == MAP_FAILED) {
+        fprintf(stderr, "error: failed to map file '%s' into memory\n", path);
+        return false;
+    }
+
+    // Lexing is a single forward pass over the file
+    madvise(data, st.st_size, MADV_SEQUENTIAL);
+
+    src->data = data;
+    src->len = st.st_size;
+    return true;
+}
+
+void source_close(Source* src) {
+    if(src->len)
+        munmap((void*)src->data, src->len);
+    free(src->line_starts);
+    src->data = "";
+    src->len = 0;
+    src->line_starts = NULL;
+    src->n_lines = 0;
+}
+
+static void build_line_starts(Source* src) {
+    size_t capacity = 256;
+    src->line_starts = malloc(sizeof(uint32_t) * capacity);
+    src->line_starts[0] = 0;
+    src->n_lines = 1;
+
+    const char* at = src->data;
+    const char* end = src->data + src->len;
+    while((at = memchr(at, '\n', end - at))) {
+        ++at;
+        if(src->n_lines == capacity) {
+            capacity *= 2;
+            src->line_starts = realloc(src->line_starts, sizeof(uint32_t) * capacity);
+        }
+        src->line_starts[src->n_lines++] = at - src->data;
+    }
+}
+
+// Resolves a byte offset into a zero-based line and column
+void source_position(Source* src, size_t offset, size_t* line, size_t* column) {
+    pthread_mutex_lock(&line_starts_lock);
+    if(!src->line_starts)
+        build_line_starts(src);
+    pthread_mutex_unlock(&line_starts_lock);
+
+    // Find the last line starting at or before `offset`
+    size_t low = 0;
+    size_t high = src->n_lines;
+    while(high - low > 1) {
+        const size_t mid = low + (high - low) / 2;
+        if(src->line_starts[mid] <= offset)
+            low = mid;
+        else
+            high = mid;
+    }
+
+    *line = low;
+    *column = offset - src->line_starts[low];
+}
+
+void diagnostics_redirect(DiagnosticBuffer* buffer) {
+    redirected = buffer;
+}
+
+// Writes out and releases everything buffered in `buffer`
+void diagnostics_flush(DiagnosticBuffer* buffer) {
+    if(buffer->len)
+        fwrite(buffer->data, 1, buffer->len, stderr);
+    free(buffer->data);
+    *buffer = (DiagnosticBuffer) { 0 };
+}
+
+static void diagnostic_vprintf(const char* format, va_list args) {
+    if(!redirected) {
+        vfprintf(stderr, format, args);
+        return;
+    }
+
+    DiagnosticBuffer* buffer = redirected;
+    va_list copy;
+    va_copy(copy, args);
+    const int len = vsnprintf(NULL, 0, format, copy);
+    va_end(copy);
+    if(len < 0)
+        return;
+
+    if(buffer->len + len + 1 > buffer->capacity) {
+        buffer->capacity = buffer->capacity ? buffer->capacity : 256;
+        while(buffer->len + len + 1 > buffer->capacity)
+            buffer->capacity *= 2;
+        buffer->data = realloc(buffer->data, buffer->capacity);
+    }
+
+    vsnprintf(buffer->data + buffer->len, len + 1, format, args);
+    buffer->len += len;
+}
+
+void diagnostic_printf(const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    diagnostic_vprintf(format, args);
+    va_end(args);
+}
+
+void source_error(size_t offset, const char* format, ...) {
+    size_t line, column;
+    source_position(current_source, offset, &line, &column);
+    diagnostic_printf("%s:%lu:%lu: error: ", current_source->path, line + 1, column + 1);
+
+    va_list args;
+    va_start(args, format);
+    diagnostic_vprintf(format, args);
+    va_end(args);
+}
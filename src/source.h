@@ -0,0 +1,44 @@
+#ifndef SOURCE_H
+#define SOURCE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// A source file mapped read-only into memory. The mapping is not
+// NUL-terminated, so consumers must always respect `len`.
+typedef struct {
+    const char* path;
+    const char* data;
+    size_t len;
+
+    // Offset at which each line starts. Positions are tracked as byte offsets
+    // everywhere else, this table is only built once a diagnostic needs a
+    // line and column.
+    uint32_t* line_starts;
+    size_t n_lines;
+} Source;
+
+// The source being compiled, diagnostics are reported against it
+extern Source* current_source;
+
+bool source_open(Source* src, const char* path);
+void source_close(Source* src);
+
+// Diagnostics are written to stderr unless the calling thread has
+// redirected them into a buffer. Work done in parallel buffers its
+// diagnostics so they can be flushed in source order afterwards.
+typedef struct {
+    char* data;
+    size_t len;
+    size_t capacity;
+} DiagnosticBuffer;
+
+void diagnostics_redirect(DiagnosticBuffer* buffer);
+void diagnostics_flush(DiagnosticBuffer* buffer);
+void diagnostic_printf(const char* format, ...) __attribute__((format(printf, 1, 2)));
+
+void source_position(Source* src, size_t offset, size_t* line, size_t* column);
+void source_error(size_t offset, const char* format, ...) __attribute__((format(printf, 2, 3)));
+
+#endif // SOURCE_H
@@ -5,44 +5,138 @@
 #include "symbol.h"
 #include "token.h"
 
-Symbol* symbol_table = NULL;
-size_t symbol_table_len = 0;
-
-Symbol symbol_add_var(const char* identifier, ValueTag type) {
-    ++symbol_table_len;
-    symbol_table = realloc(symbol_table, sizeof(Symbol) * symbol_table_len);
-    symbol_table[symbol_table_len - 1] = (Symbol) {
-        .exists = true,
+// Symbols are stored in fixed-size chunks which are never moved, so pointers
+// to them remain valid as more symbols are added
+#define CHUNK_SHIFT 10
+#define CHUNK_SIZE (1 << CHUNK_SHIFT)
+
+static Symbol** chunks = NULL;
+static size_t chunks_capacity = 0;
+size_t n_symbols = 0;
+
+// Open addressing table of `id + 1` keyed by identifier, zero marks an empty
+// slot
+static SymbolId* slots = NULL;
+static InternId* slot_identifiers = NULL;
+static size_t n_slots = 0;
+
+// Intern IDs are dense, and multiplying by an odd constant maps consecutive
+// IDs to distinct slots
+static size_t hash_identifier(InternId identifier) {
+    return (uint32_t)(identifier * 2654435761u);
+}
+
+static void grow_slots(void) {
+    const size_t new_n_slots = n_slots ? n_slots * 2 : 1024;
+    SymbolId* new_slots = calloc(new_n_slots, sizeof(SymbolId));
+    InternId* new_identifiers = malloc(sizeof(InternId) * new_n_slots);
+
+    for(size_t i = 0; i < n_slots; ++i) {
+        if(!slots[i])
+            continue;
+
+        size_t j = hash_identifier(slot_identifiers[i]) & (new_n_slots - 1);
+        while(new_slots[j])
+            j = (j + 1) & (new_n_slots - 1);
+        new_slots[j] = slots[i];
+        new_identifiers[j] = slot_identifiers[i];
+    }
+
+    free(slots);
+    free(slot_identifiers);
+    slots = new_slots;
+    slot_identifiers = new_identifiers;
+    n_slots = new_n_slots;
+}
+
+// Slot holding `identifier`, or the empty slot it would be inserted into
+static size_t find_slot(InternId identifier) {
+    size_t i = hash_identifier(identifier) & (n_slots - 1);
+    while(slots[i] && slot_identifiers[i] != identifier)
+        i = (i + 1) & (n_slots - 1);
+    return i;
+}
+
+// Callers check that `symbol.identifier` is not already defined
+static SymbolId symbol_add(Symbol symbol) {
+    // Keep the load factor at or below one half
+    if((n_symbols + 1) * 2 > n_slots)
+        grow_slots();
+
+    const size_t chunk = n_symbols >> CHUNK_SHIFT;
+    if(chunk == chunks_capacity) {
+        chunks_capacity = chunks_capacity ? chunks_capacity * 2 : 16;
+        chunks = realloc(chunks, sizeof(Symbol*) * chunks_capacity);
+    }
+    if(!(n_symbols & (CHUNK_SIZE - 1)))
+        chunks[chunk] = malloc(sizeof(Symbol) * CHUNK_SIZE);
+
+    const SymbolId id = n_symbols++;
+    *symbol_at(id) = symbol;
+
+    const size_t slot = find_slot(symbol.identifier);
+    slots[slot] = id + 1;
+    slot_identifiers[slot] = symbol.identifier;
+    return id;
+}
+
+SymbolId symbol_add_var(InternId identifier, ValueTag type) {
+    return symbol_add((Symbol) {
         .identifier = identifier,
         .type = type,
         .stype = SYM_VAR,
-    };
-    return symbol_table[symbol_table_len - 1];
+    });
 }
 
-Symbol symbol_add_fn(const char* identifier, ValueTag* param_types, const char** param_identifiers, size_t n_params, ValueTag return_type) {
-    ++symbol_table_len;
-    symbol_table = realloc(symbol_table, sizeof(Symbol) * symbol_table_len);
-    symbol_table[symbol_table_len - 1] = (Symbol) {
-        .exists = true,
+SymbolId symbol_add_fn(InternId identifier, ValueTag* param_types, const InternId* param_identifiers, size_t n_params, ValueTag return_type) {
+    return symbol_add((Symbol) {
         .identifier = identifier,
         .param_types = param_types,
         .param_identifiers = param_identifiers,
         .n_params = n_params,
         .return_type = return_type,
         .stype = SYM_FN,
-    };
-    return symbol_table[symbol_table_len - 1];
+    });
 }
 
-Symbol symbol_get(const char* identifier) {
-    for(size_t i = 0; i < symbol_table_len; ++i) {
-        if(strcmp(identifier, symbol_table[i].identifier) == 0)
-            return symbol_table[i];
-    }
-    return (Symbol) { .exists = false };
+SymbolId symbol_lookup(InternId identifier) {
+    if(!n_slots)
+        return SYMBOL_NONE;
+    // An empty slot wraps around to SYMBOL_NONE
+    return slots[find_slot(identifier)] - 1;
+}
+
+Symbol* symbol_at(SymbolId id) {
+    return &chunks[id >> CHUNK_SHIFT][id & (CHUNK_SIZE - 1)];
+}
+
+// Returns NULL if `identifier` is not defined
+Symbol* symbol_get(InternId identifier) {
+    const SymbolId id = symbol_lookup(identifier);
+    if(id == SYMBOL_NONE)
+        return NULL;
+    return symbol_at(id);
 }
 
-bool symbol_exists(const char* identifier) {
-    return symbol_get(identifier).exists;
+bool symbol_exists(InternId identifier) {
+    return symbol_lookup(identifier) != SYMBOL_NONE;
+}
+
+void symbol_free_all(void) {
+    for(size_t i = 0; i < n_symbols; ++i) {
+        // Identifiers themselves are owned by the intern table
+        const Symbol* symbol = symbol_at(i);
+        free((void*)symbol->param_identifiers);
+        free((void*)symbol->param_types);
+    }
+
+    for(size_t i = 0; i < (n_symbols + CHUNK_SIZE - 1) >> CHUNK_SHIFT; ++i)
+        free(chunks[i]);
+    free(chunks);
+    free(slots);
+    free(slot_identifiers);
+    chunks = NULL;
+    slots = NULL;
+    slot_identifiers = NULL;
+    n_symbols = chunks_capacity = n_slots = 0;
 }
@@ -3,7 +3,9 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 
+#include "intern.h"
 #include "token.h" // Needed for `ValueTag`
 
 // Structural type of the symbol
@@ -13,22 +15,28 @@ typedef enum {
 } StructType;
 
 typedef struct {
-    bool exists;
-    const char* identifier;
+    InternId identifier;
     ValueTag type;
     StructType stype;
     ValueTag* param_types;
-    const char** param_identifiers;
+    const InternId* param_identifiers;
     size_t n_params;
     ValueTag return_type;
 } Symbol;
 
-extern Symbol* symbol_table;
-extern size_t symbol_table_len;
+// Symbols are numbered densely in the order they are added. Expressions
+// refer to symbols by ID rather than embedding copies of them.
+typedef uint32_t SymbolId;
+#define SYMBOL_NONE UINT32_MAX
 
-Symbol symbol_add_var(const char* identifier, ValueTag type);
-Symbol symbol_add_fn(const char* identifier, ValueTag* param_types, const char** param_identifiers, size_t n_params, ValueTag return_type);
-Symbol symbol_get(const char* identifier);
-bool symbol_exists(const char* identifier);
+extern size_t n_symbols;
+
+SymbolId symbol_add_var(InternId identifier, ValueTag type);
+SymbolId symbol_add_fn(InternId identifier, ValueTag* param_types, const InternId* param_identifiers, size_t n_params, ValueTag return_type);
+SymbolId symbol_lookup(InternId identifier);
+Symbol* symbol_at(SymbolId id);
+Symbol* symbol_get(InternId identifier);
+bool symbol_exists(InternId identifier);
+void symbol_free_all(void);
 
 #endif // SYMBOL_H
@@ -1,5 +1,8 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
+#include "global.h"
 #include "token.h"
 
 const char* token_strs[] = {
@@ -42,6 +45,61 @@ const char* token_strs[] = {
     "eof",
 };
 
+void token_stream_push(TokenStream* stream, Token tok) {
+    if(stream->len == stream->capacity) {
+        stream->capacity = stream->capacity ? stream->capacity * 2 : 64;
+        stream->types = realloc(stream->types, sizeof(uint8_t) * stream->capacity);
+        stream->offsets = realloc(stream->offsets, sizeof(uint32_t) * stream->capacity);
+        stream->payloads = realloc(stream->payloads, sizeof(uint32_t) * stream->capacity);
+    }
+
+    stream->types[stream->len] = tok.type;
+    stream->offsets[stream->len] = tok.offset;
+    stream->payloads[stream->len] = tok.payload;
+    ++stream->len;
+}
+
+Token token_stream_get(const TokenStream* stream, size_t i) {
+    return (Token) {
+        .type = stream->types[i],
+        .offset = stream->offsets[i],
+        .payload = stream->payloads[i],
+    };
+}
+
+// Removes the first `n` tokens of the stream
+void token_stream_discard(TokenStream* stream, size_t n) {
+    const size_t remaining = stream->len - n;
+    memmove(stream->types, stream->types + n, sizeof(uint8_t) * remaining);
+    memmove(stream->offsets, stream->offsets + n, sizeof(uint32_t) * remaining);
+    memmove(stream->payloads, stream->payloads + n, sizeof(uint32_t) * remaining);
+    stream->len = remaining;
+}
+
+void token_stream_free(TokenStream* stream) {
+    free(stream->types);
+    free(stream->offsets);
+    free(stream->payloads);
+    *stream = (TokenStream) { 0 };
+}
+
+// Builds the value of a literal token from its payload
+Value token_value(Token tok) {
+    switch(tok.type) {
+        case TOK_INT:
+            return (Value) { .tag = VAL_INT, .val_int = (int)tok.payload };
+        case TOK_BOOL:
+            return (Value) { .tag = VAL_BOOL, .val_bool = tok.payload };
+        case TOK_STRING:
+            return *global_get(tok.payload);
+        case TOK_IDENTIFIER:
+            return (Value) { .tag = VAL_IDENTIFIER, .identifier = tok.payload };
+
+        default:
+            return (Value) { .tag = VAL_NONE };
+    }
+}
+
 ValueTag token_type_to_value_tag(TokenType type) {
     switch(type) {
         case TOK_TYPE_INT:
@@ -3,6 +3,7 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 
 #include "value.h"
 
@@ -54,14 +55,28 @@ typedef enum {
     TOK_EOF,
 } TokenType;
 
+// A single token. Its line and column are not stored, they are resolved from
+// `offset` only when a diagnostic is reported.
 typedef struct {
     TokenType type;
-    Value value;
-    
-    const char* source_path;
-    size_t line, column;
+    uint32_t offset; // Offset of the lexemme within the source
+    uint32_t payload; // Value of int and bool tokens, string global ID or identifier intern ID
 } Token;
 
+// Tokens stored as parallel arrays, 9 bytes each
+typedef struct {
+    uint8_t* types;
+    uint32_t* offsets;
+    uint32_t* payloads;
+    size_t len, capacity;
+} TokenStream;
+
+void token_stream_push(TokenStream* stream, Token tok);
+Token token_stream_get(const TokenStream* stream, size_t i);
+void token_stream_discard(TokenStream* stream, size_t n);
+void token_stream_free(TokenStream* stream);
+
+Value token_value(Token tok);
 ValueTag token_type_to_value_tag(TokenType type);
 
 #endif // TOKEN_H
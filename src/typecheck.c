@@ -1,56 +1,62 @@
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "expr.h"
+#include "intern.h"
+#include "source.h"
 #include "symbol.h"
 #include "token.h"
 #include "typecheck.h"
 #include "value.h"
 
-#define REPORT_ERROR(op, ...) \
-    fprintf(stderr, "%s:%lu:%lu: error: ", op.source_path, op.line + 1, op.column + 1); \
-    fprintf(stderr, __VA_ARGS__)
+#define REPORT_ERROR(expr, ...) source_error((expr)->offset, __VA_ARGS__)
 
-static ValueTag get_expr_value(Expr* expr);
+// Trees are checked in a single linear pass. Nodes are stored in post-order,
+// so the types of an expression's children are always known by the time the
+// expression itself is reached. Each node is annotated with its type and
+// size, which codegen reads back rather than working them out again.
+static ValueTag child_type(Expr* expr, ExprRef ref) {
+    return expr_child(expr, ref)->type;
+}
 
-static ValueTag get_literal_value(Expr* expr) {
-    switch(expr->literal.value.tag) {
-        case TOK_IDENTIFIER: {
-            if(symbol_exists(expr->literal.value.identifier)) {
-                // this symbol is not guarenteed to be a variable
-                return symbol_get(expr->literal.value.identifier).type;
-            }
-            if(expr->parent_fn.exists) {
-                for(size_t i = 0; i < expr->parent_fn.n_params; ++i) {
-                    return expr->parent_fn.param_types[i];
-                }
-            }
-            fprintf(stderr, "error: failed to resolve type of identifier '%s'", expr->literal.value.identifier);
-            return VAL_ERROR;
-        }
-        default:
-            return expr->literal.value.tag;
-    }
+// Statements have no type of their own, but are erroneous if any expression
+// of `body` is
+static bool body_has_error(Expr* expr, ExprRef body) {
+    for(Expr* stmt = expr_child(expr, body); stmt; stmt = expr_next(stmt))
+        if(stmt->type == VAL_ERROR)
+            return true;
+    return false;
+}
+
+static ValueTag get_variable_value(Expr* expr) {
+    const Symbol* symbol = symbol_at(expr->variable.symbol);
+    if(expr->variable.param == PARAM_NONE)
+        return symbol->type;
+    return symbol->param_types[expr->variable.param];
 }
 
 static ValueTag get_unary_value(Expr* expr) {
-    const Token op = expr->unary.op;
-    const ValueTag rhs = get_expr_value(expr->unary.rhs);
+    const TokenType op = expr->op;
+    const ValueTag rhs = child_type(expr, expr->unary.rhs);
     if(rhs == VAL_ERROR)
         return VAL_ERROR;
 
-    switch(op.type) {
+    switch(op) {
         case TOK_MINUS:
             if(rhs != VAL_INT) {
-                REPORT_ERROR(op, "cannot perform %s operation on type %s\n", token_strs[op.type], type_strs[rhs]);
+                REPORT_ERROR(expr, "cannot perform %s operation on type %s\n", token_strs[op], type_strs[rhs]);
                 return VAL_ERROR;
             }
             return VAL_INT;
         case TOK_NOT:
             if(rhs != VAL_BOOL) {
-                REPORT_ERROR(op, "cannot perform %s operation on type %s\n", token_strs[op.type], type_strs[rhs]);
+                REPORT_ERROR(expr, "cannot perform %s operation on type %s\n", token_strs[op], type_strs[rhs]);
                 return VAL_ERROR;
             }
             return VAL_BOOL;
@@ -61,21 +67,21 @@ static ValueTag get_unary_value(Expr* expr) {
 }
 
 static ValueTag get_binary_value(Expr* expr) {
-    const ValueTag lhs = get_expr_value(expr->binary.lhs);
+    const ValueTag lhs = child_type(expr, expr->binary.lhs);
     if(lhs == VAL_ERROR)
         return VAL_ERROR;
-    const ValueTag rhs = get_expr_value(expr->binary.rhs);
+    const ValueTag rhs = child_type(expr, expr->binary.rhs);
     if(rhs == VAL_ERROR)
         return VAL_ERROR;
-    const Token op = expr->binary.op;
+    const TokenType op = expr->op;
 
-    switch(op.type) {
+    switch(op) {
         case TOK_PLUS:
         case TOK_MINUS:
         case TOK_STAR:
         case TOK_SLASH:
             if(lhs != VAL_INT || rhs != VAL_INT) {
-                REPORT_ERROR(op, "cannot perform %s operation on types %s and %s\n", token_strs[op.type], type_strs[lhs], type_strs[rhs]);
+                REPORT_ERROR(expr, "cannot perform %s operation on types %s and %s\n", token_strs[op], type_strs[lhs], type_strs[rhs]);
                 return VAL_ERROR;
             }
             return VAL_INT;
@@ -83,7 +89,7 @@ static ValueTag get_binary_value(Expr* expr) {
         case TOK_EQUAL_EQUAL:
         case TOK_BANG_EQUAL:
             if(lhs != rhs) {
-                REPORT_ERROR(op, "cannot perform %s operation on types %s and %s\n", token_strs[op.type], type_strs[lhs], type_strs[rhs]);
+                REPORT_ERROR(expr, "cannot perform %s operation on types %s and %s\n", token_strs[op], type_strs[lhs], type_strs[rhs]);
                 return VAL_ERROR;
             }
             return VAL_BOOL;
@@ -93,7 +99,7 @@ static ValueTag get_binary_value(Expr* expr) {
         case TOK_GREATER:
         case TOK_GREATER_EQUAL:
             if(lhs != VAL_INT || rhs != VAL_INT) {
-                REPORT_ERROR(op, "cannot perform %s operation on types %s and %s\n", token_strs[op.type], type_strs[lhs], type_strs[rhs]);
+                REPORT_ERROR(expr, "cannot perform %s operation on types %s and %s\n", token_strs[op], type_strs[lhs], type_strs[rhs]);
                 return VAL_ERROR;
             }
             return VAL_BOOL;
@@ -103,22 +109,30 @@ static ValueTag get_binary_value(Expr* expr) {
     }
 }
 
+// Conditions must be bools, there is no implicit conversion from ints
+static bool check_condition(Expr* expr, ExprRef condition) {
+    const ValueTag cond_type = child_type(expr, condition);
+    if(cond_type == VAL_ERROR)
+        return false;
+    if(cond_type != VAL_BOOL) {
+        REPORT_ERROR(expr, "expected bool, found %s instead\n", type_strs[cond_type]);
+        return false;
+    }
+    return true;
+}
+
 static ValueTag get_if_value(Expr* expr) {
-    if(get_expr_value(expr->if_stmt.condition) == VAL_ERROR)
+    if(!check_condition(expr, expr->if_stmt.condition))
         return VAL_ERROR;
 
-    for(size_t i = 0; i < expr->if_stmt.if_body_len; ++i)
-        if(get_expr_value(expr->if_stmt.if_body[i]) == VAL_ERROR)
-            return VAL_ERROR;
-    for(size_t i = 0; i < expr->if_stmt.else_body_len; ++i)
-        if(get_expr_value(expr->if_stmt.else_body[i]) == VAL_ERROR)
-            return VAL_ERROR;
+    if(body_has_error(expr, expr->if_stmt.if_body) || body_has_error(expr, expr->if_stmt.else_body))
+        return VAL_ERROR;
     return VAL_NONE;
 }
 
 static ValueTag get_var_def_value(Expr* expr) {
     if(expr->var_def.initial_value) {
-        if(expr->var_def.type != get_expr_value(expr->var_def.initial_value))
+        if(expr->var_def.type != child_type(expr, expr->var_def.initial_value))
             // TODO: We should really be reporting an error here but we don't know where this expression begins in source
             return VAL_ERROR;
     }
@@ -126,64 +140,89 @@ static ValueTag get_var_def_value(Expr* expr) {
 }
 
 static ValueTag get_assign_value(Expr* expr) {
-    ValueTag expected_type = symbol_get(expr->assign.identifier).type;
-    ValueTag expr_type = get_expr_value(expr->assign.expr);
+    ValueTag expected_type = symbol_at(expr->assign.symbol)->type;
+    ValueTag expr_type = child_type(expr, expr->assign.expr);
+    if(expr_type == VAL_ERROR)
+        return VAL_ERROR;
+
+    // Compound assignments are arithmetic, so only apply to ints
+    if(expr->op != TOK_EQUAL && expected_type != VAL_INT) {
+        REPORT_ERROR(expr, "cannot perform %s operation on type %s\n", token_strs[expr->op], type_strs[expected_type]);
+        return VAL_ERROR;
+    }
 
     if(expected_type != expr_type) {
-        REPORT_ERROR(expr->assign.op, "cannot assign value of type %s to variable of type %s\n", type_strs[expr_type], type_strs[expected_type]);
+        REPORT_ERROR(expr, "cannot assign value of type %s to variable of type %s\n", type_strs[expr_type], type_strs[expected_type]);
         return VAL_ERROR;
     }
     return VAL_NONE;
 }
 
 static ValueTag get_while_value(Expr* expr) {
-    ValueTag cond_type = get_expr_value(expr->while_loop.condition);
-    if(cond_type != VAL_BOOL) {
-        fprintf(stderr, "error: expected bool, found %s instead\n", type_strs[cond_type]);
+    if(!check_condition(expr, expr->while_loop.condition))
         return VAL_ERROR;
-    }
-
-    for(size_t i = 0; i < expr->while_loop.body_len; ++i)
-        if(get_expr_value(expr->while_loop.body[i]) == VAL_ERROR)
-            return VAL_ERROR;
 
+    if(body_has_error(expr, expr->while_loop.body))
+        return VAL_ERROR;
     return VAL_NONE;
 }
 
 static ValueTag get_fn_def_value(Expr* expr) {
-    for(size_t i = 0; i < expr->fn_def.body_len; ++i) {
-        const Expr* curr_expr = expr->fn_def.body[i];
-        if(curr_expr->tag == EXPR_RETURN) {
-            if(get_expr_value(curr_expr->op_return.value_expr) != expr->fn_def.return_type) {
-                REPORT_ERROR(curr_expr->op_return.op, "expected %s, found %s instead\n",
-                    type_strs[expr->fn_def.return_type],
-                    type_strs[get_expr_value(curr_expr->op_return.value_expr)]
-                );
-                return VAL_ERROR;
-            }
-        } else {
-            if(get_expr_value((Expr*)curr_expr) == VAL_ERROR)
-                return VAL_ERROR;
-        }
-    }
-
+    if(body_has_error(expr, expr->fn_def.body))
+        return VAL_ERROR;
     return VAL_NONE;
 }
 
 static ValueTag get_fn_call_value(Expr* expr) {
-    return expr->fn_call.fn_symbol.return_type;
+    if(body_has_error(expr, expr->fn_call.params))
+        return VAL_ERROR;
+
+    const Symbol* fn = symbol_at(expr->fn_call.symbol);
+    size_t i = 0;
+    for(Expr* param = expr_child(expr, expr->fn_call.params); param; param = expr_next(param), ++i) {
+        if(param->type != fn->param_types[i]) {
+            REPORT_ERROR(expr, "parameter %lu of function '%s' expects %s, found %s instead\n",
+                i + 1, intern_str(fn->identifier),
+                type_strs[fn->param_types[i]],
+                type_strs[param->type]
+            );
+            return VAL_ERROR;
+        }
+    }
+    return fn->return_type;
+}
+
+// Returns are checked against the function they return from
+static ValueTag get_return_value(Expr* expr) {
+    const ValueTag value_type = child_type(expr, expr->op_return.value_expr);
+    if(value_type == VAL_ERROR)
+        return VAL_ERROR;
+    if(expr->op_return.parent_fn == SYMBOL_NONE)
+        return VAL_NONE;
+
+    const ValueTag return_type = symbol_at(expr->op_return.parent_fn)->return_type;
+    if(value_type != return_type) {
+        REPORT_ERROR(expr, "expected %s, found %s instead\n",
+            type_strs[return_type],
+            type_strs[value_type]
+        );
+        return VAL_ERROR;
+    }
+    return VAL_NONE;
 }
 
 static ValueTag get_expr_value(Expr* expr) {
     switch(expr->tag) {
         case EXPR_LITERAL:
-            return get_literal_value(expr);
+            return expr->literal.tag;
+        case EXPR_VARIABLE:
+            return get_variable_value(expr);
         case EXPR_UNARY:
             return get_unary_value(expr);
         case EXPR_BINARY:
             return get_binary_value(expr);
         case EXPR_GROUPING:
-            return get_expr_value(expr->grouping.expr);
+            return child_type(expr, expr->grouping.expr);
         case EXPR_IF:
             return get_if_value(expr);
         case EXPR_VAR_DEF:
@@ -197,17 +236,103 @@ static ValueTag get_expr_value(Expr* expr) {
         case EXPR_FN_CALL:
             return get_fn_call_value(expr);
         case EXPR_RETURN:
-            return VAL_NONE;
+            return get_return_value(expr);
+    }
+}
+
+static bool typecheck_tree(const ExprTree* tree) {
+    for(size_t i = 0; i < tree->len; ++i) {
+        Expr* expr = &tree->nodes[i];
+        expr->type = get_expr_value(expr);
+        expr->size = expr->type == VAL_NONE || expr->type == VAL_ERROR ? 0 : get_type_size(expr->type);
+    }
+
+    return expr_tree_root(tree)->type != VAL_ERROR;
+}
+
+// Trees only read the symbol table and their own nodes, so any number of
+// them can be checked at once. Trees are split into chunks which are handed
+// out to a pool of threads in order. Each chunk buffers its diagnostics,
+// which are flushed chunk by chunk once every thread has finished, so they
+// are reported in source order whatever order the chunks completed in.
+#define CHUNK_TREES 64
+
+static size_t n_jobs = 0;
+
+static ExprTree* job_trees = NULL;
+static size_t job_n_trees = 0;
+static DiagnosticBuffer* job_diagnostics = NULL;
+static atomic_size_t next_chunk = 0;
+static atomic_bool job_has_error = false;
+
+static void* check_chunks(void* arg) {
+    (void)arg;
+
+    const size_t n_chunks = (job_n_trees + CHUNK_TREES - 1) / CHUNK_TREES;
+    for(size_t chunk; (chunk = atomic_fetch_add(&next_chunk, 1)) < n_chunks;) {
+        diagnostics_redirect(&job_diagnostics[chunk]);
+
+        const size_t first = chunk * CHUNK_TREES;
+        const size_t end = first + CHUNK_TREES < job_n_trees ? first + CHUNK_TREES : job_n_trees;
+        for(size_t i = first; i < end; ++i) {
+            if(!typecheck_tree(&job_trees[i]))
+                atomic_store(&job_has_error, true);
+        }
+
+        diagnostics_redirect(NULL);
     }
+
+    return NULL;
 }
 
-bool typecheck_exprs(Expr** exprs, size_t n_exprs) {
-    bool has_error = false;
+// 0 uses one thread per online processor
+void typecheck_set_jobs(size_t jobs) {
+    n_jobs = jobs;
+}
 
-    for(size_t i = 0; i < n_exprs; ++i) {
-        if(get_expr_value(exprs[i]) == VAL_ERROR)
-            has_error = true;
+bool typecheck_exprs(ExprTree* trees, size_t n_trees) {
+    size_t jobs = n_jobs;
+    if(!jobs) {
+        const long online = sysconf(_SC_NPROCESSORS_ONLN);
+        jobs = online > 0 ? online : 1;
     }
 
-    return !has_error;
+    const size_t n_chunks = (n_trees + CHUNK_TREES - 1) / CHUNK_TREES;
+    if(jobs > n_chunks)
+        jobs = n_chunks;
+
+    // Not worth starting any threads for
+    if(jobs <= 1) {
+        bool has_error = false;
+        for(size_t i = 0; i < n_trees; ++i) {
+            if(!typecheck_tree(&trees[i]))
+                has_error = true;
+        }
+        return !has_error;
+    }
+
+    job_trees = trees;
+    job_n_trees = n_trees;
+    job_diagnostics = calloc(n_chunks, sizeof(DiagnosticBuffer));
+    atomic_store(&next_chunk, 0);
+    atomic_store(&job_has_error, false);
+
+    // The calling thread checks chunks alongside the pool
+    pthread_t* threads = malloc(sizeof(pthread_t) * (jobs - 1));
+    size_t n_threads = 0;
+    for(; n_threads < jobs - 1; ++n_threads) {
+        if(pthread_create(&threads[n_threads], NULL, check_chunks, NULL) != 0)
+            break;
+    }
+    check_chunks(NULL);
+    for(size_t i = 0; i < n_threads; ++i)
+        pthread_join(threads[i], NULL);
+    free(threads);
+
+    for(size_t i = 0; i < n_chunks; ++i)
+        diagnostics_flush(&job_diagnostics[i]);
+    free(job_diagnostics);
+    job_diagnostics = NULL;
+
+    return !atomic_load(&job_has_error);
 }
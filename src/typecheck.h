@@ -6,6 +6,7 @@
 
 #include "expr.h"
 
-bool typecheck_exprs(Expr** exprs, size_t n_exprs);
+void typecheck_set_jobs(size_t jobs);
+bool typecheck_exprs(ExprTree* trees, size_t n_trees);
 
 #endif // TYPECHECK_H
@@ -4,6 +4,8 @@
 #include <stdbool.h>
 #include <stddef.h>
 
+#include "intern.h"
+
 extern const char* type_strs[];
 
 #define SIZE_INT 8
@@ -25,8 +27,8 @@ typedef struct {
     union {
         struct { int val_int; };
         struct { bool val_bool; };
-        struct { const char* val_string; };
-        struct { const char* identifier; };
+        struct { const char* val_string; size_t val_string_len; };
+        struct { InternId identifier; };
     };
 } Value;
 
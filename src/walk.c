@@ -0,0 +1,45 @@
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "expr.h"
+#include "walk.h"
+
+void walk_push(ExprWalk* walk, Expr* expr, uint32_t step, uint32_t data) {
+    if(walk->len == walk->capacity) {
+        walk->capacity = walk->capacity ? walk->capacity * 2 : 64;
+        walk->frames = realloc(walk->frames, sizeof(ExprFrame) * walk->capacity);
+    }
+    walk->frames[walk->len++] = (ExprFrame) { .expr = expr, .step = step, .data = data };
+}
+
+// Queues every expression of a list, such as a body, to be visited in order.
+// Unless `after_step` is 0 each expression is revisited with that step once
+// it has been finished, which lets a pass deal with its result.
+void walk_push_list(ExprWalk* walk, Expr* first, uint32_t after_step, uint32_t data) {
+    const size_t start = walk->len;
+    for(Expr* expr = first; expr; expr = expr_next(expr)) {
+        walk_push(walk, expr, 0, data);
+        if(after_step)
+            walk_push(walk, expr, after_step, data);
+    }
+
+    // Lists can only be followed forwards, so they are pushed in order and
+    // reversed in place
+    for(size_t i = start, j = walk->len; i + 1 < j; ++i, --j) {
+        const ExprFrame temp = walk->frames[i];
+        walk->frames[i] = walk->frames[j - 1];
+        walk->frames[j - 1] = temp;
+    }
+}
+
+bool walk_pop(ExprWalk* walk, ExprFrame* frame) {
+    if(!walk->len)
+        return false;
+    *frame = walk->frames[--walk->len];
+    return true;
+}
+
+void walk_free(ExprWalk* walk) {
+    free(walk->frames);
+    *walk = (ExprWalk) { 0 };
+}
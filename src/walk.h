@@ -0,0 +1,33 @@
+#ifndef WALK_H
+#define WALK_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "expr.h"
+
+// A pending visit of `expr`. `step` records how far a pass has got through
+// the expression, 0 being the first visit, and `data` is free for the pass to
+// use.
+typedef struct {
+    Expr* expr;
+    uint32_t step;
+    uint32_t data;
+} ExprFrame;
+
+// Explicit, heap-allocated work stack used by passes over trees in place of
+// recursion, so that nesting depth is only limited by memory. A pass pops a
+// frame, and to visit a child it pushes a frame to resume itself followed by
+// one for the child.
+typedef struct {
+    ExprFrame* frames;
+    size_t len, capacity;
+} ExprWalk;
+
+void walk_push(ExprWalk* walk, Expr* expr, uint32_t step, uint32_t data);
+void walk_push_list(ExprWalk* walk, Expr* first, uint32_t after_step, uint32_t data);
+bool walk_pop(ExprWalk* walk, ExprFrame* frame);
+void walk_free(ExprWalk* walk);
+
+#endif // WALK_H
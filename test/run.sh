@@ -0,0 +1,68 @@
+#!/bin/sh
+# Compiles and runs each test/*.bs, comparing its exit status with the one
+# given by its first line, `# expect: <status>`. Tests which must fail to
+# compile instead give `# expect: error <line>:<column>`, the position of
+# the first diagnostic. Each `# flags: <flags>` line runs the test once more
+# with those flags added.
+#
+# usage: test/run.sh [basalt flags]
+
+BASALT=${BASALT:-$(pwd)/bin/basalt}
+DIR=$(mktemp -d)
+trap 'rm -rf "$DIR"' EXIT
+
+passed=0
+failed=0
+
+# usage: run_test <name> <expected> [basalt flags]
+run_test() {
+    name=$1
+    expected=$2
+    shift 2
+
+    case $expected in
+        error*)
+            position=${expected#error }
+            if (cd "$DIR" && "$BASALT" "$@" $name.bs > /dev/null 2> errors); then
+                echo "FAIL $name $*: compiled, expected an error at $position"
+                failed=$((failed + 1))
+            elif ! head -n 1 "$DIR/errors" | grep -q "^$name.bs:$position: error:"; then
+                echo "FAIL $name $*: expected an error at $position, found $(head -n 1 "$DIR/errors")"
+                failed=$((failed + 1))
+            else
+                passed=$((passed + 1))
+            fi
+            return
+            ;;
+    esac
+
+    if ! (cd "$DIR" && "$BASALT" "$@" $name.bs > /dev/null); then
+        echo "FAIL $name $*: failed to compile"
+        failed=$((failed + 1))
+        return
+    fi
+
+    # The shell reports the signal which killed a test on its own stderr
+    status=$(cd "$DIR" && { ./$name > /dev/null; } 2> /dev/null; echo $?)
+    if [ "$status" != "$expected" ]; then
+        echo "FAIL $name $*: exited with $status, expected $expected"
+        failed=$((failed + 1))
+    else
+        passed=$((passed + 1))
+    fi
+}
+
+for test in test/*.bs; do
+    name=$(basename "$test" .bs)
+    expected=$(sed -n '1s/^# expect: *//p' "$test")
+    cp "$test" "$DIR/$name.bs"
+
+    run_test $name "$expected" "$@"
+    sed -n 's/^# flags: *//p' "$test" > "$DIR/flags"
+    while read -r flags; do
+        run_test $name "$expected" "$@" $flags
+    done < "$DIR/flags"
+done
+
+echo "$passed passed, $failed failed"
+[ $failed -eq 0 ]